@@ -1,8 +1,49 @@
 #include "arm_decoder.h"
 
+ARM_opcode ArmDecoder::_lookupTable[4096];
+
+//encodings that decode() recognizes using bits outside the lookup table index
+struct PartialEncoding {
+	uint32_t mask, format;
+};
+
+const PartialEncoding partialEncodings[] = {
+	{0b0000'1111'1111'1111'1111'1111'0000'0000, 0b0000'0001'0010'1111'1111'1111'0000'0000},	//BX
+	{0b0000'1111'1011'1111'0000'1111'1111'1111, 0b0000'0001'0000'1111'0000'0000'0000'0000},	//MRS
+	{0b0000'1111'1011'1111'1111'1111'1111'0000, 0b0000'0001'0010'1001'1111'0000'0000'0000},	//MSR
+	{0b0000'1101'1011'1111'1111'0000'0000'0000, 0b0000'0001'0010'1000'1111'0000'0000'0000}	//MSR immidiate
+};
+
+//true if the opcodes of a table entry don't all decode to the same instruction
+bool ArmDecoder::needsFullDecode(uint16_t index) {
+	uint32_t index_mask = 0b0000'1111'1111'0000'0000'0000'1111'0000;
+	uint32_t opcode = ((index & 0xff0) << 16) | ((index & 0x0f) << 4);
+
+	for (const PartialEncoding& enc : partialEncodings) {
+		uint32_t mask = enc.mask & index_mask;
+		if ((opcode & mask) == (enc.format & mask))
+			return true;	//could match depending on the other bits
+	}
+	return false;
+}
+
+//every other decoder rule only looks at bits 27-20 and 7-4, so decoding
+//one opcode per table entry gives the result for the whole entry
+void ArmDecoder::buildLookupTable() {
+	for (uint16_t i = 0; i < 4096; i++) {
+		if (needsFullDecode(i)) {
+			_lookupTable[i] = ARM_OP_UNRESOLVED;
+			continue;
+		}
+		uint32_t opcode = ((i & 0xff0) << 16) | ((i & 0x0f) << 4);
+		_lookupTable[i] = decode(opcode);
+	}
+}
+
 ARM_opcode ArmDecoder::decode(uint32_t opcode) {
 	ARM_opcode instr;
 
+	if ((opcode & 0x0f000000) == 0x0f000000) return ARM_OP_SWI;	//software interrupt
 	if (instr = ARM_IsBranch(opcode)) return instr;		//branches
 	if (instr = ARM_IsSDTHInst(opcode)) return instr;	//load/store halfword
 	if (instr = ARM_IsMultiplication(opcode)) return instr;
@@ -1,12 +1,20 @@
 #ifndef ARM_DECODER_H
 #define ARM_DECODER_H
 
-#include "cpu.h"
+#include "opcodes.h"
+
+#include <cstdint>
 
 class ArmDecoder {
 public:
 	static ARM_opcode decode(uint32_t opcode);
+	static void buildLookupTable();
+	static ARM_opcode lookup(uint32_t opcode);
+	static uint16_t tableIndex(uint32_t opcode);
+	static ARM_opcode tableEntry(uint16_t index);
 private:
+	static ARM_opcode _lookupTable[4096];	//indexed by opcode bits 27-20 and 7-4
+	static bool needsFullDecode(uint16_t index);
 	static ARM_opcode ARM_IsBranch(uint32_t opcode);	//branches
 	static ARM_opcode ARM_IsSDTHInst(uint32_t opcode);	//halfword data transfer
 	static ARM_opcode ARM_IsAluInst(uint32_t opcode);	//data processing
@@ -15,7 +23,23 @@ private:
 	static ARM_opcode ARM_IsMSR_MRS(uint32_t opcode);	//MSR/MRS
 	static ARM_opcode ARM_IsBlockDataTransfer(uint32_t opcode);
 	static ARM_opcode ARM_IsMultiplication(uint32_t opcode);
-private:
 };
 
+//lookup table index: opcode bits 27-20 and 7-4
+inline uint16_t ArmDecoder::tableIndex(uint32_t opcode) {
+	return ((opcode >> 16) & 0xff0) | ((opcode >> 4) & 0x0f);
+}
+
+inline ARM_opcode ArmDecoder::tableEntry(uint16_t index) {
+	return _lookupTable[index];
+}
+
+//same result as decode() using the lookup table
+inline ARM_opcode ArmDecoder::lookup(uint32_t opcode) {
+	ARM_opcode instr = _lookupTable[tableIndex(opcode)];
+	if (instr == ARM_OP_UNRESOLVED)
+		return decode(opcode);
+	return instr;
+}
+
 #endif
@@ -0,0 +1,71 @@
+#include "block_cache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+BlockCache::BlockCache() {
+	memset(_pageHasBlocks, 0, sizeof(_pageHasBlocks));
+	memset(_pageVersions, 0, sizeof(_pageVersions));
+	_generation = 0;
+	_invalidations = 0;
+	_hits = 0;
+	_lookups = 0;
+}
+
+//store a decoded block, in place of the stale one at the same address
+DecodedBlock* BlockCache::insert(DecodedBlock& block) {
+	uint32_t key = block.address | block.thumb;
+	DecodedBlock& stored = _blocks[key];
+	stored = std::move(block);
+	stored.version = getPageVersion(stored.address);
+
+	int page = pageIndex(stored.address);
+	if (page >= 0)	//rom blocks never go stale
+		_pageHasBlocks[page] = true;
+
+	return &stored;
+}
+
+void BlockCache::flush() {
+	_blocks.clear();
+	memset(_pageHasBlocks, 0, sizeof(_pageHasBlocks));
+	_generation++;
+}
+
+//memory that can hold decoded blocks
+bool BlockCache::isCacheable(uint32_t address) {
+	switch (address >> 24) {
+	case 0:		//bios
+		return address < 0x4000;
+	case 2:		//external wram
+	case 3:		//internal wram
+	case 8:		//game pak rom
+	case 9:
+	case 0xa:
+	case 0xb:
+	case 0xc:
+	case 0xd:
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint64_t BlockCache::getHits() {
+	return _hits;
+}
+
+uint64_t BlockCache::getLookups() {
+	return _lookups;
+}
+
+uint64_t BlockCache::getInvalidations() {
+	return _invalidations;
+}
+
+double BlockCache::getHitRate() {
+	if (_lookups == 0)
+		return 0;
+	return (double)_hits / _lookups;
+}
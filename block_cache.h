@@ -0,0 +1,118 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+class Cpu;
+struct Registers;
+typedef void (Cpu::*ArmHandler)(uint32_t opcode);
+typedef void (Cpu::*ThumbHandler)(uint16_t opcode);
+typedef void (*JitCode)(Cpu* cpu, Registers* reg);
+
+//instruction already fetched and bound to its handler
+struct DecodedInstruction {
+	union {
+		ArmHandler arm;
+		ThumbHandler thumb;
+	};
+	uint32_t opcode;
+};
+
+//run of instructions up to the next branch. never crosses a page
+struct DecodedBlock {
+	uint32_t address;
+	bool thumb;
+	std::vector<DecodedInstruction> instructions;
+	uint32_t executions;
+	JitCode code;	//native translation, nullptr until the block gets hot
+	bool idle;	//loops on itself and only reads memory: nothing changes until an event
+	uint32_t version;	//version of its page when it was decoded
+};
+
+class BlockCache {
+public:
+	static const uint32_t PAGE_SIZE = 0x100;
+	static const int MAX_BLOCK_LENGTH = 64;
+
+	BlockCache();
+	DecodedBlock* find(uint32_t address, bool thumb);
+	DecodedBlock* insert(DecodedBlock& block);
+	void invalidate(uint32_t address);
+	void flush();
+	static bool isCacheable(uint32_t address);
+	uint32_t getGeneration();
+	uint32_t getPageVersion(uint32_t address);
+	bool isValid(const DecodedBlock& block);
+	uint64_t getInvalidations();
+	uint64_t getHits();
+	uint64_t getLookups();
+	double getHitRate();
+private:
+	std::unordered_map<uint32_t, DecodedBlock> _blocks;	//key: address | thumb
+	bool _pageHasBlocks[0x4000 / PAGE_SIZE + 0x40000 / PAGE_SIZE + 0x8000 / PAGE_SIZE];	//writable code pages: bios, ewram, iwram
+	uint32_t _pageVersions[0x4000 / PAGE_SIZE + 0x40000 / PAGE_SIZE + 0x8000 / PAGE_SIZE];	//incremented on every write to the page
+	uint32_t _generation;	//incremented every time blocks go stale or are removed
+	uint64_t _invalidations;	//writes that made the blocks of a page stale
+	uint64_t _hits;
+	uint64_t _lookups;
+
+	static int pageIndex(uint32_t address);
+};
+
+//bios, ewram and iwram page that contains the address, -1 for memory that is never written
+inline int BlockCache::pageIndex(uint32_t address) {
+	switch (address >> 24) {
+	case 0:	//bios
+		return (address & 0x3fff) / PAGE_SIZE;
+	case 2:	//external wram
+		return 0x4000 / PAGE_SIZE + (address & 0x3ffff) / PAGE_SIZE;
+	case 3:	//internal wram
+		return 0x4000 / PAGE_SIZE + 0x40000 / PAGE_SIZE + (address & 0x7fff) / PAGE_SIZE;
+	default:
+		return -1;
+	}
+}
+
+//called on every memory write: the blocks decoded from that page are stale, find() drops them.
+//the running block stops if the page held blocks
+inline void BlockCache::invalidate(uint32_t address) {
+	int page = pageIndex(address);
+	if (page < 0)
+		return;
+
+	_pageVersions[page]++;
+	if (_pageHasBlocks[page]) {
+		_pageHasBlocks[page] = false;
+		_generation++;
+		_invalidations++;
+	}
+}
+
+//changes every time the page is written, 0 for memory that is never written
+inline uint32_t BlockCache::getPageVersion(uint32_t address) {
+	int page = pageIndex(address);
+	return page >= 0 ? _pageVersions[page] : 0;
+}
+
+//the memory the block was decoded from didn't change since
+inline bool BlockCache::isValid(const DecodedBlock& block) {
+	return block.version == getPageVersion(block.address);
+}
+
+//nullptr when the block isn't decoded or its page was written since: insert() replaces it
+inline DecodedBlock* BlockCache::find(uint32_t address, bool thumb) {
+	_lookups++;
+	auto it = _blocks.find(address | thumb);
+	if (it == _blocks.end() || !isValid(it->second))
+		return nullptr;
+	_hits++;
+	return &it->second;
+}
+
+inline uint32_t BlockCache::getGeneration() {
+	return _generation;
+}
+
+#endif
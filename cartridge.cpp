@@ -274,4 +274,12 @@ void Cartridge::write_16(uint32_t addr, uint16_t data) {
 void Cartridge::write_32(uint32_t addr, uint32_t data) {
 
 
-}
\ No newline at end of file
+}
+
+uint8_t* Cartridge::getRom() {
+	return _rom.get();
+}
+
+uint32_t Cartridge::getRomSize() {
+	return _romSize;
+}
@@ -30,6 +30,8 @@ public:
 	void write_8(uint32_t addr, uint8_t data);
 	void write_16(uint32_t addr, uint16_t data);
 	void write_32(uint32_t addr, uint32_t data);
+	uint8_t* getRom();
+	uint32_t getRomSize();
 private:
 	std::unique_ptr <uint8_t[]> _rom;
 	uint32_t _romSize;
@@ -2,23 +2,106 @@
 #include "lcd_controller.h"
 #include "gba.h"
 
+#include <algorithm>
+
 LcdController GBA::GBA::lcd_ctl;
 
 Clock::Clock() {
-	_ticks = 0;
+	_runningEvents = false;
+	clear();
+}
+
+unsigned long long Clock::getNextEvent() {
+	return _nextEvent;
+}
+
+Event_Type Clock::getNextEventType() {
+	return _scheduler.getNextType();
 }
 
-void Clock::addTicks(unsigned long long ticks) {
-	_ticks += ticks;
+//schedule an event at an absolute tick
+void Clock::schedule(Event_Type type, unsigned long long timestamp) {
+	_scheduler.schedule(type, timestamp);
+	if (!_runningEvents)
+		_nextEvent = _scheduler.getNextTimestamp();
+}
+
+void Clock::cancel(Event_Type type) {
+	_scheduler.cancel(type);
+	if (!_runningEvents)
+		_nextEvent = _scheduler.getNextTimestamp();
+}
+
+bool Clock::isScheduled(Event_Type type) {
+	return _scheduler.isScheduled(type);
+}
 
-	GBA::lcd_ctl.update_V_count(ticks);
-	GBA::sound.update_fifo_timers(ticks);
+//next event that can trigger a dma: h-blank and v-blank come with the lcd events, fifo refills
+//with the sound one. the sound can lag behind a transfer no fifo channel could preempt
+unsigned long long Clock::getDmaDeadline(bool fifo) {
+	unsigned long long deadline = std::min(_scheduler.getTimestamp(EVENT_HBLANK), _scheduler.getTimestamp(EVENT_LINE_END));
+	if (fifo)
+		deadline = std::min(deadline, _scheduler.getTimestamp(EVENT_SOUND));
+	return deadline;
 }
 
-unsigned long long Clock::getTicks() {
-	return _ticks;
+//move the clock back to replay the same ticks. only valid if no event ran and the sound wasn't synced since
+void Clock::rewind(unsigned long long ticks) {
+	_ticks = ticks;
+}
+
+//bring the fifo timers up to date
+void Clock::syncSound() {
+	GBA::sound.update_fifo_timers(_ticks - _soundTicks);
+	_soundTicks = _ticks;
+	GBA::memory.refillFifos();
+}
+
+//dispatch every event that is due. events are rescheduled from their own
+//timestamp, so a late dispatch doesn't shift the following ones
+void Clock::runEvents() {
+	if (_runningEvents)	//an event handler accessed memory (dma)
+		return;
+
+	_runningEvents = true;
+	_nextEvent = Scheduler::NO_EVENT;
+
+	while (_scheduler.getNextTimestamp() <= _ticks) {
+		unsigned long long timestamp = _scheduler.getNextTimestamp();
+		Event_Type type = _scheduler.pop();
+
+		switch (type) {
+		case EVENT_HBLANK:
+			_scheduler.schedule(EVENT_HBLANK, timestamp + LcdController::LINE_TICKS);
+			GBA::lcd_ctl.hblank();
+			break;
+		case EVENT_LINE_END:
+			_scheduler.schedule(EVENT_LINE_END, timestamp + LcdController::LINE_TICKS);
+			GBA::lcd_ctl.endLine();
+			break;
+		case EVENT_SOUND:
+			_scheduler.schedule(EVENT_SOUND, timestamp + SOUND_PERIOD);
+			syncSound();
+			break;
+		case EVENT_DMA:	//reschedules itself if an event can preempt it
+			GBA::memory.runDma();
+			break;
+		default:
+			break;
+		}
+	}
+
+	_nextEvent = _scheduler.getNextTimestamp();
+	_runningEvents = false;
 }
 
 void Clock::clear() {
 	_ticks = 0;
-}
\ No newline at end of file
+	_soundTicks = 0;
+
+	_scheduler.clear();
+	_scheduler.schedule(EVENT_HBLANK, LcdController::HDRAW_TICKS);
+	_scheduler.schedule(EVENT_LINE_END, LcdController::LINE_TICKS);
+	_scheduler.schedule(EVENT_SOUND, SOUND_PERIOD);
+	_nextEvent = _scheduler.getNextTimestamp();
+}
@@ -1,14 +1,47 @@
 #ifndef CLOCK_H
 #define CLOCK_H
 
+#include "scheduler.h"
+
 class Clock {
 public:
+	static const unsigned long long SOUND_PERIOD = 64;	//max ticks the fifo timers can lag behind
+	static const unsigned long long TICKS_PER_SECOND = 1 << 24;
+
 	Clock();
 	void addTicks(unsigned long long ticks);
 	unsigned long long getTicks();
+	unsigned long long getNextEvent();
+	Event_Type getNextEventType();
+	void schedule(Event_Type type, unsigned long long timestamp);
+	void cancel(Event_Type type);
+	bool isScheduled(Event_Type type);
+	unsigned long long getDmaDeadline(bool fifo);
+	void syncSound();
+	void rewind(unsigned long long ticks);
 	void clear();
 private:
+	friend class Jit;	//compiled code adds the fetch ticks directly
+
 	unsigned long long _ticks;
+	unsigned long long _nextEvent;	//timestamp of the earliest scheduled event
+	unsigned long long _soundTicks;	//ticks already passed to the sound controller
+	bool _runningEvents;
+	Scheduler _scheduler;
+
+	void runEvents();
 };
 
+//called on every memory access: only does work when an event is due
+inline void Clock::addTicks(unsigned long long ticks) {
+	_ticks += ticks;
+
+	if (_ticks >= _nextEvent)
+		runEvents();
+}
+
+inline unsigned long long Clock::getTicks() {
+	return _ticks;
+}
+
 #endif
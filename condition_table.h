@@ -0,0 +1,40 @@
+#ifndef CONDITION_TABLE_H
+#define CONDITION_TABLE_H
+
+#include <cstdint>
+#include <array>
+
+//bit nzcv of entry cond is set when the condition passes with those flags
+constexpr std::array<uint16_t, 16> buildConditionTable() {
+	std::array<uint16_t, 16> table = {};
+	for (int cond = 0; cond < 16; cond++) {
+		for (int nzcv = 0; nzcv < 16; nzcv++) {
+			bool n = nzcv & 8, z = nzcv & 4, c = nzcv & 2, v = nzcv & 1;
+			bool met = false;
+
+			switch (cond) {
+			case 0x0: met = z; break;			//EQ
+			case 0x1: met = !z; break;			//NE
+			case 0x2: met = c; break;			//CS
+			case 0x3: met = !c; break;			//CC
+			case 0x4: met = n; break;			//MI
+			case 0x5: met = !n; break;			//PL
+			case 0x6: met = v; break;			//VS
+			case 0x7: met = !v; break;			//VC
+			case 0x8: met = c && !z; break;		//HI
+			case 0x9: met = !c || z; break;		//LS
+			case 0xa: met = n == v; break;		//GE
+			case 0xb: met = n != v; break;		//LT
+			case 0xc: met = !z && n == v; break;	//GT
+			case 0xd: met = z || n != v; break;	//LE
+			case 0xe: met = true; break;		//AL
+			case 0xf: met = false; break;		//NV
+			}
+			if (met)
+				table[cond] |= 1 << nzcv;
+		}
+	}
+	return table;
+}
+
+#endif
@@ -4,16 +4,29 @@
 #include "thumb_decoder.h"
 #include "arm_decoder.h"
 #include "interrupt.h"
+#include "hle_bios.h"
+#include "error.h"
 
 #include <cstdint>
+#include <cstring>
+#include <bitset>
+#include <map>
+#include <sstream>
 #include <iostream>
 
 Clock GBA::clock;
 Interrupt GBA::irq;
 SoundController GBA::sound;
 
+ArmHandler Cpu::_armHandlers[4096];
+
 Cpu::Cpu()
 {
+	setBackend(CPU_INTERPRETER);
+	_hleBios = false;
+	_lockstep = false;
+	ArmDecoder::buildLookupTable();
+	buildArmHandlerTable();
 	Reset();
 }
 
@@ -23,7 +36,12 @@ void Cpu::runFor(uint32_t ticks) {
 	unsigned long long endingTicks = startingTicks + ticks;
 
 	while (GBA::clock.getTicks() < endingTicks) {
-		next_instruction();
+		if (_halted)
+			waitForInterrupt(endingTicks);
+		else if (_lockstep)
+			runLockstep(endingTicks);
+		else
+			next_block(endingTicks);
 	}
 }
 
@@ -31,182 +49,136 @@ uint32_t Cpu::getPC() {
 	return reg.R15;
 }
 
-void Cpu::saveBankReg(PrivilegeMode currentMode) {
-
-	switch (currentMode) {
-	case SUPERVISOR:
-		reg.R8_std = reg.R8;
-		reg.R9_std = reg.R9;
-		reg.R10_std = reg.R10;
-		reg.R11_std = reg.R11;
-		reg.R12_std = reg.R12;
-		reg.R13_svc = reg.R13;
-		reg.R14_svc = reg.R14;
-		reg.SPSR_svc = reg.SPSR;
-		break;
+//drop the cached blocks decoded from the written address
+void Cpu::invalidateCode(uint32_t address) {
+	_blockCache.invalidate(address);
+}
 
-	case IRQ:
-		reg.R8_std = reg.R8;
-		reg.R9_std = reg.R9;
-		reg.R10_std = reg.R10;
-		reg.R11_std = reg.R11;
-		reg.R12_std = reg.R12;
-		reg.R13_irq = reg.R13;
-		reg.R14_irq = reg.R14;
-		reg.SPSR_irq = reg.SPSR;
-		break;
+BlockCache& Cpu::getBlockCache() {
+	return _blockCache;
+}
 
-	case FIQ:
-		reg.R8_fiq = reg.R8;
-		reg.R9_fiq = reg.R9;
-		reg.R10_fiq = reg.R10;
-		reg.R11_fiq = reg.R11;
-		reg.R12_fiq = reg.R12;
-		reg.R13_fiq = reg.R13;
-		reg.R14_fiq = reg.R14;
-		reg.SPSR_fiq = reg.SPSR;
-		break;
+//select interpreter or recompiler. can be changed between two runFor calls
+void Cpu::setBackend(CpuBackend backend) {
+	if (backend == CPU_JIT && !Jit::isSupported())
+		backend = CPU_INTERPRETER;
+	_backend = backend;
+}
 
-	case UNDEFINED:
-		reg.R8_std = reg.R8;
-		reg.R9_std = reg.R9;
-		reg.R10_std = reg.R10;
-		reg.R11_std = reg.R11;
-		reg.R12_std = reg.R12;
-		reg.R13_und = reg.R13;
-		reg.R14_und = reg.R14;
-		reg.SPSR_und = reg.SPSR;
-		break;
+CpuBackend Cpu::getBackend() {
+	return _backend;
+}
 
-	case ABORT:
-		reg.R8_std = reg.R8;
-		reg.R9_std = reg.R9;
-		reg.R10_std = reg.R10;
-		reg.R11_std = reg.R11;
-		reg.R12_std = reg.R12;
-		reg.R13_abt = reg.R13;
-		reg.R14_abt = reg.R14;
-		reg.SPSR_abt = reg.SPSR;
-		break;
+//debug mode, slow: every block runs twice and the first difference stops the emulator
+void Cpu::setLockstep(bool enable) {
+	_lockstep = enable;
+}
 
-	case USER: case SYSTEM:
-		reg.R8_std = reg.R8;
-		reg.R9_std = reg.R9;
-		reg.R10_std = reg.R10;
-		reg.R11_std = reg.R11;
-		reg.R12_std = reg.R12;
-		reg.R13_std = reg.R13;
-		reg.R14_std = reg.R14;
-		break;
-	}
+uint64_t Cpu::getSkippedTicks() {
+	return _skippedTicks;
 }
 
-void Cpu::getBankReg(PrivilegeMode newMode) {
+//code pages made stale by writes per emulated second, since the last call
+double Cpu::getInvalidationsPerSecond() {
+	uint64_t invalidations = _blockCache.getInvalidations();
+	unsigned long long ticks = GBA::clock.getTicks();
+	double rate = 0;
 
-	switch (newMode) {
-	case SUPERVISOR:
-		reg.R8 = reg.R8_std;
-		reg.R9 = reg.R9_std;
-		reg.R10 = reg.R10_std;
-		reg.R11 = reg.R11_std;
-		reg.R12 = reg.R12_std;
-		reg.R13 = reg.R13_svc;
-		reg.R14 = reg.R14_svc;
-		reg.CPSR_f->mode = newMode;
-		reg.SPSR = reg.SPSR_svc;
-		break;
+	if (ticks > _lastInvalidationTicks)
+		rate = (double)(invalidations - _lastInvalidations) * Clock::TICKS_PER_SECOND / (ticks - _lastInvalidationTicks);
 
-	case IRQ:
-		reg.R8 = reg.R8_std;
-		reg.R9 = reg.R9_std;
-		reg.R10 = reg.R10_std;
-		reg.R11 = reg.R11_std;
-		reg.R12 = reg.R12_std;
-		reg.R13 = reg.R13_irq;
-		reg.R14 = reg.R14_irq;
-		reg.CPSR_f->mode = newMode;
-		reg.SPSR = reg.SPSR_irq;
-		break;
+	_lastInvalidations = invalidations;
+	_lastInvalidationTicks = ticks;
+	return rate;
+}
 
-	case FIQ:
-		reg.R8 = reg.R8_fiq;
-		reg.R9 = reg.R9_fiq;
-		reg.R10 = reg.R10_fiq;
-		reg.R11 = reg.R11_fiq;
-		reg.R12 = reg.R12_fiq;
-		reg.R13 = reg.R13_fiq;
-		reg.R14 = reg.R14_fiq;
-		reg.CPSR_f->mode = newMode;
-		reg.SPSR = reg.SPSR_fiq;
-		break;
+//HALTCNT write: stop executing until an enabled irq is flagged.
+//the bios Halt, Stop, IntrWait and VBlankIntrWait all end up here
+void Cpu::halt(bool stop) {
+	_halted = true;
+	_wakeIrqs = stop ? STOP_WAKE_IRQS : HALT_WAKE_IRQS;
+}
 
-	case UNDEFINED:
-		reg.R8 = reg.R8_std;
-		reg.R9 = reg.R9_std;
-		reg.R10 = reg.R10_std;
-		reg.R11 = reg.R11_std;
-		reg.R12 = reg.R12_std;
-		reg.R13 = reg.R13_und;
-		reg.R14 = reg.R14_und;
-		reg.CPSR_f->mode = newMode;
-		reg.SPSR = reg.SPSR_und;
-		break;
+//run the bios calls natively instead of the bios code, from SoftReset to the decompressors
+//except BitUnPack, the filters and the sound calls. always on when there is no bios image
+void Cpu::setHleBios(bool enable) {
+	_hleBios = enable;
+}
 
-	case ABORT:
-		reg.R8 = reg.R8_std;
-		reg.R9 = reg.R9_std;
-		reg.R10 = reg.R10_std;
-		reg.R11 = reg.R11_std;
-		reg.R12 = reg.R12_std;
-		reg.R13 = reg.R13_abt;
-		reg.R14 = reg.R14_abt;
-		reg.CPSR_f->mode = newMode;
-		reg.SPSR = reg.SPSR_abt;
-		break;
+const std::array<uint8_t, 32> Cpu::_modeBanks = {
+	BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE,
+	BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE, BANK_NONE,
+	BANK_USER, BANK_FIQ, BANK_IRQ, BANK_SVC, BANK_NONE, BANK_NONE, BANK_NONE, BANK_ABT,
+	BANK_NONE, BANK_NONE, BANK_NONE, BANK_UND, BANK_NONE, BANK_NONE, BANK_NONE, BANK_USER
+};
 
-	case USER: case SYSTEM:
-		reg.R8 = reg.R8_std;
-		reg.R9 = reg.R9_std;
-		reg.R10 = reg.R10_std;
-		reg.R11 = reg.R11_std;
-		reg.R12 = reg.R12_std;
-		reg.R13 = reg.R13_std;
-		reg.R14 = reg.R14_std;
-		reg.CPSR_f->mode = newMode;
-		break;
+//swap the banked registers of the two modes. only fiq banks r8-r12
+void Cpu::setPrivilegeMode(PrivilegeMode currentMode, PrivilegeMode mode) {
+	uint8_t current = _modeBanks[currentMode & 0x1f];
+	uint8_t next = _modeBanks[mode & 0x1f];
+	reg.CPSR_f->mode = mode;
+
+	if (current == next || current == BANK_NONE || next == BANK_NONE)
+		return;
+
+	if ((current == BANK_FIQ) != (next == BANK_FIQ)) {
+		memcpy(reg.R8_12[current == BANK_FIQ], &reg.R8, sizeof(reg.R8_12[0]));
+		memcpy(&reg.R8, reg.R8_12[next == BANK_FIQ], sizeof(reg.R8_12[0]));
 	}
-}
 
+	reg.bank[current].R13 = reg.R13;
+	reg.bank[current].R14 = reg.R14;
+	reg.R13 = reg.bank[next].R13;
+	reg.R14 = reg.bank[next].R14;
 
-void Cpu::setPrivilegeMode(PrivilegeMode currentMode, PrivilegeMode mode) {
-	saveBankReg(currentMode);
-	getBankReg(mode);
+	if (current != BANK_USER)
+		reg.bank[current].SPSR = reg.SPSR;
+	if (next != BANK_USER)	//user mode keeps the spsr it finds
+		reg.SPSR = reg.bank[next].SPSR;
 }
 
-
 void Cpu::setPrivilegeMode(PrivilegeMode mode) {
 	PrivilegeMode currentPM = (PrivilegeMode)reg.CPSR_f->mode;
 
 	if (currentPM == mode)	//same mode
 		return;
 
-	saveBankReg(currentPM);
-	getBankReg(mode);
-
+	setPrivilegeMode(currentPM, mode);
 }
 
 void Cpu::Reset() {
 
 	reg = {};
 	reg.CPSR_f = (CPSR_registers*)&reg.CPSR;
-	getBankReg(SUPERVISOR);
+	reg.CPSR_f->mode = SUPERVISOR;
+	_flags = {};
 
 	GBA::clock.clear();
-	
+	_blockCache.flush();
+	_skippedTicks = 0;
+	_lastInvalidations = _blockCache.getInvalidations();
+	_lastInvalidationTicks = 0;
+	_halted = false;
+	_wakeIrqs = HALT_WAKE_IRQS;
+	_intrWait = false;
+	_fetchWindow = {};
+
+	if (!GBA::memory.hasBios())
+		skipBios();
+}
+
+//start the game with the registers the bios boot code leaves
+void Cpu::skipBios() {
+	reg.R13 = 0x03007fe0;	//supervisor stack
+	reg.bank[BANK_IRQ].R13 = 0x03007fa0;
+	setPrivilegeMode(SYSTEM);
+	reg.R13 = 0x03007f00;
+	reg.R15 = 0x08000000;
 }
 
 void Cpu::RaiseIRQ(Interrupt_Type type) {
 
+	syncFlags();
 	uint32_t prev_cpsr = reg.CPSR;	//save cpsr
 	setPrivilegeMode(PrivilegeMode::IRQ);	//change cpu mode
 	reg.SPSR = prev_cpsr;	//set irq spsr to previous cpsr
@@ -233,28 +205,142 @@ void Cpu::RaiseUndefined() {
 
 }
 
-void Cpu::RaiseSWI() {
+//swi: emulated natively or through the bios vector
+void Cpu::RaiseSWI(uint8_t number) {
+	uint32_t next = reg.R15 + (reg.CPSR_f->T ? 2 : 4);
+
+	if ((_hleBios || !GBA::memory.hasBios()) && hleCall(number, next))
+		return;
 
+	if (!GBA::memory.hasBios()) {	//the bios stub has no code to run
+		std::ostringstream message;
+		message << "bios call 0x" << std::hex << (int)number << " needs gba_bios.bin";
+		printError(CRITICAL_ERROR, message.str());
+	}
+
+	syncFlags();
+	uint32_t prev_cpsr = reg.CPSR;	//save cpsr
+	setPrivilegeMode(PrivilegeMode::SUPERVISOR);	//change cpu mode
+	reg.SPSR = prev_cpsr;	//set svc spsr to previous cpsr
+	reg.R14 = next;	//return address
+	reg.CPSR_f->I = 1;	//disable interrupts
+
+	reg.CPSR_f->T = 0;	//set arm mode
+	reg.R15 = 0x8;	//swi vector
 }
 
+//run the bios call natively. false if it isn't emulated and the bios code has to run
+bool Cpu::hleCall(uint8_t number, uint32_t next) {
+	switch (number) {
+	case SWI_SOFT_RESET:
+		softReset();
+		break;
+	case SWI_INTR_WAIT:
+		intrWait(reg.R0 & 1, reg.R1, next);
+		break;
+	case SWI_VBLANK_INTR_WAIT:
+		reg.R0 = 1;
+		reg.R1 = 1 << IRQ_VBLANK;
+		intrWait(true, reg.R1, next);
+		break;
+	default:
+		if (!HleBios::call(number, (uint32_t*)&reg))
+			return false;
+		reg.R15 = next;
+		return true;
+	}
+
+	GBA::clock.addTicks(HleBios::SWI_TICKS);
+	return true;
+}
+
+//SoftReset: clear the top of iwram and the registers, then restart from rom, or ewram if [0x03007ffa] is set
+void Cpu::softReset() {
+	bool ewram = GBA::memory.read_8(0x03007ffa) != 0;
+	for (uint32_t address = 0x03007e00; address < 0x03008000; address += 4) {
+		GBA::memory.write_32(address, 0);
+	}
+
+	reg = {};
+	reg.CPSR_f = (CPSR_registers*)&reg.CPSR;
+	reg.CPSR_f->mode = SUPERVISOR;
+	_flags = {};
+	_intrWait = false;
+	skipBios();
+	if (ewram)
+		reg.R15 = 0x02000000;
+}
+
+//IntrWait: halt until an irq in mask is flagged in the bios IF, that the game irq handler sets.
+//the irq returns to the swi, that checks the flags again without discarding them
+void Cpu::intrWait(bool discard, uint16_t mask, uint32_t next) {
+	GBA::memory.write_16(0x04000208, 1);	//IME
+	uint16_t flags = GBA::memory.read_16(HleBios::BIOS_IF);
+
+	if (discard && !_intrWait) {
+		flags &= ~mask;
+		GBA::memory.write_16(HleBios::BIOS_IF, flags);
+	}
+
+	if (flags & mask) {
+		GBA::memory.write_16(HleBios::BIOS_IF, flags & ~mask);
+		_intrWait = false;
+		reg.R15 = next;
+	}
+	else {
+		_intrWait = true;
+		halt(false);
+	}
+}
+
+//host pointer to the instruction, nullptr if it's not in plain memory.
+//the window is only looked up again when the pc leaves it
+inline const uint8_t* Cpu::fetchPointer(uint32_t address) {
+	if (address - _fetchWindow.start >= _fetchWindow.size || _fetchWindow.generation != GBA::memory.getPageGeneration())
+		_fetchWindow = GBA::memory.getFetchWindow(address);
+
+	if (_fetchWindow.memory == nullptr)
+		return nullptr;
+	return &_fetchWindow.memory[address - _fetchWindow.start];
+}
 
 void Cpu::next_instruction_arm() {
 
 	reg.R15 -= reg.R15 % 4;	//align R15
-	uint32_t opcode = GBA::memory.read_32(reg.R15);
+	const uint8_t* code = fetchPointer(reg.R15);
+	uint32_t opcode;
+
+	if (code != nullptr) {
+		GBA::clock.addTicks(MemoryMapper::isGamePakRom(reg.R15) ? GBA::memory.fetchTicks(reg.R15, false) : _fetchWindow.accessTimings[2]);
+		opcode = *(const uint32_t*)code;
+	}
+	else
+		opcode = GBA::memory.read_32(reg.R15);
 
-	ARM_opcode instruction = ArmDecoder::decode(opcode);
-	execute_arm(instruction, opcode);
+	if (!arm_checkInstructionCondition(opcode)) {	//doesn't meet the condition
+		reg.R15 += 4;
+		//GBA::clock.addTicks(1);
+		return;
+	}
+
+	(this->*_armHandlers[ArmDecoder::tableIndex(opcode)])(opcode);
 }
 
 void Cpu::next_instruction_thumb() {
 
 	reg.R15 -= reg.R15 % 2;	//align R15
 
-	uint16_t opcode = GBA::memory.read_16(reg.R15);
+	const uint8_t* code = fetchPointer(reg.R15);
+	uint16_t opcode;
 
-	THUMB_opcode instruction = ThumbDecoder::decode(opcode);
-	execute_thumb(instruction, opcode);
+	if (code != nullptr) {
+		GBA::clock.addTicks(MemoryMapper::isGamePakRom(reg.R15) ? GBA::memory.fetchTicks(reg.R15, true) : _fetchWindow.accessTimings[1]);
+		opcode = *(const uint16_t*)code;
+	}
+	else
+		opcode = GBA::memory.read_16(reg.R15);
+
+	(this->*_thumbHandlers[opcode >> 6])(opcode);
 }
 
 //execute the next instruction
@@ -280,240 +366,496 @@ void Cpu::next_instruction() {
 	next_instruction_arm();
 }
 
-bool Cpu::thumbCheckCondition(uint16_t opcode) {
-	uint8_t condition = (opcode >> 8) & 0x0f;
+//execute a cached block from the current pc until it ends or the program flow leaves it
+void Cpu::next_block(unsigned long long endingTicks) {
+	if (!BlockCache::isCacheable(reg.R15)) {
+		next_instruction();
+		return;
+	}
 
-	bool condition_met = false;
+	if (!reg.CPSR_f->I) GBA::irq.checkInterrupts();
 
-	switch (condition) {
-	case 0:	//EQ (z = 1)
-		condition_met = reg.CPSR_f->Z == 1;
-		break;
-	case 1:		//NE (z = 0)
-		condition_met = reg.CPSR_f->Z == 0;
-		break;
-	case 2:		//CS/HS (c = 1)
-		condition_met = reg.CPSR_f->C == 1;
-		break;
-	case 3:		//CC/LO	(c = 0)
-		condition_met = reg.CPSR_f->C == 0;
-		break;
-	case 4:		//MI (N = 1) negative
-		condition_met = reg.CPSR_f->N == 1;
-		break;
-	case 5:		//PL (N = 0) >= 0
-		condition_met = reg.CPSR_f->N == 0;
-		break;
-	case 6:		//VS (V = 1) overflow
-		condition_met = reg.CPSR_f->V == 1;
-		break;
-	case 7:		//VC (V = 0) no overflow
-		condition_met = reg.CPSR_f->V == 0;
-		break;
-	case 8:		//HI (C = 1 and Z = 0)	unsigned higher
-		condition_met = (reg.CPSR_f->C == 1) && (reg.CPSR_f->Z == 0);
-		break;
-	case 9:		//LS (C = 0 or Z=1)	unsigned lower or same
-		condition_met = (reg.CPSR_f->C == 0) || (reg.CPSR_f->Z == 1);
-		break;
-	case 0xa:	//GE (N = V) signed greater or equal
-		condition_met = reg.CPSR_f->N == reg.CPSR_f->V;
-		break;
-	case 0xb:	//LT (N!=V)	signed less than
-		condition_met = reg.CPSR_f->N != reg.CPSR_f->V;
-		break;
-	case 0xc:	//GT (Z=0 and N=V)	signed greater than
-		condition_met = (reg.CPSR_f->Z == 0) && (reg.CPSR_f->N == reg.CPSR_f->V);
-		break;
-	case 0xd:	//LE (Z=1 or N!=V)	signed less or equal
-		condition_met = (reg.CPSR_f->Z == 1) || (reg.CPSR_f->N != reg.CPSR_f->V);
-		break;
+	bool thumb = reg.CPSR_f->T;
+	reg.R15 -= thumb ? reg.R15 % 2 : reg.R15 % 4;	//align R15
+
+	if (!BlockCache::isCacheable(reg.R15)) {	//the interrupt jumped out of cacheable memory
+		if (thumb) next_instruction_thumb();
+		else next_instruction_arm();
+		return;
 	}
 
-	return condition_met;
-}
+	if (_jit.isFull()) {	//compiled code is dropped together with its blocks
+		_jit.clear();
+		_blockCache.flush();
+	}
 
-void Cpu::execute_thumb(THUMB_opcode instruction, uint16_t opcode) {
-	
-	switch (instruction) {
-	case THUMB_OP_LSL_IMM:	//logic/arithm shift left
-		Thumb_LSL_IMM(opcode);
-		reg.R15 += 2;
-		break;
-	
-	case THUMB_OP_LSR_IMM:	//logical right shift
-		Thumb_LSR_IMM(opcode);
-		reg.R15 += 2;
-		break;
+	DecodedBlock* block = _blockCache.find(reg.R15, thumb);
+	if (block == nullptr) {
+		DecodedBlock decoded;
+		decodeBlock(reg.R15, thumb, decoded);
+		block = _blockCache.insert(decoded);
+	}
 
-	case THUMB_OP_ASR_IMM:	//arithmetic shift right
-		Thumb_ASR_IMM(opcode);
-		reg.R15 += 2;
-		break;
+	//the block is replaced if it writes its own page: keep what the idle check needs
+	uint32_t address = block->address;
+	bool idle = block->idle;
+	uint32_t volatileAccesses = GBA::memory.getVolatileAccesses();
+	uint32_t generation = _blockCache.getGeneration();
+	unsigned long long nextEvent = GBA::clock.getNextEvent();	//changes when an event runs
 
-	case THUMB_OP_ADD_RR:	//add register + register
-		Thumb_ADD_RR(opcode);
-		reg.R15 += 2;
-		break;
+	if (_backend == CPU_JIT && block->code == nullptr && ++block->executions == Jit::HOT_THRESHOLD)
+		block->code = _jit.compile(*this, *block);
 
-	case THUMB_OP_SUB_RR:	//sub register - register
-		Thumb_SUB_RR(opcode);
-		reg.R15 += 2;
-		break;
+	if (_backend == CPU_JIT && block->code != nullptr)
+		_jit.run(*this, block->code, endingTicks);
+	else
+		runBlock(block, endingTicks);
 
-	case THUMB_OP_ADD_RI:	//add register + immidiate
-		Thumb_ADD_RI(opcode);
-		reg.R15 += 2;
-		break;
+	//another iteration of an idle loop would do exactly the same, unless an event or an irq came in the middle of it
+	if (idle && reg.R15 == address && reg.CPSR_f->T == thumb && _blockCache.getGeneration() == generation
+		&& GBA::memory.getVolatileAccesses() == volatileAccesses && GBA::clock.getNextEvent() == nextEvent
+		&& !GBA::irq.pending())
+		skipIdleLoop(endingTicks);
+}
 
-	case THUMB_OP_SUB_RI:	//sub register - immidiate
-		Thumb_SUB_RI(opcode);
-		reg.R15 += 2;
-		break;
+//interpret a decoded block
+void Cpu::runBlock(DecodedBlock* block, unsigned long long endingTicks) {
+	//a write to its page makes the block stale while it runs: stop when the generation changes
+	const DecodedInstruction* instructions = block->instructions.data();
+	size_t count = block->instructions.size();
+	uint32_t generation = _blockCache.getGeneration();
+	bool thumb = block->thumb;
+	bool gamePak = MemoryMapper::isGamePakRom(reg.R15);	//fetch ticks depend on the prefetch buffer
+	int fetchTicks = gamePak ? 0 : GBA::memory.fetchTicks(reg.R15, thumb);
+	uint32_t pc = reg.R15;
 
-		//alu operations
-	case THUMB_OP_AND:	//and
-		Thumb_AND(opcode);
-		reg.R15 += 2;
-		break;
+	for (size_t i = 0; ; ) {
+		uint32_t opcode = instructions[i].opcode;
+		GBA::clock.addTicks(gamePak ? GBA::memory.fetchTicks(pc, thumb) : fetchTicks);
 
-	case THUMB_OP_LSL:
-		Thumb_LSL(opcode);	//lsl
-		reg.R15 += 2;
-		break;
+		if (thumb) {
+			(this->*instructions[i].thumb)(opcode);
+		}
+		else if (arm_checkInstructionCondition(opcode)) {
+			(this->*instructions[i].arm)(opcode);
+		}
+		else {	//doesn't meet the condition
+			reg.R15 += 4;
+		}
 
-	case THUMB_OP_LSR:	//lsr
-		Thumb_LSR(opcode);
-		reg.R15 += 2;
-		break;
+		pc += thumb ? 2 : 4;
+		if (++i == count || !blockContinues(pc, thumb, generation, endingTicks))
+			return;
+	}
+}
 
-	case THUMB_OP_ASR:
-		Thumb_ASR(opcode);
-		reg.R15 += 2;
-		break;
+//checks between two instructions of a block. pc: address of the next instruction
+inline bool Cpu::blockContinues(uint32_t pc, bool thumb, uint32_t generation, unsigned long long endingTicks) {
+	if (_blockCache.getGeneration() != generation || _halted)	//block invalidated or halt
+		return false;
 
-	case THUMB_OP_TST:
-		Thumb_TST(opcode);
-		reg.R15 += 2;
-		break;
+	if (reg.R15 != pc || reg.CPSR_f->T != thumb)	//branch taken
+		return false;
 
-	case THUMB_OP_NEG:	//negate
-		Thumb_NEG(opcode);
-		reg.R15 += 2;
-		break;
-		
-	case THUMB_OP_MVN:	//mvn
-		Thumb_MVN(opcode);
-		reg.R15 += 2;
-		break;
+	if (GBA::clock.getTicks() >= endingTicks)
+		return false;
 
-	case THUMB_OP_ORR:	//or
-		Thumb_ORR(opcode);
-		reg.R15 += 2;
-		break;
+	return reg.CPSR_f->I || !GBA::irq.pending();	//let the next block raise the irq
+}
 
-	case THUMB_OP_CMP:	//cmp
-		Thumb_CMP(opcode);
-		reg.R15 += 2;
-		break;
+//run a block with the selected backend, then replay it from the same state with the reference
+//interpreter, one instruction at a time, and compare ticks, registers and written memory.
+//blocks that run events, raise an irq or access io and sram can't be replayed and aren't checked
+void Cpu::runLockstep(unsigned long long endingTicks) {
+	if (!reg.CPSR_f->I && GBA::irq.pending()) {
+		next_block(endingTicks);
+		return;
+	}
 
-	case THUMB_OP_CMN:	//cmn
-		Thumb_CMN(opcode);
-		reg.R15 += 2;
-		break;
+	unsigned long long ticks = GBA::clock.getTicks();
+	unsigned long long nextEvent = GBA::clock.getNextEvent();
+	uint32_t volatileAccesses = GBA::memory.getVolatileAccesses();
+	syncFlags();
+	Registers start = reg;
+	bool thumb = reg.CPSR_f->T;
 
-	case THUMB_OP_MUL:
-		Thumb_MUL(opcode);
-		reg.R15 += 2;
-		break;
+	GBA::memory.beginWriteLog();
+	next_block(endingTicks);
+	if (!GBA::memory.endWriteLog() || GBA::clock.getTicks() >= nextEvent
+		|| GBA::memory.getVolatileAccesses() != volatileAccesses || _halted)
+		return;
 
-	case THUMB_OP_ROR:
-		Thumb_ROR(opcode);
-		reg.R15 += 2;
-		break;
+	//what the backend left: the written bytes, then undo everything
+	syncFlags();
+	Registers backend = reg;
+	unsigned long long backendTicks = GBA::clock.getTicks();
+	std::map<uint32_t, uint8_t> expected;
+	for (const LoggedWrite& write : GBA::memory.getWriteLog()) {
+		expected[write.address] = GBA::memory.peek_8(write.address);
+	}
+
+	GBA::memory.rollbackWrites();
+	GBA::clock.rewind(ticks);
+	reg = start;
+	_flags = {};
+
+	GBA::memory.beginWriteLog();
+	while (GBA::clock.getTicks() < backendTicks && !_halted) {
+		if (reg.CPSR_f->T) next_instruction_thumb();
+		else next_instruction_arm();
+	}
+	GBA::memory.endWriteLog();
+	syncFlags();
+
+	for (const LoggedWrite& write : GBA::memory.getWriteLog()) {	//only the reference wrote it
+		expected.emplace(write.address, write.old);
+	}
+
+	std::ostringstream diff;
+	diff << std::hex;
+	if (GBA::clock.getTicks() != backendTicks)
+		diff << "\nticks: " << backendTicks << " reference " << GBA::clock.getTicks();
+
+	static const char* names[] = { "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+		"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "cpsr", "spsr" };
+	for (int i = 0; i < 18; i++) {
+		uint32_t a = ((uint32_t*)&backend)[i], b = ((uint32_t*)&reg)[i];
+		if (a != b)
+			diff << "\n" << names[i] << ": " << a << " reference " << b;
+	}
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 5; j++) {
+			if (backend.R8_12[i][j] != reg.R8_12[i][j])
+				diff << "\nbanked r" << std::dec << 8 + j << std::hex << " (" << (i ? "fiq" : "usr") << "): "
+					<< backend.R8_12[i][j] << " reference " << reg.R8_12[i][j];
+		}
+	}
+	for (int i = 0; i < BANK_COUNT; i++) {
+		const BankedRegisters& a = backend.bank[i];
+		const BankedRegisters& b = reg.bank[i];
+		if (a.R13 != b.R13 || a.R14 != b.R14 || a.SPSR != b.SPSR)
+			diff << "\nbank " << i << ": r13 " << a.R13 << " r14 " << a.R14 << " spsr " << a.SPSR
+				<< " reference r13 " << b.R13 << " r14 " << b.R14 << " spsr " << b.SPSR;
+	}
+	for (auto& byte : expected) {
+		uint8_t value = GBA::memory.peek_8(byte.first);
+		if (value != byte.second)
+			diff << "\n[" << byte.first << "]: " << (int)byte.second << " reference " << (int)value;
+	}
 
-	case THUMB_OP_EOR:
-		Thumb_EOR(opcode);
-		reg.R15 += 2;
-		break;
+	if (diff.tellp() > 0) {
+		std::ostringstream block;
+		block << "lockstep: block at " << std::hex << start.R15 << (thumb ? " (thumb)" : " (arm)") << " differs from the reference interpreter";
+		printError(CRITICAL_ERROR, block.str() + diff.str());
+	}
+}
 
-	case THUMB_OP_BIC:
-		Thumb_BIC(opcode);
-		reg.R15 += 2;
-		break;
+//the idle loop state can only change when an event fires: move the clock to it.
+//sound events run often and rarely end the wait, skip them unless they raised an interrupt
+void Cpu::skipIdleLoop(unsigned long long endingTicks) {
+	uint16_t* IF = GBA::memory.get_io_reg(0x202);
+	uint16_t flags = *IF;
 
-	case THUMB_OP_CMP_I:	//compare immidiate
-		Thumb_CMP_I(opcode);
-		reg.R15 += 2;
-		break;
+	while (GBA::clock.getTicks() < endingTicks) {
+		unsigned long long ticks = GBA::clock.getTicks();
+		unsigned long long target = GBA::clock.getNextEvent();
+		bool soundEvent = GBA::clock.getNextEventType() == EVENT_SOUND;
+		if (target > endingTicks) {
+			target = endingTicks;
+			soundEvent = true;	//no event, the loop ends on the tick budget
+		}
 
-	case THUMB_OP_MOV_I:	//move immidiate
-		Thumb_MOV_I(opcode);
-		reg.R15 += 2;
-		break;
+		_skippedTicks += target - ticks;
+		GBA::clock.addTicks(target - ticks);
 
-	case THUMB_OP_ADD_I:	//add immidiate
-		Thumb_ADD_I(opcode);
-		reg.R15 += 2;
-		break;
+		if (!soundEvent || *IF != flags)
+			return;
+	}
+}
 
-	case THUMB_OP_SUB_I:	//sub immidiate
-		Thumb_SUB_I(opcode);
-		reg.R15 += 2;
-		break;
+//nothing runs while halted: only events can flag an irq, jump from one to the next
+void Cpu::waitForInterrupt(unsigned long long endingTicks) {
+	while (!GBA::irq.requested(_wakeIrqs)) {
+		unsigned long long ticks = GBA::clock.getTicks();
+		if (ticks >= endingTicks)
+			return;
 
-	case THUMB_OP_LDR_PC:	//load pc-relative
-		Thumb_LDR_PC(opcode);
-		reg.R15 += 2;
-		break;
+		unsigned long long target = GBA::clock.getNextEvent();
+		if (target > endingTicks)
+			target = endingTicks;
 
-	case THUMB_OP_STR_O:	//store word with register offset
-		Thumb_STR_O(opcode);
-		reg.R15 += 2;
-		break;
+		_skippedTicks += target - ticks;
+		GBA::clock.addTicks(target - ticks);
+	}
+	_halted = false;
+}
 
-	case THUMB_OP_LDR_O:	//load word with register offset
-		Thumb_LDR_O(opcode);
-		reg.R15 += 2;
-		break;
+//a short loop that branches back to its start, only reads memory and reads no register
+//that the previous iteration changed. it keeps repeating itself until an event changes memory
+bool Cpu::isIdleLoop(const DecodedBlock& block) {
+	size_t count = block.instructions.size();
+	if (count > IDLE_LOOP_LENGTH)
+		return false;
 
-	case THUMB_OP_LDRB_O:	//load byte with register offset
-		Thumb_LDRB_O(opcode);
-		reg.R15 += 2;
-		break;
+	uint16_t reads[IDLE_LOOP_LENGTH];
+	uint16_t writes[IDLE_LOOP_LENGTH];
+	uint16_t written = 0;
+	uint32_t address = block.address;
 
-	case THUMB_OP_LDR_SP:
-		Thumb_LDR_SP(opcode);
-		reg.R15 += 2;
-		break;
+	for (size_t i = 0; i < count; i++) {
+		bool last = i == count - 1;
+		bool ok = block.thumb ?
+			idleThumbInstruction(block.instructions[i].opcode, address, block.address, last, reads[i], writes[i]) :
+			idleArmInstruction(block.instructions[i].opcode, address, block.address, last, reads[i], writes[i]);
+		if (!ok)
+			return false;
 
-	case THUMB_OP_STR_SP:
-		Thumb_STR_SP(opcode);
-		reg.R15 += 2;
-		break;
+		written |= writes[i];
+		address += block.thumb ? 2 : 4;
+	}
 
-	case THUMB_OP_MOV_HRR:	//move high registers
-		Thumb_MOV_HRR(opcode);
-		reg.R15 += 2;
-		break;
+	//registers written in the loop must be written before they are read
+	uint16_t defined = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (reads[i] & written & ~defined)
+			return false;
+		defined |= writes[i];
+	}
+	return true;
+}
 
-	case THUMB_OP_ADD_HRR:	//add high registers
-		Thumb_ADD_HRR(opcode);
-		reg.R15 += 2;
-		break;
+//registers read and written by a thumb instruction allowed in an idle loop.
+//the last instruction must be the branch back to the loop start
+bool Cpu::idleThumbInstruction(uint16_t opcode, uint32_t address, uint32_t loopStart, bool last, uint16_t& reads, uint16_t& writes) {
+	uint8_t rd = opcode & 0b111;
+	uint8_t rs = (opcode >> 3) & 0b111;
+	uint8_t ro = (opcode >> 6) & 0b111;
+	uint8_t rd8 = (opcode >> 8) & 0b111;
+	uint8_t rdHi = rd | ((opcode & 0b10000000) >> 4);
+	uint8_t rsHi = rs | ((opcode & 0b1000000) >> 3);
 
-	case THUMB_OP_CMP_HRR:	//compare high registers
-		Thumb_CMP_HRR(opcode);
-		reg.R15 += 2;
-		break;
+	THUMB_opcode instr = ThumbDecoder::decode(opcode);
+	reads = 0;
+	writes = 0;
 
-	case THUMB_OP_B:	//branch
-		Thumb_B(opcode);
-		break;
+	if (last) {
+		if (instr >= THUMB_OP_BEQ && instr <= THUMB_OP_BLE)
+			return address + 4 + (int8_t)(opcode & 0xff) * 2 == loopStart;
+		if (instr == THUMB_OP_B) {
+			int32_t offset = (opcode & 0x7ff) << 1;
+			if (offset & 0x800)	//negative
+				offset -= 0x1000;
+			return address + 4 + offset == loopStart;
+		}
+		return false;
+	}
 
-	case THUMB_OP_BX:	//branch exchange
-		Thumb_BX(opcode);
-		break;
+	switch (instr) {
+	case THUMB_OP_LDR_I:	//load immidiate offset
+	case THUMB_OP_LDRB_I:
+	case THUMB_OP_LDRH:
+		reads = 1 << rs;
+		writes = 1 << rd;
+		return true;
+	case THUMB_OP_LDR_O:	//load register offset
+	case THUMB_OP_LDRB_O:
+	case THUMB_OP_LDRH_R:
+	case THUMB_OP_LDSB_R:
+	case THUMB_OP_LDSH_R:
+		reads = (1 << rs) | (1 << ro);
+		writes = 1 << rd;
+		return true;
+	case THUMB_OP_LDR_PC:
+		writes = 1 << rd8;
+		return true;
+	case THUMB_OP_LDR_SP:
+		reads = 1 << 13;
+		writes = 1 << rd8;
+		return true;
+	case THUMB_OP_MOV_I:
+		writes = 1 << rd8;
+		return true;
+	case THUMB_OP_CMP_I:
+		reads = 1 << rd8;
+		return true;
+	case THUMB_OP_CMP:
+	case THUMB_OP_CMN:
+	case THUMB_OP_TST:
+		reads = (1 << rd) | (1 << rs);
+		return true;
+	case THUMB_OP_AND:
+	case THUMB_OP_ORR:
+	case THUMB_OP_EOR:
+	case THUMB_OP_BIC:
+		reads = (1 << rd) | (1 << rs);
+		writes = 1 << rd;
+		return true;
+	case THUMB_OP_LSL_IMM:
+	case THUMB_OP_LSR_IMM:
+	case THUMB_OP_ASR_IMM:
+		reads = 1 << rs;
+		writes = 1 << rd;
+		return true;
+	case THUMB_OP_CMP_HRR:
+		if (rdHi == 15 || rsHi == 15)
+			return false;
+		reads = (1 << rdHi) | (1 << rsHi);
+		return true;
+	default:
+		return false;
+	}
+}
+
+//same for arm: unconditional loads without writeback, compares, MOV and AND
+bool Cpu::idleArmInstruction(uint32_t opcode, uint32_t address, uint32_t loopStart, bool last, uint16_t& reads, uint16_t& writes) {
+	uint8_t rn = (opcode >> 16) & 0xf;
+	uint8_t rd = (opcode >> 12) & 0xf;
+	uint8_t rm = opcode & 0xf;
+	bool immidiate = opcode & 0x02000000;
+
+	ARM_opcode instr = ArmDecoder::lookup(opcode);
+	reads = 0;
+	writes = 0;
+
+	if (last) {
+		if (instr != ARM_OP_B)
+			return false;
+		return address + 8 + ((int32_t)(opcode << 8) >> 6) == loopStart;	//signed 24 bit offset * 4
+	}
+
+	if ((opcode >> 28) != 0xe || rd == 15)	//conditional writes would depend on the flags
+		return false;
+
+	switch (instr) {
+	case ARM_OP_LDR:
+		if (!(opcode & 0x01000000) || (opcode & 0x00200000) || immidiate)	//post-indexed, writeback or register offset
+			return false;
+		break;
+	case ARM_OP_LDRH:
+	case ARM_OP_LDRSB:
+	case ARM_OP_LDRSH:
+		if (!(opcode & 0x01000000) || (opcode & 0x00200000) || !(opcode & 0x00400000))	//post-indexed, writeback or register offset
+			return false;
+		break;
+	case ARM_OP_TST:
+	case ARM_OP_TEQ:
+	case ARM_OP_CMP:
+	case ARM_OP_CMN:
+	case ARM_OP_AND:
+	case ARM_OP_MOV:
+		if (!immidiate && (opcode & 0x10) != 0)	//shift by register
+			return false;
+		if (!immidiate && rm != 15)
+			reads |= 1 << rm;
+		if (instr == ARM_OP_MOV) {
+			writes = 1 << rd;
+			return true;
+		}
+		if (rn != 15)
+			reads |= 1 << rn;
+		if (instr == ARM_OP_AND)
+			writes = 1 << rd;
+		return true;
+	default:
+		return false;
+	}
+
+	//loads
+	if (rn != 15)
+		reads = 1 << rn;
+	writes = 1 << rd;
+	return true;
+}
+
+//fetch instructions up to the next branch and bind them to their handlers, without advancing the clock
+void Cpu::decodeBlock(uint32_t address, bool thumb, DecodedBlock& block) {
+	block.address = address;
+	block.thumb = thumb;
+	block.instructions.clear();
+	block.executions = 0;
+	block.code = nullptr;
+	block.idle = false;
+	block.version = 0;
+
+	for (int i = 0; i < BlockCache::MAX_BLOCK_LENGTH; i++) {
+		DecodedInstruction instr;
+		bool branch;
+		const uint8_t* code = fetchPointer(address);
+
+		if (thumb) {
+			uint16_t opcode = code != nullptr ? *(const uint16_t*)code : GBA::memory.peek_16(address);
+			instr.thumb = _thumbHandlers[opcode >> 6];
+			instr.opcode = opcode;
+			branch = instr.thumb == &Cpu::Thumb_B || instr.thumb == &Cpu::Thumb_BX
+				|| instr.thumb == &Cpu::Thumb_CondBranch || instr.thumb == &Cpu::Thumb_SWI
+				|| instr.thumb == &Cpu::Thumb_BL_2 || instr.thumb == &Cpu::Thumb_NotImplemented;
+			address += 2;
+		}
+		else {
+			uint32_t opcode = code != nullptr ? *(const uint32_t*)code : GBA::memory.peek_32(address);
+			instr.arm = _armHandlers[ArmDecoder::tableIndex(opcode)];
+			instr.opcode = opcode;
+			branch = instr.arm == &Cpu::Arm_B || instr.arm == &Cpu::Arm_BL
+				|| instr.arm == &Cpu::Arm_BX || instr.arm == &Cpu::Arm_SWI || instr.arm == &Cpu::Arm_FullDecode;
+			address += 4;
+		}
+		block.instructions.push_back(instr);
+
+		if (branch || address % BlockCache::PAGE_SIZE == 0)	//blocks never cross a page
+			break;
+	}
+
+	block.idle = isIdleLoop(block);
+}
+
+bool Cpu::thumbCheckCondition(uint16_t opcode) {
+	return (_conditionTable[(opcode >> 8) & 0x0f] >> flags()) & 1;
+}
+
+//handler that executes an instruction
+constexpr ThumbHandler Cpu::thumbHandler(THUMB_opcode instruction) {
+	switch (instruction) {
+	case THUMB_OP_LSL_IMM: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LSL_IMM>;	//logic/arithm shift left
+	case THUMB_OP_LSR_IMM: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LSR_IMM>;	//logical right shift
+	case THUMB_OP_ASR_IMM: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ASR_IMM>;	//arithmetic shift right
+	case THUMB_OP_ADD_RR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ADD_RR>;	//add register + register
+	case THUMB_OP_SUB_RR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_SUB_RR>;	//sub register - register
+	case THUMB_OP_ADD_RI: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ADD_RI>;	//add register + immidiate
+	case THUMB_OP_SUB_RI: return &Cpu::Thumb_Sequential<&Cpu::Thumb_SUB_RI>;	//sub register - immidiate
+
+	//alu operations
+	case THUMB_OP_AND: return &Cpu::Thumb_Sequential<&Cpu::Thumb_AND>;
+	case THUMB_OP_LSL: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LSL>;
+	case THUMB_OP_LSR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LSR>;
+	case THUMB_OP_ASR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ASR>;
+	case THUMB_OP_TST: return &Cpu::Thumb_Sequential<&Cpu::Thumb_TST>;
+	case THUMB_OP_NEG: return &Cpu::Thumb_Sequential<&Cpu::Thumb_NEG>;
+	case THUMB_OP_MVN: return &Cpu::Thumb_Sequential<&Cpu::Thumb_MVN>;
+	case THUMB_OP_ORR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ORR>;
+	case THUMB_OP_CMP: return &Cpu::Thumb_Sequential<&Cpu::Thumb_CMP>;
+	case THUMB_OP_CMN: return &Cpu::Thumb_Sequential<&Cpu::Thumb_CMN>;
+	case THUMB_OP_MUL: return &Cpu::Thumb_Sequential<&Cpu::Thumb_MUL>;
+	case THUMB_OP_ROR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ROR>;
+	case THUMB_OP_EOR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_EOR>;
+	case THUMB_OP_BIC: return &Cpu::Thumb_Sequential<&Cpu::Thumb_BIC>;
+
+	case THUMB_OP_CMP_I: return &Cpu::Thumb_Sequential<&Cpu::Thumb_CMP_I>;	//compare immidiate
+	case THUMB_OP_MOV_I: return &Cpu::Thumb_Sequential<&Cpu::Thumb_MOV_I>;	//move immidiate
+	case THUMB_OP_ADD_I: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ADD_I>;	//add immidiate
+	case THUMB_OP_SUB_I: return &Cpu::Thumb_Sequential<&Cpu::Thumb_SUB_I>;	//sub immidiate
+	case THUMB_OP_LDR_PC: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDR_PC>;	//load pc-relative
+	case THUMB_OP_STR_O: return &Cpu::Thumb_Sequential<&Cpu::Thumb_STR_O>;	//store word with register offset
+	case THUMB_OP_LDR_O: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDR_O>;	//load word with register offset
+	case THUMB_OP_LDRB_O: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDRB_O>;	//load byte with register offset
+	case THUMB_OP_LDR_SP: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDR_SP>;
+	case THUMB_OP_STR_SP: return &Cpu::Thumb_Sequential<&Cpu::Thumb_STR_SP>;
+	case THUMB_OP_MOV_HRR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_MOV_HRR>;	//move high registers
+	case THUMB_OP_NOP: return &Cpu::Thumb_Sequential<&Cpu::Thumb_MOV_HRR>;	//nop is MOV r8, r8
+	case THUMB_OP_ADD_HRR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ADD_HRR>;	//add high registers
+	case THUMB_OP_CMP_HRR: return &Cpu::Thumb_Sequential<&Cpu::Thumb_CMP_HRR>;	//compare high registers
+
+	case THUMB_OP_B: return &Cpu::Thumb_B;	//branch
+	case THUMB_OP_BX: return &Cpu::Thumb_BX;	//branch exchange
 
 	case THUMB_OP_BEQ:	//conditional branches
 	case THUMB_OP_BNE:
@@ -529,127 +871,59 @@ void Cpu::execute_thumb(THUMB_opcode instruction, uint16_t opcode) {
 	case THUMB_OP_BLT:
 	case THUMB_OP_BGT:
 	case THUMB_OP_BLE:
-		if (thumbCheckCondition(opcode)) {
-			int8_t offset_8 = (int8_t)(opcode & 0xff);
-			int16_t offset = ((int16_t)offset_8 * 2) + 4;
-			reg.R15 += offset;
-			GBA::clock.addTicks(2);
-			break;
-		}
-		reg.R15 += 2;
-		break;
+		return &Cpu::Thumb_CondBranch;
 
-	case THUMB_OP_SWI:
-		Thumb_SWI(opcode);
-		break;
-
-	case THUMB_OP_ADD_R_SP:
-		Thumb_ADD_R_SP(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_ADD_R_PC:
-		Thumb_ADD_R_PC(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_SUB_SP:
-		Thumb_SUB_SP(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_ADD_SP:
-		Thumb_ADD_SP(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_PUSH:		//push
-		Thumb_PUSH(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_POP:	//pop
-		Thumb_POP(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_LDMIA:	//multiple load
-		Thumb_LDMIA(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_STMIA:	//multiple store
-		Thumb_STMIA(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_BL_F:	//branch with link 1
-		Thumb_BL_1(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_BL_LR_IMM:	//branch with link 2
-		Thumb_BL_2(opcode);
-		break;
-
-	case THUMB_OP_STR_I:	//store immidate offset
-		Thumb_STR_I(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_LDR_I:	//load immidiate offset
-		Thumb_LDR_I(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_STRB_I:	//store byte immidate offset
-		Thumb_STRB_I(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_LDRB_I:	//load byte immidiate offset
-		Thumb_LDRB_I(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_STRH:	//store halfword
-		Thumb_STRH_I(opcode);
-		reg.R15 += 2;
-		break;
+	case THUMB_OP_SWI: return &Cpu::Thumb_SWI;
+	case THUMB_OP_ADD_R_SP: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ADD_R_SP>;
+	case THUMB_OP_ADD_R_PC: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ADD_R_PC>;
+	case THUMB_OP_SUB_SP: return &Cpu::Thumb_Sequential<&Cpu::Thumb_SUB_SP>;
+	case THUMB_OP_ADD_SP: return &Cpu::Thumb_Sequential<&Cpu::Thumb_ADD_SP>;
+	case THUMB_OP_PUSH: return &Cpu::Thumb_Sequential<&Cpu::Thumb_PUSH>;	//push
+	case THUMB_OP_POP: return &Cpu::Thumb_Sequential<&Cpu::Thumb_POP>;	//pop
+	case THUMB_OP_LDMIA: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDMIA>;	//multiple load
+	case THUMB_OP_STMIA: return &Cpu::Thumb_Sequential<&Cpu::Thumb_STMIA>;	//multiple store
+	case THUMB_OP_BL_F: return &Cpu::Thumb_Sequential<&Cpu::Thumb_BL_1>;	//branch with link 1
+	case THUMB_OP_BL_LR_IMM: return &Cpu::Thumb_BL_2;	//branch with link 2
+	case THUMB_OP_STR_I: return &Cpu::Thumb_Sequential<&Cpu::Thumb_STR_I>;	//store immidate offset
+	case THUMB_OP_LDR_I: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDR_I>;	//load immidiate offset
+	case THUMB_OP_STRB_I: return &Cpu::Thumb_Sequential<&Cpu::Thumb_STRB_I>;	//store byte immidate offset
+	case THUMB_OP_LDRB_I: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDRB_I>;	//load byte immidiate offset
+	case THUMB_OP_STRH: return &Cpu::Thumb_Sequential<&Cpu::Thumb_STRH_I>;	//store halfword
+	case THUMB_OP_LDRH: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDRH_I>;	//load halfword
+	case THUMB_OP_LDRH_R: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDRH_R>;	//load halfword register offset
+	case THUMB_OP_STRH_R: return &Cpu::Thumb_Sequential<&Cpu::Thumb_STRH_R>;	//store halfword register offset
+	case THUMB_OP_LDSH_R: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDRSH>;	//load sign-extended halfword
+	case THUMB_OP_LDSB_R: return &Cpu::Thumb_Sequential<&Cpu::Thumb_LDRSB>;	//load sign-extended byte
 
-	case THUMB_OP_LDRH:		//load halfword
-		Thumb_LDRH_I(opcode);
-		reg.R15 += 2;
-		break;
-
-	case THUMB_OP_LDRH_R:	//load halfword register offset
-		Thumb_LDRH_R(opcode);
-		reg.R15 += 2;
-		break;
+	default: return &Cpu::Thumb_NotImplemented;
+	}
+}
 
-	case THUMB_OP_STRH_R:	//store halfword register offset
-		Thumb_STRH_R(opcode);
-		reg.R15 += 2;
-		break;
+//only the NOP encoding depends on bits 5-0 and it runs as MOV r8, r8 anyway
+constexpr std::array<ThumbHandler, 1024> Cpu::buildThumbHandlerTable() {
+	std::array<ThumbHandler, 1024> table = {};
+	for (uint16_t i = 0; i < 1024; i++) {
+		table[i] = thumbHandler(ThumbDecoder::decode(i << 6));
+	}
+	return table;
+}
 
-	case THUMB_OP_LDSH_R:	//load sign-extended halfword
-		Thumb_LDRSH(opcode);
-		reg.R15 += 2;
-		break;
+constexpr std::array<ThumbHandler, 1024> Cpu::_thumbHandlers = Cpu::buildThumbHandlerTable();
 
-	case THUMB_OP_LDSB_R:	//load sign-extended byte
-		Thumb_LDRSB(opcode);
-		reg.R15 += 2;
-		break;
+constexpr std::array<uint16_t, 16> Cpu::_conditionTable = buildConditionTable();
 
-	default:
-		std::cout << "!! Thumb instruction not implemented: " << std::hex
-			<< "opcode: 0x" << opcode << ", instruction 0x" << instruction << std::endl;
-		system("pause");
-		exit(1);
-		break;
-	}
+//executes an instruction that doesn't change the program flow
+template <void (Cpu::*handler)(uint16_t)>
+void Cpu::Thumb_Sequential(uint16_t opcode) {
+	(this->*handler)(opcode);
+	reg.R15 += 2;
+}
 
+void Cpu::Thumb_NotImplemented(uint16_t opcode) {
+	std::cout << "!! Thumb instruction not implemented: " << std::hex
+		<< "opcode: 0x" << opcode << ", instruction 0x" << ThumbDecoder::decode(opcode) << std::endl;
+	system("pause");
+	exit(1);
 }
 
 //logic/arithm shift left
@@ -667,9 +941,7 @@ inline void Cpu::Thumb_LSL_IMM(uint16_t opcode) {
 	}
 
 	*Rd = Rs << offset;
-	reg.CPSR_f->C = (Rs >> (32 - offset)) & 1;
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = *Rd & 0x80000000;
+	setFlagsLogic(*Rd, (Rs >> (32 - offset)) & 1);
 }
 
 //logical right shift
@@ -686,9 +958,7 @@ inline void Cpu::Thumb_LSR_IMM(uint16_t opcode) {
 	}
 
 	*Rd = Rs >> offset;
-	reg.CPSR_f->C = (Rs >> (offset - 1)) & 1;
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = *Rd & 0x80000000;
+	setFlagsLogic(*Rd, (Rs >> (offset - 1)) & 1);
 }
 
 //arithmetic shift right
@@ -713,9 +983,7 @@ inline void Cpu::Thumb_ASR_IMM(uint16_t opcode) {
 		*Rd = (Rs >> offset) | (uint32_t)ones;
 	}
 
-	reg.CPSR_f->C = (Rs >> (offset - 1)) & 1;
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = *Rd & 0x80000000;
+	setFlagsLogic(*Rd, (Rs >> (offset - 1)) & 1);
 }
 
 //add register-register
@@ -732,11 +1000,7 @@ inline void Cpu::Thumb_ADD_RR(uint16_t opcode) {
 	uint64_t result = (uint64_t)Rs + (uint64_t)Rn;
 	*Rd = (uint32_t)result;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = (result >> 32) & 1;	//carry
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(Rn ^ Rs)) & (Rs ^ *Rd)) >> 31) & 1;
+	setFlagsAdd(Rs, Rn, *Rd);
 
 }
 
@@ -753,11 +1017,7 @@ inline void Cpu::Thumb_SUB_RR(uint16_t opcode) {
 
 	*Rd = Rs - Rn;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = !(Rs < Rn);	//carry = !borrow
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(Rs ^ (uint32_t)(-(int32_t)Rn))) & (Rs ^ *Rd)) >> 31) & 1;
+	setFlagsSub(Rs, Rn, *Rd);
 }
 
 //add register-immidiate
@@ -773,15 +1033,10 @@ inline void Cpu::Thumb_ADD_RI(uint16_t opcode) {
 	uint64_t result = (uint64_t)Rs + (uint64_t)nn;
 	*Rd = (uint32_t)result;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = (result >> 32) & 1;	//carry
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(nn ^ Rs)) & (Rs ^ *Rd)) >> 31) & 1;
+	setFlagsAdd(Rs, nn, *Rd);
 }
 
 //sub register-immidiate
-//TODO: for overflow flag maybe we should consider 2nd operand as negative
 inline void Cpu::Thumb_SUB_RI(uint16_t opcode) {
 	uint32_t nn = (opcode >> 6) & 0b111;	//operand immidiate
 
@@ -792,11 +1047,7 @@ inline void Cpu::Thumb_SUB_RI(uint16_t opcode) {
 	uint32_t* Rd = &((uint32_t*)&reg)[Rd_reg_code];	//destination register
 
 	uint32_t result = Rs - nn;
-	reg.CPSR_f->Z = result == 0;
-	reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = !(Rs < nn);	//carry = !borrow
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(Rs ^ (uint32_t)(-(int32_t)nn))) & (Rs ^ result)) >> 31) & 1;
+	setFlagsSub(Rs, nn, result);
 
 	*Rd = result;
 }
@@ -812,8 +1063,7 @@ inline void Cpu::Thumb_MVN(uint16_t opcode) {
 
 	*Rd = ~Rs;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;
+	setFlagsNZ(*Rd);
 }
 
 //OR logical
@@ -826,8 +1076,7 @@ inline void  Cpu::Thumb_ORR(uint16_t opcode) {
 
 	*Rd |= Rs;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;
+	setFlagsNZ(*Rd);
 }
 
 //CMP
@@ -839,11 +1088,7 @@ inline void Cpu::Thumb_CMP(uint16_t opcode) {
 	uint32_t Rd = ((uint32_t*)&reg)[Rd_reg_code];
 
 	uint32_t result = Rd - Rs;
-	reg.CPSR_f->Z = result == 0;
-	reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = !(Rd < Rs);	//carry = !borrow
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(Rd ^ (uint32_t)(-(int32_t)Rs))) & (Rd ^ result)) >> 31) & 1;
+	setFlagsSub(Rd, Rs, result);
 }
 
 //cmn
@@ -854,13 +1099,9 @@ inline void Cpu::Thumb_CMN(uint16_t opcode) {
 	uint8_t Rd_reg_code = opcode & 0b111;
 	uint32_t Rd = ((uint32_t*)&reg)[Rd_reg_code];
 
-	uint64_t result = (uint64_t)Rd + (uint64_t)Rs;
+	uint32_t result = Rd + Rs;
 
-	reg.CPSR_f->Z = (result & 0xffffffff) == 0;
-	reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = (result >> 32) & 1;	//carry
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(Rd ^ Rs)) & (Rd ^ result)) >> 31) & 1;
+	setFlagsAdd(Rd, Rs, result);
 }
 
 //ROR
@@ -873,9 +1114,7 @@ inline void Cpu::Thumb_ROR(uint16_t opcode){
 
 	*Rd = shifterRightRotate(*Rd, Rs & 0xff);
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;
-	reg.CPSR_f->C = shifter_carry_out;
+	setFlagsLogic(*Rd, shifter_carry_out);
 
 	GBA::clock.addTicks(1);
 }
@@ -890,8 +1129,7 @@ inline void Cpu::Thumb_EOR(uint16_t opcode) {
 
 	*Rd ^= Rs;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;
+	setFlagsNZ(*Rd);
 }
 
 //multiply
@@ -904,9 +1142,7 @@ inline void Cpu::Thumb_MUL(uint16_t opcode) {
 
 	*Rd *= Rs;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;
-	reg.CPSR_f->C = 0;
+	setFlagsLogic(*Rd, false);
 
 	GBA::clock.addTicks(4);	//not accurate but is fine for most cases
 }
@@ -921,8 +1157,7 @@ inline void Cpu::Thumb_BIC(uint16_t opcode) {
 
 	*Rd &= ~Rs;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;
+	setFlagsNZ(*Rd);
 
 }
 
@@ -936,8 +1171,7 @@ inline void Cpu::Thumb_AND(uint16_t opcode) {
 
 	*Rd &= Rs;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;
+	setFlagsNZ(*Rd);
 }
 
 inline void Cpu::Thumb_LSR(uint16_t opcode) {
@@ -949,12 +1183,12 @@ inline void Cpu::Thumb_LSR(uint16_t opcode) {
 
 	if (Rs > 0) {
 		uint32_t pre_result = *Rd >> ((Rs & 0xff) - 1);
-		reg.CPSR_f->C = pre_result & 1;
 		*Rd = pre_result >> 1;
+		setFlagsLogic(*Rd, pre_result & 1);
+	}
+	else {
+		setFlagsNZ(*Rd);
 	}
-
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;
 
 }
 
@@ -967,12 +1201,12 @@ inline void Cpu::Thumb_LSL(uint16_t opcode) {
 
 	if (Rs > 0) {
 		uint32_t pre_result = *Rd << ((Rs & 0xff) - 1);
-		reg.CPSR_f->C = (pre_result >> 31) & 1;
 		*Rd = pre_result << 1;
+		setFlagsLogic(*Rd, (pre_result >> 31) & 1);
+	}
+	else {
+		setFlagsNZ(*Rd);
 	}
-
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;
 }
 
 inline void Cpu::Thumb_ASR(uint16_t opcode) {
@@ -983,12 +1217,13 @@ inline void Cpu::Thumb_ASR(uint16_t opcode) {
 	uint32_t &Rd = ((uint32_t*)&reg)[Rd_reg_code];	//destination register
 
 	if (Rs > 0) {
-		reg.CPSR_f->C = (Rd >> ((Rs & 0xff) - 1)) & 1;
+		bool carry = (Rd >> ((Rs & 0xff) - 1)) & 1;
 		Rd = arithmRight(Rd, Rs & 0xff);
-	}	
-
-	reg.CPSR_f->Z = Rd == 0;
-	reg.CPSR_f->N = (Rd & 0x80000000) != 0;
+		setFlagsLogic(Rd, carry);
+	}
+	else {
+		setFlagsNZ(Rd);
+	}
 }
 
 //TST
@@ -1001,8 +1236,7 @@ inline void Cpu::Thumb_TST(uint16_t opcode) {
 
 	uint32_t result = Rd & Rs;
 
-	reg.CPSR_f->Z = result == 0;
-	reg.CPSR_f->N = (result & 0x80000000) != 0;
+	setFlagsNZ(result);
 }
 
 //negate
@@ -1015,11 +1249,7 @@ inline void Cpu::Thumb_NEG(uint16_t opcode) {
 	
 	uint32_t result = 0 - Rs;
 
-	reg.CPSR_f->Z = result == 0;
-	reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = !(0 < Rs);	//carry = !borrow
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(0 ^ (uint32_t)(-(int32_t)Rs))) & (0 ^ result)) >> 31) & 1;
+	setFlagsSub(0, Rs, result);
 
 	*Rd = result;
 }
@@ -1032,12 +1262,10 @@ inline void Cpu::Thumb_MOV_I(uint16_t opcode) {
 	uint8_t nn = opcode & 0xff;
 	*Rd = nn;
 
-	reg.CPSR_f->Z = nn == 0;
-	reg.CPSR_f->N = (nn & 0x80000000) != 0;
+	setFlagsNZ(nn);
 }
 
 //sub immidiate.
-//TODO: for overflow flag maybe we should consider 2nd operand as negative
 inline void Cpu::Thumb_SUB_I(uint16_t opcode) {
 	uint8_t Rd_reg_code = (opcode >> 8) & 0b111;
 	uint32_t* Rd = &((uint32_t*)&reg)[Rd_reg_code];	//operand register
@@ -1045,11 +1273,7 @@ inline void Cpu::Thumb_SUB_I(uint16_t opcode) {
 	uint32_t nn = opcode & 0xff;
 	uint32_t result = *Rd - nn;
 
-	reg.CPSR_f->Z = result == 0;
-	reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = !(*Rd < nn);	//carry = !borrow
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(*Rd ^ (uint32_t)(-(int32_t)nn))) & (*Rd ^ result)) >> 31) & 1;
+	setFlagsSub(*Rd, nn, result);
 
 	*Rd = result;
 }
@@ -1064,15 +1288,10 @@ inline void Cpu::Thumb_ADD_I(uint16_t opcode) {
 	uint64_t result = (uint64_t)oper1 + (uint64_t)nn;
 	*Rd = result;
 
-	reg.CPSR_f->Z = *Rd == 0;
-	reg.CPSR_f->N = (*Rd & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = (result >> 32) & 1;	//carry
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(oper1 ^ nn)) & (nn ^ *Rd)) >> 31) & 1;
+	setFlagsAdd(oper1, nn, *Rd);
 }
 
 //compare immidiate
-//TODO: for overflow flag maybe we should consider 2nd operand as negative
 inline void Cpu::Thumb_CMP_I(uint16_t opcode) {
 	uint8_t Rd_reg_code = (opcode >> 8) & 0b111;
 	uint32_t Rd = ((uint32_t*)&reg)[Rd_reg_code];	//operand register
@@ -1080,11 +1299,7 @@ inline void Cpu::Thumb_CMP_I(uint16_t opcode) {
 	uint32_t nn = opcode & 0xff;
 	uint32_t result = Rd - nn;
 
-	reg.CPSR_f->Z = result == 0;
-	reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = !(Rd < nn);	//carry = !borrow
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(Rd ^ (uint32_t)(-(int32_t)nn))) & (Rd ^ result)) >> 31) & 1;
+	setFlagsSub(Rd, nn, result);
 }
 
 //load pc-relative
@@ -1349,11 +1564,7 @@ inline void Cpu::Thumb_CMP_HRR(uint16_t opcode) {
 
 	uint32_t result = Rd - Rs;
 
-	reg.CPSR_f->Z = result == 0;
-	reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = !(Rd < Rs);	//carry = !borrow
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(Rd ^ (uint32_t)(-(int32_t)Rs))) & (Rd ^ result)) >> 31) & 1;
+	setFlagsSub(Rd, Rs, result);
 }
 
 //branch exchange
@@ -1376,6 +1587,14 @@ inline void Cpu::Thumb_BX(uint16_t opcode) {
 inline void Cpu::Thumb_PUSH(uint16_t opcode) {
 
 	uint8_t registers_to_push = opcode & 0xff;
+	uint32_t count = std::bitset<9>(opcode & 0x1ff).count();
+	uint32_t* block = GBA::memory.transferBlock(reg.R13 - count * 4, count, true);
+
+	if (block != nullptr) {	//stack in plain memory
+		storeBlock(block, registers_to_push | ((opcode & 0x100) << 6));	//lr is register 14
+		reg.R13 -= count * 4;
+		return;
+	}
 
 	if (opcode & 0x100) {
 		reg.R13 -= 4;
@@ -1394,6 +1613,18 @@ inline void Cpu::Thumb_PUSH(uint16_t opcode) {
 //pop
 inline void Cpu::Thumb_POP(uint16_t opcode) {
 	uint8_t registers_to_pop = opcode & 0xff;
+	uint32_t count = std::bitset<9>(opcode & 0x1ff).count();
+	uint32_t* block = GBA::memory.transferBlock(reg.R13, count, false);
+
+	if (block != nullptr) {	//stack in plain memory
+		loadBlock(block, registers_to_pop);
+		if (opcode & 0x100) {
+			reg.R15 = block[count - 1] & 0xfffffffe;	//ignore least significant bit
+			reg.R15 -= 2;	//to compensate for the R15 increase after the execution
+		}
+		reg.R13 += count * 4;
+		return;
+	}
 
 	for (int i = 0; i < 8; i++) {
 		if ((registers_to_pop >> i) & 1) {
@@ -1424,11 +1655,20 @@ inline void Cpu::Thumb_LDMIA(uint16_t opcode) {
 		return;
 	}
 
-	for (int i = 0; i < 8; i++) {	//load registers
-		if ((rList >> i) & 1) {
-			uint32_t* r = &((uint32_t*)&reg)[i];
-			*r = GBA::memory.read_32(addr);
-			addr += 4;
+	uint32_t count = std::bitset<8>(rList).count();
+	uint32_t* block = GBA::memory.transferBlock(addr, count, false);
+
+	if (block != nullptr) {
+		loadBlock(block, rList);
+		addr += count * 4;
+	}
+	else {
+		for (int i = 0; i < 8; i++) {	//load registers
+			if ((rList >> i) & 1) {
+				uint32_t* r = &((uint32_t*)&reg)[i];
+				*r = GBA::memory.read_32(addr);
+				addr += 4;
+			}
 		}
 	}
 
@@ -1453,11 +1693,20 @@ inline void Cpu::Thumb_STMIA(uint16_t opcode) {
 		return;
 	}
 
-	for (int i = 0; i < 8; i++) {	//store registers
-		if ((rList >> i) & 1) {
-			uint32_t r = ((uint32_t*)&reg)[i];
-			GBA::memory.write_32(addr, r);
-			addr += 4;
+	uint32_t count = std::bitset<8>(rList).count();
+	uint32_t* block = GBA::memory.transferBlock(addr, count, true);
+
+	if (block != nullptr) {
+		storeBlock(block, rList);
+		addr += count * 4;
+	}
+	else {
+		for (int i = 0; i < 8; i++) {	//store registers
+			if ((rList >> i) & 1) {
+				uint32_t r = ((uint32_t*)&reg)[i];
+				GBA::memory.write_32(addr, r);
+				addr += 4;
+			}
 		}
 	}
 
@@ -1472,15 +1721,20 @@ inline void Cpu::Thumb_STMIA(uint16_t opcode) {
 	}
 }
 
-inline void Cpu::Thumb_SWI(uint16_t opcode) {
-	uint32_t prev_cpsr = reg.CPSR;	//save cpsr
-	setPrivilegeMode(PrivilegeMode::SUPERVISOR);	//change cpu mode
-	reg.SPSR = prev_cpsr;	//set irq spsr to previous cpsr
-	reg.R14 = reg.R15 + 2;	//save R15
-	reg.CPSR_f->I = 1;	//disable interrupts
+//conditional branch
+inline void Cpu::Thumb_CondBranch(uint16_t opcode) {
+	if (thumbCheckCondition(opcode)) {
+		int8_t offset_8 = (int8_t)(opcode & 0xff);
+		int16_t offset = ((int16_t)offset_8 * 2) + 4;
+		reg.R15 += offset;
+		GBA::clock.addTicks(2);
+		return;
+	}
+	reg.R15 += 2;
+}
 
-	reg.CPSR_f->T = 0;	//set arm mode
-	reg.R15 = 0x8;	//swi vector
+inline void Cpu::Thumb_SWI(uint16_t opcode) {
+	RaiseSWI(opcode & 0xff);
 }
 
 //unconditional branch
@@ -1580,70 +1834,124 @@ inline void Cpu::Thumb_STR_SP(uint16_t opcode) {
 
 bool Cpu::arm_checkInstructionCondition(uint32_t opcode) {
 	uint8_t condition = (opcode >> 28) & 0x0f;
+	if (condition == 0xe)	//AL: don't build the flags
+		return true;
 
-	bool condition_met = false;
+	return (_conditionTable[condition] >> flags()) & 1;
+}
 
-	switch (condition) {
-	case 0:	//EQ (z = 1)
-		condition_met = reg.CPSR_f->Z == 1;
-		break;
-	case 1:		//NE (z = 0)
-		condition_met = reg.CPSR_f->Z == 0;
-		break;
-	case 2:		//CS/HS (c = 1)
-		condition_met = reg.CPSR_f->C == 1;
-		break;
-	case 3:		//CC/LO	(c = 0)
-		condition_met = reg.CPSR_f->C == 0;
-		break;
-	case 4:		//MI (N = 1) negative
-		condition_met = reg.CPSR_f->N == 1;
-		break;
-	case 5:		//PL (N = 0) >= 0
-		condition_met = reg.CPSR_f->N == 0;
-		break;
-	case 6:		//VS (V = 1) overflow
-		condition_met = reg.CPSR_f->V == 1;
-		break;
-	case 7:		//VC (V = 0) no overflow
-		condition_met = reg.CPSR_f->V == 0;
-		break;
-	case 8:		//HI (C = 1 and Z = 0)	unsigned higher
-		condition_met = (reg.CPSR_f->C == 1) && (reg.CPSR_f->Z == 0);
-		break;
-	case 9:		//LS (C = 0 or Z=1)	unsigned lower or same
-		condition_met = (reg.CPSR_f->C == 0) || (reg.CPSR_f->Z == 1);
-		break;
-	case 0xa:	//GE (N = V) signed greater or equal
-		condition_met = reg.CPSR_f->N == reg.CPSR_f->V;
-		break;
-	case 0xb:	//LT (N!=V)	signed less than
-		condition_met = reg.CPSR_f->N != reg.CPSR_f->V;
-		break;
-	case 0xc:	//GT (Z=0 and N=V)	signed greater than
-		condition_met = (reg.CPSR_f->Z == 0) && (reg.CPSR_f->N == reg.CPSR_f->V);
-		break;
-	case 0xd:	//LE (Z=1 or N!=V)	signed less or equal
-		condition_met = (reg.CPSR_f->Z == 1) || (reg.CPSR_f->N != reg.CPSR_f->V);
-		break;
-	case 0xe:	//AL always
-		condition_met = true;
-		break;
-	case 0xf:	//NV never
-		condition_met = false;
-		break;
+//fill the handler table from the decoder lookup table
+void Cpu::buildArmHandlerTable() {
+	for (uint16_t i = 0; i < 4096; i++) {
+		_armHandlers[i] = armHandler(ArmDecoder::tableEntry(i), i);
 	}
-
-	return condition_met;
 }
 
-void Cpu::execute_arm(ARM_opcode instruction, uint32_t opcode) {
+//handler that executes an instruction. Instructions without a dedicated handler
+//go through the full decoder
+ArmHandler Cpu::armHandler(ARM_opcode instruction, uint16_t index) {
+	switch (instruction) {
+	case ARM_OP_B: return &Cpu::Arm_B;
+	case ARM_OP_BL: return &Cpu::Arm_BL;
+	case ARM_OP_BX: return &Cpu::Arm_BX;
+	case ARM_OP_AND: case ARM_OP_EOR: case ARM_OP_SUB: case ARM_OP_RSB:
+	case ARM_OP_ADD: case ARM_OP_ADC: case ARM_OP_TST: case ARM_OP_TEQ:
+	case ARM_OP_CMP: case ARM_OP_ORR: case ARM_OP_MOV: case ARM_OP_BIC:
+		return aluHandler(instruction, index);
+	case ARM_OP_LDRH: return &Cpu::Arm_Sequential<&Cpu::Arm_LDRH>;
+	case ARM_OP_STRH: return &Cpu::Arm_Sequential<&Cpu::Arm_STRH>;
+	case ARM_OP_LDRSH: return &Cpu::Arm_Sequential<&Cpu::Arm_LDRSH>;
+	case ARM_OP_LDRSB: return &Cpu::Arm_Sequential<&Cpu::Arm_LDRSB>;
+	case ARM_OP_LDM: return &Cpu::Arm_Sequential<&Cpu::Arm_LDM>;
+	case ARM_OP_STM: return &Cpu::Arm_Sequential<&Cpu::Arm_STM>;
+	case ARM_OP_LDR: return &Cpu::Arm_Sequential<&Cpu::Arm_LDR>;
+	case ARM_OP_STR: return &Cpu::Arm_Sequential<&Cpu::Arm_STR>;
+	case ARM_OP_MSR: return &Cpu::Arm_Sequential<&Cpu::Arm_MSR>;
+	case ARM_OP_MRS: return &Cpu::Arm_Sequential<&Cpu::Arm_MRS>;
+	case ARM_OP_MUL: return &Cpu::Arm_Sequential<&Cpu::Arm_MUL>;
+	case ARM_OP_MULL: return &Cpu::Arm_Sequential<&Cpu::Arm_MULL>;
+	case ARM_OP_SWI: return &Cpu::Arm_SWI;
+	default: return &Cpu::Arm_FullDecode;
+	}
+}
+
+//data processing handler specialized for an operand form:
+//bit 4 I, bit 3 S, bit 2 shift by register, bits 1-0 shift type
+template <ARM_opcode instruction, uint8_t form>
+constexpr ArmHandler Cpu::aluHandler() {
+	constexpr bool I = (form & 0x10) != 0;
+	constexpr bool S = (form & 0x08) != 0;
+	constexpr uint8_t shift = I ? 0 : form & 0x07;	//the shift bits are part of the immidiate
 
-	if (!arm_checkInstructionCondition(opcode)) {	//doesn't meet the condition
-		reg.R15 += 4;
-		//GBA::clock.addTicks(1);
-		return;
+	switch (instruction) {
+	case ARM_OP_AND: return &Cpu::Arm_Sequential<&Cpu::Arm_AND<I, S, shift>>;
+	case ARM_OP_EOR: return &Cpu::Arm_Sequential<&Cpu::Arm_EOR<I, S, shift>>;
+	case ARM_OP_SUB: return &Cpu::Arm_Sequential<&Cpu::Arm_SUB<I, S, shift>>;
+	case ARM_OP_RSB: return &Cpu::Arm_Sequential<&Cpu::Arm_RSB<I, S, shift>>;
+	case ARM_OP_ADD: return &Cpu::Arm_Sequential<&Cpu::Arm_ADD<I, S, shift>>;
+	case ARM_OP_ADC: return &Cpu::Arm_Sequential<&Cpu::Arm_ADC<I, S, shift>>;
+	case ARM_OP_TST: return &Cpu::Arm_Sequential<&Cpu::Arm_TST<I, S, shift>>;
+	case ARM_OP_TEQ: return &Cpu::Arm_Sequential<&Cpu::Arm_TEQ<I, S, shift>>;
+	case ARM_OP_CMP: return &Cpu::Arm_Sequential<&Cpu::Arm_CMP<I, S, shift>>;
+	case ARM_OP_ORR: return &Cpu::Arm_Sequential<&Cpu::Arm_ORR<I, S, shift>>;
+	case ARM_OP_MOV: return &Cpu::Arm_Sequential<&Cpu::Arm_MOV<I, S, shift>>;
+	default: return &Cpu::Arm_Sequential<&Cpu::Arm_BIC<I, S, shift>>;
+	}
+}
+
+template <ARM_opcode instruction, size_t... forms>
+constexpr std::array<ArmHandler, 32> Cpu::aluHandlers(std::index_sequence<forms...>) {
+	return { aluHandler<instruction, forms>()... };
+}
+
+//the specialized handler for a lookup table index. the operand form is in
+//bit 9 (I), bit 4 (S) and bits 2-0 (shift type, shift by register) of the index
+ArmHandler Cpu::aluHandler(ARM_opcode instruction, uint16_t index) {
+	static const std::array<ArmHandler, 32> handlers[] = {
+		aluHandlers<ARM_OP_AND>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_EOR>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_SUB>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_RSB>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_ADD>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_ADC>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_TST>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_TEQ>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_CMP>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_ORR>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_MOV>(std::make_index_sequence<32>()),
+		aluHandlers<ARM_OP_BIC>(std::make_index_sequence<32>())
+	};
+	uint8_t form = ((index >> 5) & 0x10) | ((index >> 1) & 0x08) | ((index & 1) << 2) | ((index >> 1) & 0x03);
+
+	switch (instruction) {
+	case ARM_OP_AND: return handlers[0][form];
+	case ARM_OP_EOR: return handlers[1][form];
+	case ARM_OP_SUB: return handlers[2][form];
+	case ARM_OP_RSB: return handlers[3][form];
+	case ARM_OP_ADD: return handlers[4][form];
+	case ARM_OP_ADC: return handlers[5][form];
+	case ARM_OP_TST: return handlers[6][form];
+	case ARM_OP_TEQ: return handlers[7][form];
+	case ARM_OP_CMP: return handlers[8][form];
+	case ARM_OP_ORR: return handlers[9][form];
+	case ARM_OP_MOV: return handlers[10][form];
+	default: return handlers[11][form];
 	}
+}
+
+//executes an instruction that doesn't change the program flow
+template <void (Cpu::*handler)(uint32_t)>
+void Cpu::Arm_Sequential(uint32_t opcode) {
+	(this->*handler)(opcode);
+	reg.R15 += 4;
+}
+
+//slow path for table entries that need the whole opcode to be decoded
+void Cpu::Arm_FullDecode(uint32_t opcode) {
+	execute_arm(ArmDecoder::decode(opcode), opcode);
+}
+
+void Cpu::execute_arm(ARM_opcode instruction, uint32_t opcode) {
 
 	switch (instruction) {
 	case ARM_OP_B:	//branch
@@ -1658,64 +1966,10 @@ void Cpu::execute_arm(ARM_opcode instruction, uint32_t opcode) {
 		Arm_BX(opcode);
 		break;
 
-	case ARM_OP_AND:	//and
-		Arm_AND(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_EOR:	//xor
-		Arm_EOR(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_CMP:		//cmp
-		Arm_CMP(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_MOV:		//mov
-		Arm_MOV(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_ADD:	//add
-		Arm_ADD(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_ADC:	//adc
-		Arm_ADC(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_SUB:	//subtract
-		Arm_SUB(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_RSB:	//reversed subtract
-		Arm_RSB(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_BIC:	//bic
-		Arm_BIC(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_TEQ:	//test xor
-		Arm_TEQ(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_TST:	//test and
-		Arm_TST(opcode);
-		reg.R15 += 4;
-		break;
-
-	case ARM_OP_ORR:	//logical or
-		Arm_ORR(opcode);
-		reg.R15 += 4;
+	case ARM_OP_AND: case ARM_OP_EOR: case ARM_OP_SUB: case ARM_OP_RSB:	//data processing
+	case ARM_OP_ADD: case ARM_OP_ADC: case ARM_OP_TST: case ARM_OP_TEQ:
+	case ARM_OP_CMP: case ARM_OP_ORR: case ARM_OP_MOV: case ARM_OP_BIC:
+		(this->*aluHandler(instruction, ArmDecoder::tableIndex(opcode)))(opcode);
 		break;
 
 	case ARM_OP_LDRH:	//load halfword
@@ -1778,6 +2032,10 @@ void Cpu::execute_arm(ARM_opcode instruction, uint32_t opcode) {
 		reg.R15 += 4;
 		break;
 
+	case ARM_OP_SWI:	//software interrupt
+		Arm_SWI(opcode);
+		break;
+
 	default:
 		std::cout << "!! Arm instruction not implemented: " << std::hex 
 			<< "opcode: 0x" << opcode << ", instruction 0x" << instruction << std::endl;
@@ -1799,7 +2057,7 @@ int32_t Cpu::convert_24Bit_to_32Bit_signed(uint32_t val) {
 /*
 inline uint32_t Cpu::shifterLeftRotate(uint32_t n, int bits) {
 	if (bits == 0) {
-		shifter_carry_out = reg.CPSR_f->C;
+		shifter_carry_out = carryFlag();
 		return;
 	}
 	return (n << bits) | (n >> (32 - bits));
@@ -1808,7 +2066,7 @@ inline uint32_t Cpu::shifterLeftRotate(uint32_t n, int bits) {
 //rotate right with the cpu shifter updating also the shifter carry out
 inline uint32_t Cpu::shifterRightRotate(uint32_t n, int bits) {
 	if (bits == 0) {
-		shifter_carry_out = reg.CPSR_f->C;
+		shifter_carry_out = carryFlag();
 		return n;
 	}
 	shifter_carry_out = (n >> (bits - 1)) & 1;	//carry = last rotated bit
@@ -1830,6 +2088,79 @@ inline uint32_t Cpu::arithmRight(uint32_t n, int bits) {
 	return (n >> bits) | (uint32_t)ones;
 }
 
+//n and z from the result, c and v stay as they are
+inline void Cpu::setFlagsNZ(uint32_t result) {
+	if (_flags.kind >= FLAGS_ADD)	//c and v only live in the operands
+		syncFlags();
+#ifdef _DEBUG
+	setEagerFlags(result >> 31, result == 0, -1, -1);
+#endif
+	if (_flags.kind != FLAGS_LOGIC)
+		_flags.kind = FLAGS_NZ;
+	_flags.result = result;
+}
+
+//n and z from the result, c from the shifter. v stays
+inline void Cpu::setFlagsLogic(uint32_t result, bool carry) {
+	if (_flags.kind >= FLAGS_ADD)
+		syncFlags();
+#ifdef _DEBUG
+	setEagerFlags(result >> 31, result == 0, carry, -1);
+#endif
+	_flags.kind = FLAGS_LOGIC;
+	_flags.result = result;
+	_flags.carry = carry;
+}
+
+inline void Cpu::setFlagsAdd(uint32_t op1, uint32_t op2, uint32_t result) {
+#ifdef _DEBUG
+	setEagerFlags(result >> 31, result == 0, (((uint64_t)op1 + op2) >> 32) & 1,
+		(((~(op1 ^ op2)) & (op1 ^ result)) >> 31) & 1);
+#endif
+	_flags.kind = FLAGS_ADD;
+	_flags.result = result;
+	_flags.op1 = op1;
+	_flags.op2 = op2;
+}
+
+inline void Cpu::setFlagsSub(uint32_t op1, uint32_t op2, uint32_t result) {
+#ifdef _DEBUG
+	setEagerFlags(result >> 31, result == 0, !(op1 < op2),
+		(((op1 ^ op2) & (op1 ^ result)) >> 31) & 1);
+#endif
+	_flags.kind = FLAGS_SUB;
+	_flags.result = result;
+	_flags.op1 = op1;
+	_flags.op2 = op2;
+}
+
+//all the flags at once, for what the lazy kinds can't express
+inline void Cpu::setFlags(uint32_t nzcv) {
+#ifdef _DEBUG
+	_flags.eager = nzcv;
+#endif
+	reg.CPSR = (reg.CPSR & 0x0fffffff) | (nzcv << 28);
+	_flags.kind = FLAGS_CPSR;
+}
+
+#ifdef _DEBUG
+//the flags as the eager code set them. a negative value keeps the previous flag
+void Cpu::setEagerFlags(int n, int z, int c, int v) {
+	uint32_t eager = _flags.kind == FLAGS_CPSR ? reg.CPSR >> 28 : _flags.eager;
+	int flag[4] = { v, c, z, n };
+
+	for (int i = 0; i < 4; i++)
+		if (flag[i] >= 0)
+			eager = (eager & ~(1 << i)) | (flag[i] << i);
+	_flags.eager = eager;
+}
+
+void Cpu::checkFlags(uint32_t nzcv) {
+	if (nzcv != _flags.eager)
+		printError(ERROR, "lazy flags " + std::to_string(nzcv) + " differ from the eager flags " + std::to_string(_flags.eager));
+}
+#endif
+
 
 //branch
 inline void Cpu::Arm_B(uint32_t opcode) {
@@ -1866,11 +2197,15 @@ inline void Cpu::Arm_BX(uint32_t opcode) {
 	GBA::clock.addTicks(2);
 }
 
+//software interrupt, the bios reads the call number from bits 16-23
+inline void Cpu::Arm_SWI(uint32_t opcode) {
+	RaiseSWI((opcode >> 16) & 0xff);
+}
 
-inline void Cpu::ARM_ALU_unpacker(uint32_t opcode, uint32_t** destReg, uint32_t& oper1, uint32_t& oper2, uint8_t &s) {
 
-	uint8_t I = (opcode >> 25) & 1;
-	s = (opcode >> 20) & 1;	//set condition code
+//I: immidiate operand 2. shift: bit 2 shift amount in a register, bits 1-0 shift type
+template <bool I, uint8_t shift>
+inline void Cpu::ARM_ALU_unpacker(uint32_t opcode, uint32_t** destReg, uint32_t& oper1, uint32_t& oper2) {
 
 	//get destination register
 	uint8_t dest_reg_code = (opcode >> 12) & 0x0f;
@@ -1881,7 +2216,7 @@ inline void Cpu::ARM_ALU_unpacker(uint32_t opcode, uint32_t** destReg, uint32_t&
 	oper1 = ((uint32_t*)&reg)[reg_1_code];
 	if (reg_1_code == 0xf) oper1 += 8;
 
-	if (I) {	//immidiate 2nd operand 
+	if constexpr (I) {	//immidiate 2nd operand 
 		uint8_t Is = (opcode >> 8) & 0x0f;
 		uint32_t nn = opcode & 0xff;
 		if (Is != 0) {
@@ -1889,79 +2224,65 @@ inline void Cpu::ARM_ALU_unpacker(uint32_t opcode, uint32_t** destReg, uint32_t&
 			//shifter_carry_out = (oper2 >> 31) & 1;
 		}
 		else {
-			shifter_carry_out = reg.CPSR_f->C;
+			shifter_carry_out = carryFlag();
 			oper2 = nn;
 		}
-		
-		return;
 	}
-	
-	//operand 2 is a register
-	ARM_ALU_oper2_getter(opcode, oper2);
-
+	else {	//operand 2 is a register
+		ARM_ALU_oper2_getter<shift>(opcode, oper2);
+	}
 }
 
-inline void Cpu::ARM_Shifter(uint8_t shiftType, uint8_t shift_amount, uint32_t val, uint32_t& result, bool enableSpecialShift) {
+template <uint8_t shiftType, bool enableSpecialShift>
+inline void Cpu::ARM_Shifter(uint8_t shift_amount, uint32_t val, uint32_t& result) {
 
-	shifter_carry_out = reg.CPSR_f->C;
+	shifter_carry_out = carryFlag();
 	if (shift_amount) {	//there is a shift
 		GBA::clock.addTicks(1);
-		switch (shiftType) {
-		case 0:		//logical left
+		if constexpr (shiftType == 0) {		//logical left
 			shifter_carry_out = (val >> (32 - shift_amount)) & 1;	//carry = last lost bit
 			result = val << shift_amount;
-			break;
-
-		case 1:		//logical right
+		}
+		else if constexpr (shiftType == 1) {	//logical right
 			shifter_carry_out = (val >> (shift_amount - 1)) & 1;	//carry = last lost bit
 			result = val >> shift_amount;
-			break;
-
-		case 2:		//arithmetic right
+		}
+		else if constexpr (shiftType == 2) {	//arithmetic right
 			shifter_carry_out = (val >> (shift_amount - 1)) & 1;	//carry = last lost bit
 			result = arithmRight(val, shift_amount);
-			break;
-
-		case 3:		//rotate right
-			//shifter_carry_out = (val >> (shift_amount - 1)) & 1;	//carry = last rotated bit
+		}
+		else {		//rotate right
 			result = shifterRightRotate(val, shift_amount);
-			break;
 		}
 		return;
 	}
 
 	//special shifts only for immidiate shift amount
-	if (!enableSpecialShift) {
+	if constexpr (!enableSpecialShift) {
 		result = val;
-		return;
 	}
-
-	switch (shiftType) {
-	case 0:		//logical left
-		shifter_carry_out = reg.CPSR_f->C;
+	else if constexpr (shiftType == 0) {	//logical left
+		shifter_carry_out = carryFlag();
 		result = val;
-		break;
-
-	case 1:		//logical right
+	}
+	else if constexpr (shiftType == 1) {	//logical right
 		shifter_carry_out = (val >> 31) & 1;	//carry: 31th bit
 		result = 0;
-		break;
-
-	case 2:		//arithmetic right
+	}
+	else if constexpr (shiftType == 2) {	//arithmetic right
 		shifter_carry_out = (val >> 31) & 1;	//carry: 31th bit
 		result = (shifter_carry_out == 0 ? 0 : 0xffffffff);
-		break;
-
-	case 3:		//rotate right extended
+	}
+	else {	//rotate right extended
 		GBA::clock.addTicks(1);
 		uint8_t prev_carry = (val >> 31) & 1;
 		shifter_carry_out = val & 1;
 		result = val >> 1;
 		result |= (prev_carry << 31);
-		break;
 	}
 }
 
+template <uint8_t shift>
 inline void Cpu::ARM_ALU_oper2_getter(uint32_t opcode, uint32_t& oper2) {
 
 	//get operand 2 register
@@ -1970,316 +2291,278 @@ inline void Cpu::ARM_ALU_oper2_getter(uint32_t opcode, uint32_t& oper2) {
 	uint32_t real_Rm = 0;	//register value corrected in case of R15
 	uint8_t Is;	//shift amount
 
-	if (opcode & 0x10) {	//bit 4 set: shift amount taken from a register
+	if constexpr ((shift & 0x4) != 0) {	//bit 4 set: shift amount taken from a register
 		uint8_t shift_reg_code = (opcode >> 8) & 0x0f;
 		uint32_t Rs = ((uint32_t*)&reg)[shift_reg_code];
 		Is = Rs & 0xff;
 		if (operand_reg_code == 0xf) real_Rm = 12;
 
 		real_Rm += Rm;
-
-		uint8_t ST = (opcode >> 5) & 0x3;	//shift type
-		ARM_Shifter(ST, Is, real_Rm, oper2, false);
+		ARM_Shifter<shift & 0x3, false>(Is, real_Rm, oper2);
 	}
 	else { //bit 4 clear: immidiate shift amount 
 		Is = (opcode >> 7) & 0x1f;
 		if (operand_reg_code == 0xf) real_Rm = 8;
 
 		real_Rm += Rm;
-
-		uint8_t ST = (opcode >> 5) & 0x3;	//shift type
-		ARM_Shifter(ST, Is, real_Rm, oper2, true);
+		ARM_Shifter<shift & 0x3, true>(Is, real_Rm, oper2);
 	}
 }
 
 //arithmetic operation
-//TODO: for overflow flag maybe we should consider 2nd operand as negative
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_CMP(uint32_t opcode) {
 	uint32_t oper1, oper2, *dest_reg;
-	uint8_t s;
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 
 	uint32_t result = oper1 - oper2;
-	reg.CPSR_f->Z = result == 0;
-	reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-	reg.CPSR_f->C = !(oper1 < oper2);	//carry = !borrow
-	//if oper1 and oper2 have same sign but result have different sign: overflow
-	reg.CPSR_f->V = (((~(oper1 ^ (uint32_t)(-(int32_t)oper2))) & (oper1 ^ *dest_reg)) >> 31) & 1;
+	setFlagsSub(oper1, oper2, result);
 
 }
 
 //logical op
 //OR: operator1 | operator2
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_ORR(uint32_t opcode) {
 	uint32_t oper1, oper2, * dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 
 	uint32_t result = oper1 | oper2;
 	*dest_reg = result;
 	if (dest_reg == &reg.R15) *dest_reg -= 4;	//R15 will be increased after the instruction
 
-	if (s) {	//flags
+	if (S) {	//flags
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = result == 0;
-			reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = shifter_carry_out;
+			setFlagsLogic(result, shifter_carry_out);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 }
 
 //logical operation
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_MOV(uint32_t opcode) {
 	uint32_t oper1, oper2, *dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 	*dest_reg = oper2;
 	if (dest_reg == &reg.R15) *dest_reg -= 4;	//R15 will be increased after the instruction
 	
-	if (s) {	//flags
+	if (S) {	//flags
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = oper2 == 0;
-			reg.CPSR_f->N = (oper2 & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = shifter_carry_out;
+			setFlagsLogic(oper2, shifter_carry_out);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 }
 
 //tests operand1 XOR operand2
 //logical operation
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_TEQ(uint32_t opcode) {
 	uint32_t oper1, oper2, *dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 
 	uint32_t result = oper1 ^ oper2;
 
-	if (s) {	//flags
+	if (S) {	//flags
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = result == 0;
-			reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = shifter_carry_out;
+			setFlagsLogic(result, shifter_carry_out);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 }
 
 //operand1 AND operand2
 //logical operation
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_AND(uint32_t opcode) {
 	uint32_t oper1, oper2, *dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 
 	*dest_reg = oper1 & oper2;
 	if (dest_reg == &reg.R15) *dest_reg -= 4;	//R15 will be increased after the instruction
 
-	if (s) {	//flags
+	if (S) {	//flags
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = *dest_reg == 0;
-			reg.CPSR_f->N = (*dest_reg & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = shifter_carry_out;
+			setFlagsLogic(*dest_reg, shifter_carry_out);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 
 }
 
 //operand1 xor operand2
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_EOR(uint32_t opcode) {
 	uint32_t oper1, oper2, *dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 
 	*dest_reg = oper1 ^ oper2;
 	if (dest_reg == &reg.R15) *dest_reg -= 4;	//R15 will be increased after the instruction
 
-	if (s) {	//flags
+	if (S) {	//flags
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = *dest_reg == 0;
-			reg.CPSR_f->N = (*dest_reg & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = shifter_carry_out;
+			setFlagsLogic(*dest_reg, shifter_carry_out);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 }
 
 //test. Logical operation
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_TST(uint32_t opcode) {
 	uint32_t oper1, oper2, * dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 	uint32_t result = oper1 & oper2;
 
-	if (s) {	//flags
+	if (S) {	//flags
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = result == 0;
-			reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = shifter_carry_out;
+			setFlagsLogic(result, shifter_carry_out);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 }
 
 //arithmetic operation
 //operand1 + operand2
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_ADD(uint32_t opcode) {
 	uint32_t oper1, oper2, *dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
-	uint64_t result = (uint64_t)oper1 + (uint64_t)oper2;
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 	*dest_reg = oper1 + oper2;
 	if (dest_reg == &reg.R15) *dest_reg -= 4;	//R15 will be increased after the instruction
 
-	if (s) {
+	if (S) {
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = *dest_reg == 0;
-			reg.CPSR_f->N = (*dest_reg & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = (result >> 32) & 1;	//carry
-			//if oper1 and oper2 have same sign but result have different sign: overflow
-			reg.CPSR_f->V = (((~(oper1 ^ oper2)) & (oper1 ^ *dest_reg)) >> 31) & 1;
+			setFlagsAdd(oper1, oper2, *dest_reg);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 
 }
 
 //add with carry
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_ADC(uint32_t opcode) {
 	uint32_t oper1, oper2, * dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
-	uint64_t result = (uint64_t)oper1 + (uint64_t)oper2 + reg.CPSR_f->C;
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
+	uint64_t result = (uint64_t)oper1 + (uint64_t)oper2 + carryFlag();
 	*dest_reg = result;
 	if (dest_reg == &reg.R15) *dest_reg -= 4;	//R15 will be increased after the instruction
 
-	if (s) {
+	if (S) {
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = *dest_reg == 0;
-			reg.CPSR_f->N = (*dest_reg & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = (result >> 32) & 1;	//carry
-			//if oper1 and oper2 have same sign but result have different sign: overflow
-			reg.CPSR_f->V = (((~(oper1 ^ oper2)) & (oper1 ^ *dest_reg)) >> 31) & 1;
+			//the carry in doesn't fit the lazy add, set the flags now
+			setFlags(((*dest_reg >> 28) & 0x8) | (*dest_reg == 0 ? 0x4 : 0) | ((result >> 31) & 0x2)
+				| ((~(oper1 ^ oper2) & (oper1 ^ *dest_reg)) >> 31));
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 }
 
 //arithmetic operation
 //operand1 - operand2
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_SUB(uint32_t opcode) {
 	uint32_t oper1, oper2, *dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 	uint32_t result = oper1 - oper2;
 	*dest_reg = result;
 	if (dest_reg == &reg.R15) *dest_reg -= 4;	//R15 will be increased after the instruction
 
-	if (s) {
+	if (S) {
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = result == 0;
-			reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = !(oper1 < oper2);	//carry = !borrow
-			//if oper1 and oper2 have same sign but result have different sign: overflow
-			reg.CPSR_f->V = (((~(oper1 ^ (uint32_t)(-(int32_t)oper2))) & (oper1 ^ result)) >> 31) & 1;
+			setFlagsSub(oper1, oper2, result);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}	
 }
 
 //arithmetic operation
 //reversed sub: operand2 - operand1
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_RSB(uint32_t opcode) {
 	uint32_t oper1, oper2, *dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 	uint32_t result = oper2 - oper1;
 	*dest_reg = result;
 	if (dest_reg == &reg.R15) *dest_reg -= 4;	//R15 will be increased after the instruction
 
-	if (s) {
+	if (S) {
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = result == 0;
-			reg.CPSR_f->N = (result & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = !(oper1 < oper2);	//carry = !borrow
-			//if oper1 and oper2 have same sign but result have different sign: overflow
-			reg.CPSR_f->V = (((~(oper2 ^ (uint32_t)(-(int32_t)oper1))) & (oper2 ^ result)) >> 31) & 1;
+			setFlagsSub(oper2, oper1, result);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 }
 
 //bit clear. Logical operation
+template <bool I, bool S, uint8_t shift>
 inline void Cpu::Arm_BIC(uint32_t opcode) {
 	uint32_t oper1, oper2, * dest_reg;
-	uint8_t s;
 
-	ARM_ALU_unpacker(opcode, &dest_reg, oper1, oper2, s);
+	ARM_ALU_unpacker<I, shift>(opcode, &dest_reg, oper1, oper2);
 	*dest_reg = oper1 & ~oper2;
 	if (dest_reg == &reg.R15) *dest_reg -= 4;	//R15 will be increased after the instruction
 
-	if (s) {
+	if (S) {
 		if (dest_reg != &reg.R15) {
-			reg.CPSR_f->Z = *dest_reg == 0;
-			reg.CPSR_f->N = (*dest_reg & 0x80000000) != 0;	//negative
-			reg.CPSR_f->C = shifter_carry_out;	//carry
+			setFlagsLogic(*dest_reg, shifter_carry_out);
 		}
 		else {
 			uint32_t prev_cpsr = reg.SPSR;
 			setPrivilegeMode((PrivilegeMode)((CPSR_registers*)&reg.SPSR)->mode);
-			reg.CPSR = prev_cpsr;
+			setCPSR(prev_cpsr);
 		}
 	}
 }
@@ -2294,6 +2577,7 @@ inline void Cpu::Arm_MRS(uint32_t opcode) {
 	src_reg_code += Ps;
 	uint32_t& Sr = ((uint32_t*)&reg)[src_reg_code];
 
+	syncFlags();
 	Rd = Sr;
 }
 
@@ -2333,6 +2617,7 @@ inline void Cpu::Arm_MSR(uint32_t opcode) {
 	}
 	else {
 		//dest = CPSR
+		syncFlags();
 		PrivilegeMode prevMode = (PrivilegeMode)((CPSR_registers*)&reg.CPSR)->mode;
 		reg.CPSR = (reg.CPSR & (~out_mask));
 		reg.CPSR |= Rm & out_mask;
@@ -2485,9 +2770,13 @@ inline void Cpu::ARM_SDT_unpacker(uint32_t opcode, uint32_t& address, uint32_t**
 		uint32_t Rm = ((uint32_t*)&reg)[offset_reg_code];
 
 		uint8_t Is = (opcode >> 7) & 0x1f;
-		uint8_t ST = (opcode >> 5) & 0x3;
 
-		ARM_Shifter(ST, Is, Rm, offset, true);
+		switch ((opcode >> 5) & 0x3) {	//shift type
+		case 0: ARM_Shifter<0, true>(Is, Rm, offset); break;
+		case 1: ARM_Shifter<1, true>(Is, Rm, offset); break;
+		case 2: ARM_Shifter<2, true>(Is, Rm, offset); break;
+		case 3: ARM_Shifter<3, true>(Is, Rm, offset); break;
+		}
 	}
 	else {	//offset in immidiate 12 bits
 		offset = opcode & 0xfff;
@@ -2576,9 +2865,7 @@ inline void Cpu::Arm_MUL(uint32_t opcode) {
 	*Rd = Rm * Rs;
 
 	if (opcode & 0x100000) {	//s flag
-		reg.CPSR_f->Z = *Rd == 0;
-		reg.CPSR_f->N = (*Rd & 0x80000000) != 0;	//negative
-		reg.CPSR_f->C = 0;	//carry destroyed on ARMv4
+		setFlagsLogic(*Rd, false);
 	}
 
 }
@@ -2604,7 +2891,8 @@ void Cpu::Arm_MULL(uint32_t opcode) {
 	*Rdhi = (((uint64_t)res) >> 32) & 0xffffffff;
 
 	if ((opcode >> 20) & 1) {
-		reg.CPSR_f->N = (((uint64_t)res) >> 64) & 1;
+		syncFlags();
+		reg.CPSR_f->N = (((uint64_t)res) >> 63) & 1;
 		reg.CPSR_f->Z = res == 0;
 	}
 }
@@ -2672,6 +2960,28 @@ inline void Cpu::Arm_STM_INC(uint8_t paramP, uint16_t reg_list, uint32_t& addres
 	}
 }
 
+//lowest address of a block transfer, the lowest register goes there
+static inline uint32_t blockStart(bool up, bool pre, uint32_t address, uint32_t count) {
+	if (up)
+		return pre ? address + 4 : address;
+	return pre ? address - count * 4 : address - count * 4 + 4;
+}
+
+//copy the listed registers to consecutive words, lowest register first
+inline void Cpu::storeBlock(uint32_t* block, uint16_t reg_list) {
+	for (int i = 0; i < 16; i++) {
+		if ((reg_list >> i) & 1)
+			*block++ = ((uint32_t*)&reg)[i];
+	}
+}
+
+inline void Cpu::loadBlock(const uint32_t* block, uint16_t reg_list) {
+	for (int i = 0; i < 16; i++) {
+		if ((reg_list >> i) & 1)
+			((uint32_t*)&reg)[i] = *block++;
+	}
+}
+
 //store block data
 inline void Cpu::Arm_STM(uint32_t opcode) {
 	struct param {
@@ -2697,8 +3007,14 @@ inline void Cpu::Arm_STM(uint32_t opcode) {
 	uint8_t Rn_code = (opcode >> 16) & 0x0f;
 	uint32_t* Rn = &((uint32_t*)&reg)[Rn_code];		
 	uint32_t address = *Rn;
+	uint32_t count = std::bitset<16>(reg_list).count();
+	uint32_t* block = GBA::memory.transferBlock(blockStart(param.U, param.P, address, count), count, true);
 
-	if (param.U) {
+	if (block != nullptr) {	//plain memory: no region lookup per register
+		storeBlock(block, reg_list);
+		address = param.U ? address + count * 4 : address - count * 4;
+	}
+	else if (param.U) {
 		Arm_STM_INC(param.P, reg_list, address);
 	}
 	else {
@@ -2774,7 +3090,7 @@ inline void Cpu::Arm_LDM(uint32_t opcode) {
 	PrivilegeMode prevMod = (PrivilegeMode)reg.CPSR_f->mode;
 	if (param.S) {
 		if (reg_list & 0x8000) {	//R15 in register list
-			reg.CPSR = reg.SPSR;
+			setCPSR(reg.SPSR);
 			prevMod = (PrivilegeMode)reg.CPSR_f->mode;	//to avoid the mode to be wrongly changed at the end of this function
 		}
 		else {	//user register bank
@@ -2786,8 +3102,14 @@ inline void Cpu::Arm_LDM(uint32_t opcode) {
 	uint8_t Rn_code = (opcode >> 16) & 0x0f;
 	uint32_t* Rn = &((uint32_t*)&reg)[Rn_code];
 	uint32_t address = *Rn;
+	uint32_t count = std::bitset<16>(reg_list).count();
+	uint32_t* block = GBA::memory.transferBlock(blockStart(param.U, param.P, address, count), count, false);
 
-	if (param.U) {
+	if (block != nullptr) {	//plain memory: no region lookup per register
+		loadBlock(block, reg_list);
+		address = param.U ? address + count * 4 : address - count * 4;
+	}
+	else if (param.U) {
 		Arm_LDM_INC(param.P, reg_list, address);
 	}
 	else {
@@ -2,131 +2,15 @@
 #define CPU_H
 
 #include "interrupt.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "memory_mapper.h"
+#include "condition_table.h"
+#include "opcodes.h"
 
 #include <cstdint>
-
-enum ARM_opcode {
-	ARM_OP_INVALID,
-	ARM_OP_B,	//branches
-	ARM_OP_BL,
-	ARM_OP_BX,
-	ARM_OP_AND,	//alu operations
-	ARM_OP_EOR,
-	ARM_OP_SUB,
-	ARM_OP_RSB,
-	ARM_OP_ADD,
-	ARM_OP_ADC,
-	ARM_OP_SBC,
-	ARM_OP_RSC,
-	ARM_OP_TST,
-	ARM_OP_TEQ,
-	ARM_OP_CMP,
-	ARM_OP_CMN,
-	ARM_OP_ORR,
-	ARM_OP_MOV,
-	ARM_OP_BIC,
-	ARM_OP_MVN,
-	ARM_OP_LDRH,	//load/store halfword
-	ARM_OP_LDRSB,
-	ARM_OP_LDRSH,
-	ARM_OP_STRH,
-	ARM_OP_STM,		//load/store multiple
-	ARM_OP_LDM,
-	ARM_OP_LDR,		//load/store
-	ARM_OP_STR,
-	ARM_OP_MSR,
-	ARM_OP_MRS,
-	ARM_OP_MUL,
-	ARM_OP_MLA,
-	ARM_OP_MULL,	//multiply long
-	ARM_OP_MLAL,		//multiply-accumulate long
-	ARM_OP_UMULL,	//unsigned multiply long
-	ARM_OP_UMLAL		//unsigned multiply-accumulate long
-};
-
-enum THUMB_opcode {
-	THUMB_OP_INVALID,
-	THUMB_OP_UNDEFINED,
-	THUMB_OP_LSL_IMM,	//logical/arithm shift left
-	THUMB_OP_LSR_IMM,	//logical right shift
-	THUMB_OP_ASR_IMM,	//arithmetic shift right
-	THUMB_OP_MOV_I,	//mov/cmp/add/sub immidiate
-	THUMB_OP_CMP_I,
-	THUMB_OP_ADD_I,
-	THUMB_OP_SUB_I,	
-	THUMB_OP_LDR_PC,	//load pc-relative
-	THUMB_OP_STR_O,	//store register offset
-	THUMB_OP_STRB_O,
-	THUMB_OP_LDR_O,	//load register offset
-	THUMB_OP_LDRB_O,
-	//Alu operations
-	THUMB_OP_AND,
-	THUMB_OP_EOR,
-	THUMB_OP_LSL,
-	THUMB_OP_LSR,
-	THUMB_OP_ASR,
-	THUMB_OP_ADC,
-	THUMB_OP_SBC,
-	THUMB_OP_ROR,
-	THUMB_OP_TST,	//TST
-	THUMB_OP_NEG,
-	THUMB_OP_CMP,
-	THUMB_OP_CMN,
-	THUMB_OP_ORR,
-	THUMB_OP_MUL,
-	THUMB_OP_BIC,
-	THUMB_OP_MVN,	//MVN
-
-	THUMB_OP_ADD_RR,	//add register-register
-	THUMB_OP_SUB_RR,	//sub register-register
-	THUMB_OP_ADD_RI,	//add register-immidiate
-	THUMB_OP_SUB_RI,	//sub register-immidiate
-	THUMB_OP_BEQ,	//conditional branches
-	THUMB_OP_BNE,
-	THUMB_OP_BCS,	
-	THUMB_OP_BCC,
-	THUMB_OP_BMI,
-	THUMB_OP_BPL,
-	THUMB_OP_BVS,
-	THUMB_OP_BVC,
-	THUMB_OP_BHI,
-	THUMB_OP_BLS,
-	THUMB_OP_BGE,
-	THUMB_OP_BLT,
-	THUMB_OP_BGT,
-	THUMB_OP_BLE,
-	THUMB_OP_SWI,	//software interrupt
-	THUMB_OP_ADD_HRR,	//high register add
-	THUMB_OP_CMP_HRR,	//high register compare
-	THUMB_OP_MOV_HRR,	//high register move
-	THUMB_OP_NOP,	//nop (MOV r8, r8)
-	THUMB_OP_BX,	//branch exchange
-	THUMB_OP_PUSH,	//push
-	THUMB_OP_POP,	//pop
-	THUMB_OP_LDMIA,	//load multiple 
-	THUMB_OP_STMIA,	//store multiple
-	THUMB_OP_ADD_SP,	//add offset to sp
-	THUMB_OP_SUB_SP,		//sub offset to sp
-	THUMB_OP_ADD_R_SP,	//get relative address from sp
-	THUMB_OP_ADD_R_PC,	//get relative address from pc
-	THUMB_OP_STR_SP,	//store sp-relative
-	THUMB_OP_LDR_SP,	//load sp-relative
-	THUMB_OP_LDRH,	//load halfword
-	THUMB_OP_STRH,	//store halfword
-	THUMB_OP_B,	//unconditional branch
-	THUMB_OP_BL_F,	//long branch with link
-	THUMB_OP_BL_LR_IMM,
-	THUMB_OP_STR_I,	//load/store immidiate offset
-	THUMB_OP_LDR_I,
-	THUMB_OP_STRB_I,
-	THUMB_OP_LDRB_I,
-
-	//THUMB.8: load store sign-extended byte halfword
-	THUMB_OP_STRH_R,	
-	THUMB_OP_LDSB_R,
-	THUMB_OP_LDRH_R,
-	THUMB_OP_LDSH_R
-};
+#include <array>
+#include <utility>
 
 struct CPSR_registers {
 	uint32_t mode : 5,	//M0-M4 modes
@@ -155,36 +39,98 @@ enum PrivilegeMode {
 	SYSTEM = 0x1f	
 };
 
+//register banks. r13, r14 and spsr are banked per mode, r8-r12 only for fiq
+enum Register_Bank {
+	BANK_USER,	//user and system
+	BANK_FIQ,
+	BANK_SVC,
+	BANK_ABT,
+	BANK_IRQ,
+	BANK_UND,
+	BANK_COUNT,
+	BANK_NONE = BANK_COUNT	//invalid mode bits
+};
+
+struct BankedRegisters {
+	uint32_t R13, R14, SPSR;	//user mode has no spsr
+};
+
 struct Registers {
 	//active registers
 	uint32_t R0, R1, R2, R3, R4, R5, R6, R7;
 	uint32_t R8, R9, R10, R11, R12, R13, R14, R15;
 	uint32_t CPSR, SPSR;
 	CPSR_registers *CPSR_f;
-	//standard banked registers
-	uint32_t R8_std, R9_std, R10_std, R11_std, R12_std, R13_std, R14_std;
-	//fiq banked registers
-	uint32_t R8_fiq, R9_fiq, R10_fiq, R11_fiq, R12_fiq, R13_fiq, R14_fiq, SPSR_fiq;
-	//supervisor banked registers
-	uint32_t R13_svc, R14_svc, SPSR_svc;
-	//abort banked registers
-	uint32_t R13_abt, R14_abt, SPSR_abt;
-	//irq banked registers
-	uint32_t R13_irq, R14_irq, SPSR_irq;
-	//undefined banked registers
-	uint32_t R13_und, R14_und, SPSR_und;
+	//r8-r12 of the modes not active: [0] standard, [1] fiq
+	uint32_t R8_12[2][5];
+	//r13, r14, spsr of the modes not active
+	BankedRegisters bank[BANK_COUNT];
+};
+
+//what the last flag-setting instruction left to compute. the nzcv bits are
+//only built when something reads them: a condition, mrs, an exception entry
+enum Flag_Kind {
+	FLAGS_CPSR,		//nzcv are in the cpsr
+	FLAGS_NZ,		//n, z from result. c, v in the cpsr
+	FLAGS_LOGIC,	//n, z from result, c from carry. v in the cpsr
+	FLAGS_ADD,		//result = op1 + op2
+	FLAGS_SUB		//result = op1 - op2
+};
+
+struct LazyFlags {
+	Flag_Kind kind;
+	uint32_t result;
+	uint32_t op1, op2;
+	bool carry;
+#ifdef _DEBUG
+	uint32_t eager;	//nzcv computed the old way, checked against the lazy ones
+#endif
+};
+
+enum CpuBackend {
+	CPU_INTERPRETER,
+	CPU_JIT	//x86-64 linux only, falls back to the interpreter elsewhere
 };
 
 class Cpu {
+	friend class Jit;
 public:
 	Cpu();
+	void Reset();
+	void skipBios();
 	void runFor(uint32_t ticks);
 	uint32_t getPC();
 
 	void RaiseIRQ(Interrupt_Type type);
+	void invalidateCode(uint32_t address);
+	BlockCache& getBlockCache();
+	void setBackend(CpuBackend backend);
+	CpuBackend getBackend();
+	uint64_t getSkippedTicks();
+	double getInvalidationsPerSecond();
+	void halt(bool stop);
+	void setHleBios(bool enable);
+	void setLockstep(bool enable);
 private:
+	static const int IDLE_LOOP_LENGTH = 8;	//longest loop checked by the idle loop detector
+	static const uint16_t HALT_WAKE_IRQS = 0x3fff;	//any irq ends halt
+	static const uint16_t STOP_WAKE_IRQS = 0x3080;	//keypad, gamepak and serial end stop
+
 	Registers reg;
+	LazyFlags _flags;
 	uint8_t shifter_carry_out;
+	BlockCache _blockCache;
+	Jit _jit;
+	CpuBackend _backend;
+	uint64_t _skippedTicks;	//ticks fast-forwarded in idle loops and halt since the game started
+	bool _halted;	//waiting for an irq after a HALTCNT write
+	bool _hleBios;	//bios calls implemented natively, when possible
+	uint16_t _wakeIrqs;	//irqs that end the halt
+	bool _intrWait;	//halted in IntrWait, the swi runs again after the irq
+	uint64_t _lastInvalidations;	//block cache invalidations at the last getInvalidationsPerSecond
+	unsigned long long _lastInvalidationTicks;
+	FetchWindow _fetchWindow;	//code page of the last fetch
+	bool _lockstep;	//check every block against the reference interpreter
 
 	int32_t convert_24Bit_to_32Bit_signed(uint32_t val);
 
@@ -197,21 +143,52 @@ private:
 	void next_instruction();
 	void next_instruction_thumb();
 	void next_instruction_arm();
+	inline const uint8_t* fetchPointer(uint32_t address);
+	void next_block(unsigned long long endingTicks);
+	void runLockstep(unsigned long long endingTicks);
+	void decodeBlock(uint32_t address, bool thumb, DecodedBlock& block);
+	void runBlock(DecodedBlock* block, unsigned long long endingTicks);
+	inline bool blockContinues(uint32_t pc, bool thumb, uint32_t generation, unsigned long long endingTicks);
+	void skipIdleLoop(unsigned long long endingTicks);
+	void waitForInterrupt(unsigned long long endingTicks);
+	static bool isIdleLoop(const DecodedBlock& block);
+	static bool idleThumbInstruction(uint16_t opcode, uint32_t address, uint32_t loopStart, bool last, uint16_t& reads, uint16_t& writes);
+	static bool idleArmInstruction(uint32_t opcode, uint32_t address, uint32_t loopStart, bool last, uint16_t& reads, uint16_t& writes);
 
-	void Reset();
-	
 	void RaiseFIQ();
 	void RaiseUndefined();
-	void RaiseSWI();
+	void RaiseSWI(uint8_t number);
+	bool hleCall(uint8_t number, uint32_t next);
+	void softReset();
+	void intrWait(bool discard, uint16_t mask, uint32_t next);
+
+	//lazy flags
+	inline uint32_t flags();
+	inline bool carryFlag();
+	inline void syncFlags();
+	inline void setCPSR(uint32_t value);
+	inline void setFlagsNZ(uint32_t result);
+	inline void setFlagsLogic(uint32_t result, bool carry);
+	inline void setFlagsAdd(uint32_t op1, uint32_t op2, uint32_t result);
+	inline void setFlagsSub(uint32_t op1, uint32_t op2, uint32_t result);
+	inline void setFlags(uint32_t nzcv);
+#ifdef _DEBUG
+	void setEagerFlags(int n, int z, int c, int v);
+	void checkFlags(uint32_t nzcv);
+#endif
 
+	static const std::array<uint8_t, 32> _modeBanks;	//Register_Bank indexed by the mode bits
 	void setPrivilegeMode(PrivilegeMode mode);
 	void setPrivilegeMode(PrivilegeMode currentMode, PrivilegeMode mode);
-	void saveBankReg(PrivilegeMode currentMode);
-	void getBankReg(PrivilegeMode newMode);
 
 	//THUMB instructions
-	void execute_thumb(THUMB_opcode instruction, uint16_t opcode);
+	static const std::array<ThumbHandler, 1024> _thumbHandlers;	//indexed by opcode bits 15-6
+	static constexpr std::array<ThumbHandler, 1024> buildThumbHandlerTable();
+	static constexpr ThumbHandler thumbHandler(THUMB_opcode instruction);
+	template <void (Cpu::*handler)(uint16_t)> void Thumb_Sequential(uint16_t opcode);
+	void Thumb_NotImplemented(uint16_t opcode);
 	bool thumbCheckCondition(uint16_t opcode);
+	static const std::array<uint16_t, 16> _conditionTable;	//indexed by condition, bit nzcv
 
 	//THUMB.1
 	inline void Thumb_LSL_IMM(uint16_t opcode);
@@ -296,6 +273,9 @@ private:
 	inline void Thumb_LDMIA(uint16_t opcode);
 	inline void Thumb_STMIA(uint16_t opcode);
 
+	//THUMB.16
+	inline void Thumb_CondBranch(uint16_t opcode);
+
 	//THUMB.17
 	inline void Thumb_SWI(uint16_t opcode);
 
@@ -307,31 +287,44 @@ private:
 	inline void Thumb_BL_2(uint16_t opcode);
 
 	//ARM instructions
+	static ArmHandler _armHandlers[4096];	//indexed like the ArmDecoder lookup table
+	static void buildArmHandlerTable();
+	static ArmHandler armHandler(ARM_opcode instruction, uint16_t index);
+	static ArmHandler aluHandler(ARM_opcode instruction, uint16_t index);
+	template <ARM_opcode instruction, uint8_t form> static constexpr ArmHandler aluHandler();
+	template <ARM_opcode instruction, size_t... forms>
+	static constexpr std::array<ArmHandler, 32> aluHandlers(std::index_sequence<forms...>);
+	template <void (Cpu::*handler)(uint32_t)> void Arm_Sequential(uint32_t opcode);
+	void Arm_FullDecode(uint32_t opcode);
 	void execute_arm(ARM_opcode instruction, uint32_t opcode);
 	bool arm_checkInstructionCondition(uint32_t opcode);
 
-	inline void ARM_Shifter(uint8_t shiftType, uint8_t shift_amount, uint32_t val, uint32_t& result, bool enableSpecialShift);
+	template <uint8_t shiftType, bool enableSpecialShift>
+	inline void ARM_Shifter(uint8_t shift_amount, uint32_t val, uint32_t& result);
 
 	//branches implementation
 	inline void Arm_B(uint32_t opcode);
 	inline void Arm_BL(uint32_t opcode);
 	inline void Arm_BX(uint32_t opcode);
+	inline void Arm_SWI(uint32_t opcode);
 
 	//ALU implementation
-	inline void ARM_ALU_unpacker(uint32_t opcode, uint32_t **destReg, uint32_t& oper1, uint32_t& oper2, uint8_t& s);
-	inline void ARM_ALU_oper2_getter(uint32_t opcode, uint32_t &oper2);
-	inline void Arm_AND(uint32_t opcode);
-	inline void Arm_EOR(uint32_t opcode);
-	inline void Arm_SUB(uint32_t opcode);
-	inline void Arm_RSB(uint32_t opcode);
-	inline void Arm_ADD(uint32_t opcode);
-	inline void Arm_ADC(uint32_t opcode);
-	inline void Arm_TST(uint32_t opcode);
-	inline void Arm_TEQ(uint32_t opcode);
-	inline void Arm_CMP(uint32_t opcode);
-	inline void Arm_ORR(uint32_t opcode);
-	inline void Arm_MOV(uint32_t opcode);
-	inline void Arm_BIC(uint32_t opcode);	
+	//specialized on the operand form: I bit, S bit, shift by register and shift type
+	template <bool I, uint8_t shift>
+	inline void ARM_ALU_unpacker(uint32_t opcode, uint32_t **destReg, uint32_t& oper1, uint32_t& oper2);
+	template <uint8_t shift> inline void ARM_ALU_oper2_getter(uint32_t opcode, uint32_t &oper2);
+	template <bool I, bool S, uint8_t shift> inline void Arm_AND(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_EOR(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_SUB(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_RSB(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_ADD(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_ADC(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_TST(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_TEQ(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_CMP(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_ORR(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_MOV(uint32_t opcode);
+	template <bool I, bool S, uint8_t shift> inline void Arm_BIC(uint32_t opcode);
 
 	inline void Arm_MSR(uint32_t opcode);
 	inline void Arm_MRS(uint32_t opcode);
@@ -362,6 +355,65 @@ private:
 	inline void Arm_LDM(uint32_t opcode);
 	inline void Arm_LDM_DEC(uint8_t paramP, uint16_t reg_list, uint32_t& address);
 	inline void Arm_LDM_INC(uint8_t paramP, uint16_t reg_list, uint32_t& address);
+	inline void storeBlock(uint32_t* block, uint16_t reg_list);
+	inline void loadBlock(const uint32_t* block, uint16_t reg_list);
 };
 
+//nzcv in bits 3-0, computed from the last flag-setting instruction
+inline uint32_t Cpu::flags() {
+	uint32_t nz = ((_flags.result >> 28) & 0x8) | (_flags.result == 0 ? 0x4 : 0);
+	uint32_t nzcv;
+
+	switch (_flags.kind) {
+	case FLAGS_NZ:
+		nzcv = nz | ((reg.CPSR >> 28) & 0x3);
+		break;
+	case FLAGS_LOGIC:
+		nzcv = nz | (_flags.carry ? 0x2 : 0) | ((reg.CPSR >> 28) & 0x1);
+		break;
+	case FLAGS_ADD:
+		nzcv = nz | (_flags.result < _flags.op1 ? 0x2 : 0)
+			| ((~(_flags.op1 ^ _flags.op2) & (_flags.op1 ^ _flags.result)) >> 31);
+		break;
+	case FLAGS_SUB:
+		nzcv = nz | (_flags.op1 >= _flags.op2 ? 0x2 : 0)
+			| (((_flags.op1 ^ _flags.op2) & (_flags.op1 ^ _flags.result)) >> 31);
+		break;
+	default:
+		return reg.CPSR >> 28;
+	}
+#ifdef _DEBUG
+	checkFlags(nzcv);
+#endif
+	return nzcv;
+}
+
+//the carry alone, for the shifter and adc
+inline bool Cpu::carryFlag() {
+	switch (_flags.kind) {
+	case FLAGS_LOGIC:
+		return _flags.carry;
+	case FLAGS_ADD:
+		return _flags.result < _flags.op1;
+	case FLAGS_SUB:
+		return _flags.op1 >= _flags.op2;
+	default:
+		return reg.CPSR_f->C;
+	}
+}
+
+//write the pending flags into the cpsr
+inline void Cpu::syncFlags() {
+	if (_flags.kind == FLAGS_CPSR)
+		return;
+	reg.CPSR = (reg.CPSR & 0x0fffffff) | (flags() << 28);
+	_flags.kind = FLAGS_CPSR;
+}
+
+//whole cpsr write (spsr restore), the pending flags are overwritten
+inline void Cpu::setCPSR(uint32_t value) {
+	reg.CPSR = value;
+	_flags.kind = FLAGS_CPSR;
+}
+
 #endif
@@ -2,6 +2,7 @@
 #include "gba.h"
 
 #include <cstdint>
+#include <cstring>
 
 Dma::Dma(uint8_t num) {
 	_dmaNr = num;
@@ -11,24 +12,21 @@ Dma::Dma(uint8_t num) {
 	_transfCounter = 0;
 	_reload_on_repeat = 0;
 	_fifoTransfer = false;
+	_enabled = false;
 
-	switch (_dmaNr) {
-	case 0:
-		_cnt = (dma_control_struct*)GBA::memory.get_io_reg(0xBA);
-		break;
-	case 1:
-		_cnt = (dma_control_struct*)GBA::memory.get_io_reg(0xc6);
-		break;
-	case 2:
-		_cnt = (dma_control_struct*)GBA::memory.get_io_reg(0xd2);
-		break;
-	case 3:
-		_cnt = (dma_control_struct*)GBA::memory.get_io_reg(0xdc);
-		break;
-	default:
+	if (_dmaNr > 3)
 		throw "Invalid DMA channel specified";
-		break;
-	}
+
+	//DMAxSAD, DMAxDAD, DMAxCNT_L and DMAxCNT_H, 12 bytes per channel
+	uint32_t offset = 0xb0 + _dmaNr * 12;
+	_sad = (uint32_t*)GBA::memory.get_io_reg(offset);
+	_dad = (uint32_t*)GBA::memory.get_io_reg(offset + 4);
+	_count = GBA::memory.get_io_reg(offset + 8);
+	_cnt = (dma_control_struct*)GBA::memory.get_io_reg(offset + 10);
+
+	_srcMask = _dmaNr == 0 ? 0x7FFFFFF : 0xFFFFFFF;	//DMA0: internal memory only
+	_dstMask = _dmaNr == 3 ? 0xFFFFFFF : 0x7FFFFFF;	//DMA3: any memory
+	_countMask = _dmaNr == 3 ? 0xffff : 0x3fff;		//DMA3: 16 bit, 14 bit for the others
 }
 
 //reload some stuff on repeat
@@ -36,199 +34,72 @@ void Dma::load_on_repeat(void) {
 	if (!_reload_on_repeat)
 		return;
 
-	_fifoTransfer = false;
-
-	switch (_dmaNr) {
-	case 0:	//DMA0
-	{
-		//read destination address
-		if (_cnt->dst_cnt == 3) {	//increment + reload
-			_dstAddr = GBA::memory.read_32(0x40000B4);
-			_dstAddr &= 0x7FFFFFF;	//internal memory only
-		}
-		//read transfer lenght
-		_transfLen = GBA::memory.read_16(0x40000B8);
-		_transfLen &= 0x3fff;	//14 bit only
-		if (_transfLen == 0) _transfLen = 0x4000;
-		_transfCounter = 0;
-		break;
-	}
-	case 1:		//DMA1
-	{
-		//read destination address
-		if (_cnt->dst_cnt == 3) {	//increment + reload
-			_dstAddr = GBA::memory.read_32(0x40000c0);
-			_dstAddr &= 0x7FFFFFF;	//internal memory only
-		}
-		//read transfer lenght
-		_transfLen = GBA::memory.read_16(0x40000c4);
-		_transfLen &= 0x3fff;	//14 bit only
-		if (_transfLen == 0) _transfLen = 0x4000;
-		_transfCounter = 0;
-		_fifoTransfer = _cnt->repeat
-			&& (_dstAddr == 0x40000A0 || _dstAddr == 0x40000A4);
-		break;
-	}
-	case 2:		//DMA2
-	{
-		//read destination address
-		if (_cnt->dst_cnt == 3) {	//increment + reload
-			_dstAddr = GBA::memory.read_32(0x40000cc);
-			_dstAddr &= 0x7FFFFFF;	//internal memory only
-		}
-		//read transfer lenght
-		_transfLen = GBA::memory.read_16(0x40000d0);
-		_transfLen &= 0x3fff;	//14 bit only
-		if (_transfLen == 0) _transfLen = 0x4000;
-		_transfCounter = 0;
-		_fifoTransfer = _cnt->repeat
-			&& (_dstAddr == 0x40000A0 || _dstAddr == 0x40000A4);
-		break;
-	}
-	case 3:		//DMA3
-	{
-		//read destination address
-		if (_cnt->dst_cnt == 3) {	//increment + reload
-			_dstAddr = GBA::memory.read_32(0x40000d8);
-			_dstAddr &= 0xFFFFFFF;		//any memory
-		}
-		//read transfer lenght
-		_transfLen = GBA::memory.read_16(0x40000dc);	//16 bit
-		if (_transfLen == 0) _transfLen = 0x10000;
-		_transfCounter = 0;
-		break;
-	}
-	}
+	if (_cnt->dst_cnt == 3)	//increment + reload
+		_dstAddr = *_dad & _dstMask;
+	latchCount();
 }
 
+//the registers are read straight from the io memory: latching is not a bus access
 void Dma::enable_dma(void) {
-	_fifoTransfer = false;
+	_enabled = true;
+	_srcAddr = *_sad & _srcMask;
+	_dstAddr = *_dad & _dstMask;
+	latchCount();
+	_reload_on_repeat = 0;
+}
 
-	switch (_dmaNr) {
-	case 0:	//DMA0
-	{
-		//read source address
-		_srcAddr = GBA::memory.read_32(0x40000B0);
-		_srcAddr &= 0x7FFFFFF;	//internal memory only
-		//read destination address
-		_dstAddr = GBA::memory.read_32(0x40000B4);
-		_dstAddr &= 0x7FFFFFF;	//internal memory only
-		//read transfer lenght
-		_transfLen = GBA::memory.read_16(0x40000B8);
-		_transfLen &= 0x3fff;	//14 bit only
-		if (_transfLen == 0) _transfLen = 0x4000;
-		_transfCounter = 0;
-		_reload_on_repeat = 0;
-		break;
-	}
-	case 1:		//DMA1
-	{
-		//read source address
-		_srcAddr = GBA::memory.read_32(0x40000bc);
-		_srcAddr &= 0xFFFFFFF;	//any memory
-		//read destination address
-		_dstAddr = GBA::memory.read_32(0x40000c0);
-		_dstAddr &= 0x7FFFFFF;	//internal memory only
-		//read transfer lenght
-		_transfLen = GBA::memory.read_16(0x40000c4);
-		_transfLen &= 0x3fff;	//14 bit only
-		if (_transfLen == 0) _transfLen = 0x4000;
-		_transfCounter = 0;
-		_reload_on_repeat = 0;
-		//is FIFO transfer?
-		_fifoTransfer = _cnt->repeat
-			&& (_dstAddr == 0x40000A0 || _dstAddr == 0x40000A4);
-		break;
-	}
-	case 2:		//DMA2
-	{
-		//read source address
-		_srcAddr = GBA::memory.read_32(0x40000c8);
-		_srcAddr &= 0xFFFFFFF;		//any memory
-		//read destination address
-		_dstAddr = GBA::memory.read_32(0x40000cc);
-		_dstAddr &= 0x7FFFFFF;	//internal memory only
-		//read transfer lenght
-		_transfLen = GBA::memory.read_16(0x40000d0);
-		_transfLen &= 0x3fff;	//14 bit only
-		if (_transfLen == 0) _transfLen = 0x4000;
-		_transfCounter = 0;
-		_reload_on_repeat = 0;
-		//is FIFO transfer?
-		_fifoTransfer = _cnt->repeat
-			&& (_dstAddr == 0x40000A0 || _dstAddr == 0x40000A4);
-		break;
-	}
-	case 3:		//DMA3
-	{
-		//read source address
-		_srcAddr = GBA::memory.read_32(0x40000d4);
-		_srcAddr &= 0xFFFFFFF;		//any memory
-		//read destination address
-		_srcAddr = GBA::memory.read_32(0x40000d8);
-		_srcAddr &= 0xFFFFFFF;		//any memory
-		//read transfer lenght
-		_transfLen = GBA::memory.read_16(0x40000dc);	//16 bit
-		if (_transfLen == 0) _transfLen = 0x10000;
-		_transfCounter = 0;
-		_reload_on_repeat = 0;
-		break;
-	}
-	}
+void Dma::latchCount(void) {
+	_transfLen = *_count & _countMask;
+	if (_transfLen == 0) _transfLen = _countMask + 1;
+	_transfCounter = 0;
+
+	//is FIFO transfer? only DMA1 & DMA2 feed the sound fifos
+	_fifoTransfer = (_dmaNr == 1 || _dmaNr == 2) && _cnt->repeat
+		&& (_dstAddr == 0x40000A0 || _dstAddr == 0x40000A4);
 }
 
-void Dma::trigger(Dma_Trigger trigger) {
-	if (!_cnt->enable)
-		return;
+//trigger the channel waits for. EMPTY_TRIGGER when disabled or started right away
+Dma_Trigger Dma::getTrigger(void) {
+	if (!_enabled)
+		return Dma_Trigger::EMPTY_TRIGGER;
 
 	switch (_cnt->timing) {
-	case 0:	//immidiately
-		full_run_dma();
-		break;
 	case 1:	//vblank
-		if (trigger == Dma_Trigger::VBLANK) {
-			load_on_repeat();
-			full_run_dma();
-		}
-		break;
-
+		return Dma_Trigger::VBLANK;
 	case 2:	//hblank
-		if (trigger == Dma_Trigger::HBLANK) {
-			load_on_repeat();
-			full_run_dma();
-		}
-		break;
+		return Dma_Trigger::HBLANK;
 	case 3:	//special trigger
 		switch (_dmaNr) {
 		case 1:	//DMA1 & DMA2 special triggers are FIFO
 		case 2:
-			if (trigger == Dma_Trigger::FIFO) {
-				load_on_repeat();
-				full_run_dma();
-			}
-			break;
+			return Dma_Trigger::FIFO;
 		case 3:	//DMA3 special trigger is video capture
-			if (trigger == Dma_Trigger::VIDEO_CAPTURE) {
-				load_on_repeat();
-				full_run_dma();
-			}
-			break;
+			return Dma_Trigger::VIDEO_CAPTURE;
 		}
 		break;
 	}
+	return Dma_Trigger::EMPTY_TRIGGER;	//immidiately
+}
+
+bool Dma::isEnabled(void) {
+	return _enabled;
 }
 
 void Dma::disable() {
 	_reload_on_repeat = false;
 	_fifoTransfer = false;
+	_enabled = false;
 	_cnt->enable = 0;
 }
 
-void Dma::full_run_dma(void) {
+//transfer until the count is done or the clock reaches until, at least one unit.
+//returns false if the transfer was interrupted, the next call goes on from there
+bool Dma::run(unsigned long long until) {
 	int8_t inc_transform[4] = {1, -1, 0, 1};
+	int32_t src_inc_mod = inc_transform[_cnt->src_cnt];
+	int32_t dst_inc_mod = inc_transform[_cnt->dst_cnt];
 
 	if (_fifoTransfer) {	//fifo transfer. destination address is fixed
-		int32_t src_inc_mod = inc_transform[_cnt->src_cnt];
 		for (_transfCounter = 0; _transfCounter < 4; _transfCounter++) {
 			uint32_t read_val = GBA::memory.read_32(_srcAddr);
 			GBA::memory.write_32(_dstAddr, read_val);
@@ -236,33 +107,106 @@ void Dma::full_run_dma(void) {
 		}
 	}else if (_cnt->type == 0){
 		//16 bit transfer
-		int32_t src_inc_mod = inc_transform[_cnt->src_cnt];
-		int32_t dst_inc_mod = inc_transform[_cnt->dst_cnt];
-		for (_transfCounter = 0; _transfCounter < _transfLen; _transfCounter++) {
-			uint16_t read_val = GBA::memory.read_16(_srcAddr);
-			GBA::memory.write_16(_dstAddr, read_val);
-			_srcAddr += 2 * src_inc_mod;
-			_dstAddr += 2 * dst_inc_mod;
+		if (!fastTransfer(2, until)) {
+			do {
+				uint16_t read_val = GBA::memory.read_16(_srcAddr);
+				GBA::memory.write_16(_dstAddr, read_val);
+				_srcAddr += 2 * src_inc_mod;
+				_dstAddr += 2 * dst_inc_mod;
+				_transfCounter++;
+			} while (_transfCounter < _transfLen && GBA::clock.getTicks() < until);
 		}
+		if (_transfCounter < _transfLen)
+			return false;
 	}
 	else {
 		//32 bit transfer
-		for (_transfCounter = 0; _transfCounter < _transfLen; _transfCounter++) {
-			int32_t src_inc_mod = inc_transform[_cnt->src_cnt];
-			int32_t dst_inc_mod = inc_transform[_cnt->dst_cnt];
-			for (_transfCounter = 0; _transfCounter < _transfLen; _transfCounter++) {
+		if (!fastTransfer(4, until)) {
+			do {
 				uint32_t read_val = GBA::memory.read_32(_srcAddr);
 				GBA::memory.write_32(_dstAddr, read_val);
 				_srcAddr += 4 * src_inc_mod;
 				_dstAddr += 4 * dst_inc_mod;
-			}
+				_transfCounter++;
+			} while (_transfCounter < _transfLen && GBA::clock.getTicks() < until);
 		}
+		if (_transfCounter < _transfLen)
+			return false;
 	}
 	_transfCounter = 0;
 	if (!_cnt->repeat) {	//no repeat
 		_cnt->enable = 0;
+		_enabled = false;
 	}
 	if (_cnt->irq)		//irq upon end of word count
 		GBA::irq.setDMAFlag(_dmaNr);
 	_reload_on_repeat = _cnt->repeat;
+	return true;
 } 
+
+//lowest address touched by units accesses starting at address
+uint32_t Dma::rangeStart(uint32_t address, int32_t step, uint32_t units) {
+	return step < 0 ? address + step * (int32_t)(units - 1) : address;
+}
+
+//rest of the transfer, or what fits before until, between plain memory on the host with the ticks
+//charged at once. false when either side touches io, sram or open bus, the slow path handles those
+bool Dma::fastTransfer(uint32_t unit, unsigned long long until) {
+	static const int8_t inc_transform[4] = {1, -1, 0, 1};
+	int32_t srcStep = inc_transform[_cnt->src_cnt] * (int32_t)unit;
+	int32_t dstStep = inc_transform[_cnt->dst_cnt] * (int32_t)unit;
+
+	if ((_srcAddr | _dstAddr) & (unit - 1))
+		return false;
+
+	int unitTicks = GBA::memory.burstTicks(_srcAddr, 1, unit) + GBA::memory.burstTicks(_dstAddr, 1, unit);
+	unsigned long long ticks = GBA::clock.getTicks();
+	uint32_t units = _transfLen - _transfCounter;
+	if (unitTicks == 0)
+		return false;
+	if (until <= ticks)
+		units = 1;
+	else if ((until - ticks) / unitTicks + 1 < units)
+		units = (uint32_t)((until - ticks) / unitTicks + 1);
+
+	uint32_t srcStart = rangeStart(_srcAddr, srcStep, units);
+	uint32_t dstStart = rangeStart(_dstAddr, dstStep, units);
+	uint32_t srcSize = srcStep ? units * unit : unit;
+	uint32_t dstSize = dstStep ? units * unit : unit;
+	if (srcStart > _srcAddr || dstStart > _dstAddr)	//wraps below 0
+		return false;
+
+	uint8_t* src = GBA::memory.hostRange(srcStart, srcSize, false);
+	uint8_t* dst = GBA::memory.hostRange(dstStart, dstSize, true);
+	if (src == nullptr || dst == nullptr)
+		return false;
+
+	GBA::memory.prepareHostWrite(dstStart, dst, dstSize);
+
+	//one copy only between different regions: inside a region the host memory may be a mirror of itself,
+	//the unit by unit copy keeps the result of overlapping transfers
+	uint32_t srcLast = srcStart + srcSize - 1, dstLast = dstStart + dstSize - 1;
+	bool apart = (srcLast >> 24) < (dstStart >> 24) || (dstLast >> 24) < (srcStart >> 24);
+	if (srcStep == dstStep && srcStep != 0 && apart) {
+		memcpy(dst, src, srcSize);
+	}
+	else {
+		uint8_t* from = src + (_srcAddr - srcStart);
+		uint8_t* to = dst + (_dstAddr - dstStart);
+		for (uint32_t i = 0; i < units; i++) {
+			memcpy(to, from, unit);
+			from += srcStep;
+			to += dstStep;
+		}
+	}
+
+	//a fixed address is accessed again and again, never in a burst
+	int srcTicks = srcStep ? GBA::memory.burstTicks(srcStart, units, unit) : GBA::memory.burstTicks(srcStart, 1, unit) * units;
+	int dstTicks = dstStep ? GBA::memory.burstTicks(dstStart, units, unit) : GBA::memory.burstTicks(dstStart, 1, unit) * units;
+	GBA::clock.addTicks(srcTicks + dstTicks);
+
+	_srcAddr += srcStep * (int32_t)units;
+	_dstAddr += dstStep * (int32_t)units;
+	_transfCounter += units;
+	return true;
+}
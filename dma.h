@@ -25,17 +25,29 @@ enum Dma_Trigger {
 
 class Dma {
 public:
+	static const unsigned long long START_TICKS = 2;	//latency between the trigger and the first transfer
+
 	Dma(uint8_t num);
-	void trigger(Dma_Trigger trigger);
+	Dma_Trigger getTrigger(void);
+	bool isEnabled(void);
 	void enable_dma(void);
-	void full_run_dma(void);
+	bool run(unsigned long long until);
 	void load_on_repeat(void);
 	void disable();
 private:
+	void latchCount(void);
+	bool fastTransfer(uint32_t unit, unsigned long long until);
+	static uint32_t rangeStart(uint32_t address, int32_t step, uint32_t units);
+
 	uint32_t _srcAddr, _dstAddr, _transfLen, _transfCounter;
 	dma_control_struct* _cnt;
+	uint32_t* _sad;		//DMAxSAD
+	uint32_t* _dad;		//DMAxDAD
+	uint16_t* _count;	//DMAxCNT_L
+	uint32_t _srcMask, _dstMask, _countMask;
 	uint8_t _dmaNr, _reload_on_repeat;
 	bool _fifoTransfer;
+	bool _enabled;	//latched on the enable bit going from 0 to 1
 };
 
 #endif
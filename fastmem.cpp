@@ -0,0 +1,165 @@
+#include "fastmem.h"
+
+#include <cstdint>
+
+#ifdef GBA_FASTMEM
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+Fastmem::Fastmem() {
+	_base = nullptr;
+	_fd = -1;
+}
+
+Fastmem::~Fastmem() {
+	destroy();
+}
+
+bool Fastmem::isSupported() {
+#ifdef GBA_FASTMEM
+	return true;
+#else
+	return false;
+#endif
+}
+
+//reserve the address space and map bios, wram and vram with their mirrors
+bool Fastmem::create() {
+#ifdef GBA_FASTMEM
+	if (_base != nullptr)
+		return true;
+
+	_fd = memfd_create("gba_memory", 0);
+	if (_fd < 0)
+		return false;
+
+	if (ftruncate(_fd, ROM_OFFSET) != 0) {
+		destroy();
+		return false;
+	}
+
+	void* base = mmap(nullptr, ADDRESS_SPACE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		destroy();
+		return false;
+	}
+	_base = (uint8_t*)base;
+
+	bool ok = mapMirrors(0x00000000, 0x00004000, BIOS_OFFSET, 0x4000)
+		&& mapMirrors(0x02000000, 0x03000000, EWRAM_OFFSET, 0x40000)	//every 256k
+		&& mapMirrors(0x03000000, 0x04000000, IWRAM_OFFSET, 0x8000);	//every 32k
+
+	//vram mirrors every 128k, the last 32k mirror the previous 32k
+	for (uint32_t address = 0x06000000; ok && address < 0x07000000; address += 0x20000) {
+		ok = mapView(address, VRAM_OFFSET, 0x18000, true)
+			&& mapView(address + 0x18000, VRAM_OFFSET + 0x10000, 0x8000, true);
+	}
+
+	//an unaligned access at the end of a region reads a few bytes past it: the start
+	//of the region is mapped there again, so the host never faults
+	uint32_t pageSize = sysconf(_SC_PAGESIZE);
+	ok = ok && mapView(0x00004000, BIOS_OFFSET, pageSize, true)
+		&& mapView(0x04000000, IWRAM_OFFSET, pageSize, true)
+		&& mapView(0x07000000, VRAM_OFFSET, pageSize, true);
+
+	if (!ok) {
+		destroy();
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Fastmem::destroy() {
+#ifdef GBA_FASTMEM
+	if (_base != nullptr)
+		munmap(_base, ADDRESS_SPACE);
+	if (_fd >= 0)
+		close(_fd);
+#endif
+	_base = nullptr;
+	_fd = -1;
+}
+
+//copy the rom in the memfd and map it in the three wait state windows, read only.
+//each window is followed by a page of the rom start, like the other regions
+bool Fastmem::mapRom(const uint8_t* rom, uint32_t size) {
+#ifdef GBA_FASTMEM
+	if (_base == nullptr || size > 0x2000000)
+		return false;
+
+	uint32_t pageSize = sysconf(_SC_PAGESIZE);
+	uint32_t mappedSize = (size + pageSize - 1) & ~(pageSize - 1);
+
+	for (int waitState = 0; waitState < 3; waitState++) {	//drop the previous rom
+		if (!unmapRange(0x08000000 + waitState * 0x02000000, 0x02000000))
+			return false;
+	}
+	if (!unmapRange(0x0e000000, pageSize))
+		return false;
+
+	if (ftruncate(_fd, ROM_OFFSET) != 0 || ftruncate(_fd, ROM_OFFSET + mappedSize) != 0)
+		return false;
+
+	uint32_t written = 0;
+	while (written < size) {
+		ssize_t ret = pwrite(_fd, rom + written, size - written, ROM_OFFSET + written);
+		if (ret <= 0)
+			return false;
+		written += ret;
+	}
+
+	for (int waitState = 0; waitState < 3; waitState++) {
+		uint32_t start = 0x08000000 + waitState * 0x02000000;
+		if (!mapView(start, ROM_OFFSET, mappedSize, false))
+			return false;
+		if ((mappedSize < 0x02000000 || waitState == 2) && !mapView(start + mappedSize, ROM_OFFSET, pageSize, false))
+			return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool Fastmem::isActive() {
+	return _base != nullptr;
+}
+
+//base[address] is the byte at that gba address, on mapped memory
+uint8_t* Fastmem::getBase() {
+	return _base;
+}
+
+//map size bytes of the memfd at the gba address
+bool Fastmem::mapView(uint32_t address, uint32_t offset, uint32_t size, bool writable) {
+#ifdef GBA_FASTMEM
+	int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+	void* view = mmap(_base + address, size, prot, MAP_SHARED | MAP_FIXED, _fd, offset);
+	return view != MAP_FAILED;
+#else
+	return false;
+#endif
+}
+
+//map the same memory again and again to fill [start, end)
+bool Fastmem::mapMirrors(uint32_t start, uint32_t end, uint32_t offset, uint32_t size) {
+	for (uint32_t address = start; address < end; address += size) {
+		if (!mapView(address, offset, size, true))
+			return false;
+	}
+	return true;
+}
+
+//give the range back to the reservation
+bool Fastmem::unmapRange(uint32_t address, uint32_t size) {
+#ifdef GBA_FASTMEM
+	void* view = mmap(_base + address, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+	return view != MAP_FAILED;
+#else
+	return false;
+#endif
+}
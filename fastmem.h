@@ -0,0 +1,43 @@
+#ifndef FASTMEM_H
+#define FASTMEM_H
+
+#include <cstdint>
+
+//the arena needs memfd_create and fixed mmap
+#if defined(__linux__)
+#define GBA_FASTMEM
+#endif
+
+//gba address space reserved as one host range, so that base[address] is the memory at address.
+//bios, wram, vram and rom live in a memfd and every hardware mirror is another mapping
+//of the same pages. io, palette, oam and unused memory stay unmapped, except for the page
+//after each region
+class Fastmem {
+public:
+	static const uint32_t ADDRESS_SPACE = 0x10000000;
+
+	Fastmem();
+	~Fastmem();
+	static bool isSupported();
+	bool create();
+	void destroy();
+	bool mapRom(const uint8_t* rom, uint32_t size);
+	bool isActive();
+	uint8_t* getBase();
+private:
+	//regions in the memfd
+	static const uint32_t BIOS_OFFSET = 0;
+	static const uint32_t EWRAM_OFFSET = 0x4000;
+	static const uint32_t IWRAM_OFFSET = 0x44000;
+	static const uint32_t VRAM_OFFSET = 0x4c000;
+	static const uint32_t ROM_OFFSET = 0x64000;
+
+	uint8_t* _base;
+	int _fd;
+
+	bool mapView(uint32_t address, uint32_t offset, uint32_t size, bool writable);
+	bool mapMirrors(uint32_t start, uint32_t end, uint32_t offset, uint32_t size);
+	bool unmapRange(uint32_t address, uint32_t size);
+};
+
+#endif
@@ -1,7 +1,24 @@
 #include "gba.h"
+#include "error.h"
+
+#include <cstring>
 
 #undef main
-int main() {
+int main(int argc, char* argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--fastmem") == 0 && !GBA::memory.setFastmem(true))
+			printError(ERROR, "fastmem is not available, using the page table");
+		else if (strcmp(argv[i], "--jit") == 0) {
+			GBA::cpu.setBackend(CPU_JIT);
+			if (GBA::cpu.getBackend() != CPU_JIT)
+				printError(ERROR, "the recompiler is not available, using the interpreter");
+		}
+		else if (strcmp(argv[i], "--lockstep") == 0)
+			GBA::cpu.setLockstep(true);
+		else if (strcmp(argv[i], "--hle-bios") == 0)
+			GBA::cpu.setHleBios(true);
+	}
+
 	GBA::Load("Kirby - Nightmare in Dreamland.gba");
 	GBA::Run();
 	return 0;
@@ -0,0 +1,544 @@
+#include "hle_bios.h"
+#include "gba.h"
+
+#include <cstdint>
+
+//handle the bios call. false if it isn't emulated, or the arguments aren't supported, and the bios code has to run
+bool HleBios::call(uint8_t number, uint32_t* r) {
+	switch (number) {
+	case SWI_REGISTER_RAM_RESET:
+		registerRamReset(r);
+		break;
+	case SWI_HALT:
+	case SWI_STOP:
+		GBA::cpu.halt(number == SWI_STOP);
+		break;
+	case SWI_DIV:
+		div(r, r[0], r[1]);
+		break;
+	case SWI_DIV_ARM:
+		div(r, r[1], r[0]);
+		break;
+	case SWI_SQRT:
+		sqrt(r);
+		break;
+	case SWI_ARCTAN:
+		r[0] = arcTan(r[0], &r[1], &r[3]);
+		break;
+	case SWI_ARCTAN2:
+		r[0] = (uint16_t)arcTan2(r[0], r[1], &r[1]);
+		r[3] = 0x170;
+		break;
+	case SWI_CPU_SET:
+		cpuSet(r);
+		break;
+	case SWI_CPU_FAST_SET:
+		cpuFastSet(r);
+		break;
+	case SWI_BG_AFFINE_SET:
+		bgAffineSet(r);
+		break;
+	case SWI_OBJ_AFFINE_SET:
+		objAffineSet(r);
+		break;
+	case SWI_LZ77_WRAM:
+	case SWI_LZ77_VRAM:
+		lz77(r, number == SWI_LZ77_VRAM);
+		break;
+	case SWI_HUFFMAN:
+		if (!huffman(r))
+			return false;
+		break;
+	case SWI_RL_WRAM:
+	case SWI_RL_VRAM:
+		runLength(r, number == SWI_RL_VRAM);
+		break;
+	default:
+		return false;
+	}
+
+	GBA::clock.addTicks(SWI_TICKS);
+	return true;
+}
+
+//the bios sine table: sin(i * pi / 128) in 1.14 fixed point, rounded down
+const int16_t* HleBios::sineTable() {
+	static const int16_t quarter[65] = {
+		0x0000, 0x0192, 0x0323, 0x04b5, 0x0645, 0x07d5, 0x0964, 0x0af1,
+		0x0c7c, 0x0e05, 0x0f8c, 0x1111, 0x1294, 0x1413, 0x158f, 0x1708,
+		0x187d, 0x19ef, 0x1b5d, 0x1cc6, 0x1e2b, 0x1f8b, 0x20e7, 0x223d,
+		0x238e, 0x24da, 0x2620, 0x2760, 0x289a, 0x29cd, 0x2afa, 0x2c21,
+		0x2d41, 0x2e5a, 0x2f6b, 0x3076, 0x3179, 0x3274, 0x3367, 0x3453,
+		0x3536, 0x3612, 0x36e5, 0x37af, 0x3871, 0x392a, 0x39da, 0x3a82,
+		0x3b20, 0x3bb6, 0x3c42, 0x3cc5, 0x3d3e, 0x3dae, 0x3e14, 0x3e71,
+		0x3ec5, 0x3f0e, 0x3f4e, 0x3f84, 0x3fb1, 0x3fd3, 0x3fec, 0x3ffb,
+		0x4000
+	};
+	static int16_t table[256];
+	static bool built = false;
+
+	if (!built) {
+		for (int i = 0; i < 128; i++) {
+			table[i] = quarter[i <= 64 ? i : 128 - i];
+			table[i + 128] = -table[i];
+		}
+		built = true;
+	}
+	return table;
+}
+
+//the bios refuses to read its own memory: the copy and decompression calls do nothing then
+bool HleBios::validSource(uint32_t address) {
+	return (address & 0x0e000000) != 0;
+}
+
+//zero fill with 32 bit writes, the way the bios uses CpuFastSet
+void HleBios::clear(uint32_t address, uint32_t size) {
+	for (uint32_t i = 0; i < size; i += 4) {
+		GBA::memory.write_32(address + i, 0);
+	}
+	GBA::clock.addTicks(3 * (size / 32));
+}
+
+//clear the areas selected by r0: ewram, iwram without the stacks at the top, palette, vram, oam,
+//serial, sound and the other io registers
+void HleBios::registerRamReset(uint32_t* r) {
+	uint8_t flags = r[0];
+
+	if (flags & 0x01)
+		clear(0x02000000, 0x40000);
+	if (flags & 0x02)
+		clear(0x03000000, 0x7e00);
+	if (flags & 0x04)
+		clear(0x05000000, 0x400);
+	if (flags & 0x08)
+		clear(0x06000000, 0x18000);
+	if (flags & 0x10)
+		clear(0x07000000, 0x400);
+	if (flags & 0x20) {
+		clear(0x04000120, 0x40);
+		GBA::memory.write_16(0x04000134, 0x8000);	//RCNT: general purpose mode
+	}
+	if (flags & 0x40) {	//the fifos are left alone
+		clear(0x04000060, 0x40);
+		GBA::memory.write_16(0x04000088, 0x200);	//SOUNDBIAS
+	}
+	if (flags & 0x80) {
+		clear(0x04000000, 0x60);
+		clear(0x040000b0, 0x60);	//dma and timers
+		GBA::memory.write_16(0x04000200, 0);	//IE
+		GBA::memory.write_16(0x04000204, 0);	//WAITCNT
+		GBA::memory.write_16(0x04000208, 0);	//IME
+		GBA::memory.write_16(0x04000000, 0x80);	//DISPCNT: forced blank
+	}
+}
+
+//32 bit multiplication that wraps like the arm one
+int32_t HleBios::mul(int32_t a, int32_t b) {
+	return (int32_t)((uint32_t)a * (uint32_t)b);
+}
+
+//r0 = num / denom, r1 = num % denom, r3 = abs(num / denom)
+void HleBios::div(uint32_t* r, int32_t num, int32_t denom) {
+	if (denom == 0) {	//the bios hangs unless num is 0 or +-1
+		r[0] = num < 0 ? -1 : 1;
+		r[1] = num;
+		r[3] = 1;
+	}
+	else if (denom == -1 && num == INT32_MIN) {
+		r[0] = INT32_MIN;
+		r[1] = 0;
+		r[3] = INT32_MIN;
+	}
+	else {
+		int32_t quot = num / denom;
+		r[0] = quot;
+		r[1] = num % denom;
+		r[3] = quot < 0 ? -quot : quot;
+	}
+
+	//one iteration of the division loop for every bit of the quotient
+	int loops = 1;
+	uint32_t absNum = num < 0 ? -(uint32_t)num : num;
+	uint32_t absDenom = denom < 0 ? -(uint32_t)denom : denom;
+	while (absDenom != 0 && absDenom < absNum && !(absDenom & 0x80000000)) {
+		absDenom <<= 1;
+		loops++;
+	}
+	GBA::clock.addTicks(11 + 13 * loops);
+}
+
+//r0 = floor(sqrt(r0))
+void HleBios::sqrt(uint32_t* r) {
+	uint32_t value = r[0];
+	uint32_t result = 0;
+	uint32_t bit = 1u << 30;
+
+	while (bit > value)
+		bit >>= 2;
+
+	int loops = 0;
+	while (bit != 0) {
+		if (value >= result + bit) {
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		}
+		else {
+			result >>= 1;
+		}
+		bit >>= 2;
+		loops++;
+	}
+
+	r[0] = result;
+	GBA::clock.addTicks(15 + 10 * loops);
+}
+
+//polynomial approximation of the arc tangent of a 1.14 value, the bios way
+int32_t HleBios::arcTan(int32_t i, uint32_t* r1, uint32_t* r3) {
+	static const int32_t coefficients[] = { 0x390, 0x91c, 0xfb6, 0x16aa, 0x2081, 0x3651, 0xa2f9 };
+
+	int32_t a = -(mul(i, i) >> 14);
+	int32_t b = (mul(0xa9, a) >> 14) + coefficients[0];
+	for (int k = 1; k < 7; k++) {
+		b = (mul(b, a) >> 14) + coefficients[k];
+	}
+
+	if (r1 != nullptr)
+		*r1 = a;
+	if (r3 != nullptr)
+		*r3 = b;
+
+	GBA::clock.addTicks(37 + 9 * 4);	//nine multiplications
+	return mul(i, b) >> 16;
+}
+
+//angle of the (x, y) vector, 0 - 0xffff for 0 - 2pi
+int32_t HleBios::arcTan2(int32_t x, int32_t y, uint32_t* r1) {
+	if (y == 0)
+		return x >= 0 ? 0 : 0x8000;
+	if (x == 0)
+		return y >= 0 ? 0x4000 : 0xc000;
+
+	if (y >= 0) {
+		if (x >= 0) {
+			if (x >= y)
+				return arcTan((y << 14) / x, r1, nullptr);
+		}
+		else if (-x >= y) {
+			return arcTan((y << 14) / x, r1, nullptr) + 0x8000;
+		}
+		return 0x4000 - arcTan((x << 14) / y, r1, nullptr);
+	}
+
+	if (x <= 0) {
+		if (-x > -y)
+			return arcTan((y << 14) / x, r1, nullptr) + 0x8000;
+	}
+	else if (x >= -y) {
+		return arcTan((y << 14) / x, r1, nullptr) + 0x10000;
+	}
+	return 0xc000 - arcTan((x << 14) / y, r1, nullptr);
+}
+
+//copy or fill r2 bits 0-20 halfwords (words if bit 26) from r0 to r1. bit 24: fill with the value at r0
+void HleBios::cpuSet(uint32_t* r) {
+	uint32_t count = r[2] & 0x1fffff;
+	bool fill = (r[2] & 0x01000000) != 0;
+	bool words = (r[2] & 0x04000000) != 0;
+	uint32_t size = words ? 4 : 2;
+	uint32_t src = r[0] & ~(size - 1);
+	uint32_t dst = r[1] & ~(size - 1);
+
+	if (!validSource(src) || !validSource(src + (fill ? size : count * size)))
+		return;
+
+	uint32_t value = 0;
+	if (fill)
+		value = words ? GBA::memory.read_32(src) : GBA::memory.read_16(src);
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (!fill) {
+			value = words ? GBA::memory.read_32(src) : GBA::memory.read_16(src);
+			src += size;
+		}
+		if (words)
+			GBA::memory.write_32(dst, value);
+		else
+			GBA::memory.write_16(dst, value);
+		dst += size;
+	}
+
+	r[0] = src;
+	r[1] = dst;
+	GBA::clock.addTicks(3 * count);	//counter and branch
+}
+
+//word copy or fill in blocks of 8 words, the count is rounded up
+void HleBios::cpuFastSet(uint32_t* r) {
+	uint32_t count = ((r[2] & 0x1fffff) + 7) & ~7;
+	bool fill = (r[2] & 0x01000000) != 0;
+	uint32_t src = r[0] & ~3;
+	uint32_t dst = r[1] & ~3;
+
+	if (!validSource(src) || !validSource(src + (fill ? 4 : count * 4)))
+		return;
+
+	uint32_t value = 0;
+	if (fill)
+		value = GBA::memory.read_32(src);
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (!fill) {
+			value = GBA::memory.read_32(src);
+			src += 4;
+		}
+		GBA::memory.write_32(dst, value);
+		dst += 4;
+	}
+
+	r[0] = src;
+	r[1] = dst;
+	GBA::clock.addTicks(3 * (count / 8));	//ldm/stm of 8 words, counter and branch
+}
+
+//r2 background rotation/scaling parameters from r0 (20 bytes each) to r1 (16 bytes each)
+void HleBios::bgAffineSet(uint32_t* r) {
+	const int16_t* sine = sineTable();
+	uint32_t src = r[0];
+	uint32_t dst = r[1];
+
+	for (uint32_t i = 0; i < r[2]; i++) {
+		int32_t ox = GBA::memory.read_32(src);	//texture center, 8 bit fraction
+		int32_t oy = GBA::memory.read_32(src + 4);
+		int32_t cx = (int16_t)GBA::memory.read_16(src + 8);	//screen center
+		int32_t cy = (int16_t)GBA::memory.read_16(src + 10);
+		int32_t sx = (int16_t)GBA::memory.read_16(src + 12);	//scale, 8 bit fraction
+		int32_t sy = (int16_t)GBA::memory.read_16(src + 14);
+		uint8_t theta = GBA::memory.read_16(src + 16) >> 8;
+		int32_t sin = sine[theta];
+		int32_t cos = sine[(uint8_t)(theta + 64)];
+
+		int32_t pa = mul(sx, cos) >> 14;
+		int32_t pb = -mul(sx, sin) >> 14;
+		int32_t pc = mul(sy, sin) >> 14;
+		int32_t pd = mul(sy, cos) >> 14;
+
+		GBA::memory.write_16(dst, pa);
+		GBA::memory.write_16(dst + 2, pb);
+		GBA::memory.write_16(dst + 4, pc);
+		GBA::memory.write_16(dst + 6, pd);
+		GBA::memory.write_32(dst + 8, ox - mul(pa, cx) - mul(pb, cy));
+		GBA::memory.write_32(dst + 12, oy - mul(pc, cx) - mul(pd, cy));
+
+		src += 20;
+		dst += 16;
+		GBA::clock.addTicks(30);
+	}
+}
+
+//r2 object rotation/scaling parameters from r0 (8 bytes each) to r1, r3 bytes apart
+void HleBios::objAffineSet(uint32_t* r) {
+	const int16_t* sine = sineTable();
+	uint32_t src = r[0];
+	uint32_t dst = r[1];
+	uint32_t stride = r[3];
+
+	for (uint32_t i = 0; i < r[2]; i++) {
+		int32_t sx = (int16_t)GBA::memory.read_16(src);
+		int32_t sy = (int16_t)GBA::memory.read_16(src + 2);
+		uint8_t theta = GBA::memory.read_16(src + 4) >> 8;
+		int32_t sin = sine[theta];
+		int32_t cos = sine[(uint8_t)(theta + 64)];
+
+		GBA::memory.write_16(dst, mul(sx, cos) >> 14);
+		GBA::memory.write_16(dst + stride, -mul(sx, sin) >> 14);
+		GBA::memory.write_16(dst + stride * 2, mul(sy, sin) >> 14);
+		GBA::memory.write_16(dst + stride * 3, mul(sy, cos) >> 14);
+
+		src += 8;
+		dst += stride * 4;
+		GBA::clock.addTicks(20);
+	}
+}
+
+//lz77 from r0 to r1. vram: written 16 bit at a time, copies read back what is already in memory
+void HleBios::lz77(uint32_t* r, bool vram) {
+	uint32_t src = r[0];
+	uint32_t dst = r[1];
+
+	if (!validSource(src))
+		return;
+
+	int32_t remaining = GBA::memory.read_32(src) >> 8;
+	uint16_t halfword = 0;
+	uint32_t bytes = 0;
+	src += 4;
+
+	while (remaining > 0) {
+		uint8_t flags = GBA::memory.read_8(src++);
+
+		for (int block = 0; block < 8 && remaining > 0; block++, flags <<= 1) {
+			uint32_t length = 1;
+			uint32_t disp = 0;
+			if (flags & 0x80) {	//copy length bytes from disp bytes back
+				uint16_t info = (GBA::memory.read_8(src) << 8) | GBA::memory.read_8(src + 1);
+				src += 2;
+				length = (info >> 12) + 3;
+				disp = (info & 0xfff) + 1;
+			}
+
+			for (uint32_t k = 0; k < length; k++) {
+				uint8_t byte;
+				if (disp == 0)
+					byte = GBA::memory.read_8(src++);
+				else if (vram)
+					byte = GBA::memory.read_16((dst - disp) & ~1) >> (((dst - disp) & 1) * 8);
+				else
+					byte = GBA::memory.read_8(dst - disp);
+
+				if (!vram) {
+					GBA::memory.write_8(dst, byte);
+				}
+				else if (dst & 1) {
+					GBA::memory.write_16(dst & ~1, halfword | (byte << 8));
+				}
+				else {
+					halfword = byte;
+				}
+				dst++;
+				if (remaining > 0)	//a block can overrun the size, like on the bios
+					remaining--;
+			}
+			bytes += length;
+		}
+	}
+
+	r[0] = src;
+	r[1] = dst;
+	r[3] = 0;
+	GBA::clock.addTicks(10 * bytes);
+}
+
+//huffman from r0 to r1, written 32 bit at a time. false, before writing anything, for the data sizes
+//that aren't supported: the bios code has to run then
+bool HleBios::huffman(uint32_t* r) {
+	uint32_t src = r[0] & ~3;
+	uint32_t dst = r[1];
+
+	if (!validSource(src))
+		return true;
+
+	uint32_t header = GBA::memory.read_32(src);
+	int32_t remaining = header >> 8;
+	uint32_t bits = header & 0xf;
+	if (bits == 0)
+		bits = 8;
+	if (32 % bits != 0 || bits == 1)	//data units that cross a word are not supported
+		return false;
+
+	uint32_t treeBase = src + 5;
+	uint32_t node = treeBase;
+	uint8_t nodeValue = GBA::memory.read_8(node);
+	uint32_t block = 0;
+	uint32_t blockBits = 0;
+	uint32_t decoded = 0;
+	src += 5 + GBA::memory.read_8(src + 4) * 2 + 1;	//skip the tree
+
+	while (remaining > 0) {
+		uint32_t stream = GBA::memory.read_32(src);
+		src += 4;
+
+		for (int k = 0; k < 32 && remaining > 0; k++, stream <<= 1) {
+			//node: bits 0-5 offset to the children, bit 7/6 left/right child is data
+			uint32_t next = (node & ~1) + (nodeValue & 0x3f) * 2 + 2;
+			bool right = (stream & 0x80000000) != 0;
+			if (!(nodeValue & (right ? 0x40 : 0x80))) {
+				node = next + right;
+				nodeValue = GBA::memory.read_8(node);
+				continue;
+			}
+
+			uint8_t data = GBA::memory.read_8(next + right);
+			block |= (data & ((1 << bits) - 1)) << blockBits;
+			blockBits += bits;
+			decoded++;
+			node = treeBase;
+			nodeValue = GBA::memory.read_8(node);
+
+			if (blockBits == 32) {
+				GBA::memory.write_32(dst, block);
+				dst += 4;
+				remaining -= 4;
+				block = 0;
+				blockBits = 0;
+			}
+		}
+	}
+
+	r[0] = src;
+	r[1] = dst;
+	GBA::clock.addTicks(12 * decoded);
+	return true;
+}
+
+//run length from r0 to r1. vram: written 16 bit at a time. the output is padded to 4 bytes
+void HleBios::runLength(uint32_t* r, bool vram) {
+	uint32_t src = r[0];
+	uint32_t dst = r[1];
+
+	if (!validSource(src))
+		return;
+
+	int32_t remaining = GBA::memory.read_32(src & ~3) >> 8;
+	int32_t padding = (4 - remaining) & 3;
+	uint16_t halfword = 0;
+	uint32_t bytes = 0;
+	src += 4;
+
+	while (remaining > 0) {
+		uint8_t flag = GBA::memory.read_8(src++);
+		bool compressed = (flag & 0x80) != 0;
+		int32_t length = compressed ? (flag & 0x7f) + 3 : (flag & 0x7f) + 1;
+		uint8_t byte = 0;
+		if (compressed)
+			byte = GBA::memory.read_8(src++);
+
+		for (; length > 0 && remaining > 0; length--, remaining--) {
+			if (!compressed)
+				byte = GBA::memory.read_8(src++);
+
+			if (!vram) {
+				GBA::memory.write_8(dst, byte);
+			}
+			else if (dst & 1) {
+				GBA::memory.write_16(dst & ~1, halfword | (byte << 8));
+			}
+			else {
+				halfword = byte;
+			}
+			dst++;
+			bytes++;
+		}
+	}
+
+	if (vram) {
+		if (dst & 1) {	//the pending byte goes out with the first padding byte
+			GBA::memory.write_16(dst & ~1, halfword);
+			padding--;
+			dst++;
+		}
+		for (; padding > 0; padding -= 2, dst += 2) {
+			GBA::memory.write_16(dst, 0);
+		}
+	}
+	else {
+		for (; padding > 0; padding--) {
+			GBA::memory.write_8(dst++, 0);
+		}
+	}
+
+	r[0] = src;
+	r[1] = dst;
+	GBA::clock.addTicks(8 * bytes);
+}
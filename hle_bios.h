@@ -0,0 +1,59 @@
+#ifndef HLE_BIOS_H
+#define HLE_BIOS_H
+
+#include <cstdint>
+
+enum Bios_Call {
+	SWI_SOFT_RESET = 0x00,
+	SWI_REGISTER_RAM_RESET = 0x01,
+	SWI_HALT = 0x02,
+	SWI_STOP = 0x03,
+	SWI_INTR_WAIT = 0x04,
+	SWI_VBLANK_INTR_WAIT = 0x05,
+	SWI_DIV = 0x06,
+	SWI_DIV_ARM = 0x07,
+	SWI_SQRT = 0x08,
+	SWI_ARCTAN = 0x09,
+	SWI_ARCTAN2 = 0x0a,
+	SWI_CPU_SET = 0x0b,
+	SWI_CPU_FAST_SET = 0x0c,
+	SWI_BG_AFFINE_SET = 0x0e,
+	SWI_OBJ_AFFINE_SET = 0x0f,
+	SWI_LZ77_WRAM = 0x11,
+	SWI_LZ77_VRAM = 0x12,
+	SWI_HUFFMAN = 0x13,
+	SWI_RL_WRAM = 0x14,
+	SWI_RL_VRAM = 0x15
+};
+
+//bios calls implemented natively. they leave memory and r0-r3 as the bios does,
+//memory accesses go through the memory mapper and the bios loops are charged as fixed ticks.
+//SoftReset, IntrWait and VBlankIntrWait change the program flow and are done by the cpu
+class HleBios {
+public:
+	static const int SWI_TICKS = 20;	//swi entry, dispatch and return
+	static const uint32_t BIOS_IF = 0x03007ff8;	//irq flags acknowledged by the game handler, read by IntrWait
+
+	static bool call(uint8_t number, uint32_t* r);
+private:
+
+	static const int16_t* sineTable();
+	static bool validSource(uint32_t address);
+	static int32_t mul(int32_t a, int32_t b);
+	static void clear(uint32_t address, uint32_t size);
+
+	static void registerRamReset(uint32_t* r);
+	static void div(uint32_t* r, int32_t num, int32_t denom);
+	static void sqrt(uint32_t* r);
+	static int32_t arcTan(int32_t i, uint32_t* r1, uint32_t* r3);
+	static int32_t arcTan2(int32_t x, int32_t y, uint32_t* r1);
+	static void cpuSet(uint32_t* r);
+	static void cpuFastSet(uint32_t* r);
+	static void bgAffineSet(uint32_t* r);
+	static void objAffineSet(uint32_t* r);
+	static void lz77(uint32_t* r, bool vram);
+	static bool huffman(uint32_t* r);
+	static void runLength(uint32_t* r, bool vram);
+};
+
+#endif
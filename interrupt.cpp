@@ -52,4 +52,14 @@ void Interrupt::checkInterrupts() {
 			}
 		}
 	}
+}
+
+//true if checkInterrupts has something to do
+bool Interrupt::pending() {
+	return (*IME & 1) && (*IE & *IF);
+}
+
+//true if an enabled irq in mask is flagged. halt wakes up on these, whatever IME says
+bool Interrupt::requested(uint16_t mask) {
+	return (*IE & *IF & mask) != 0;
 }
\ No newline at end of file
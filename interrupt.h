@@ -28,6 +28,8 @@ public:
 	void setVCounterFlag();
 	void setDMAFlag(uint8_t dmaNr);
 	void checkInterrupts();
+	bool pending();
+	bool requested(uint16_t mask);
 private:
 	uint16_t *IE, *IF, *IME;
 	uint8_t irq_cnt;
@@ -0,0 +1,895 @@
+#include "jit.h"
+#include "cpu.h"
+#include "gba.h"
+#include "thumb_decoder.h"
+#include "arm_decoder.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#ifdef GBA_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+enum HostReg {
+	HOST_EAX, HOST_ECX, HOST_EDX, HOST_EBX, HOST_ESP, HOST_EBP, HOST_ESI, HOST_EDI,
+	HOST_R8, HOST_R9, HOST_R10, HOST_R11, HOST_R12, HOST_R13, HOST_R14, HOST_R15
+};
+
+//x86 alu opcodes, register-register form
+enum AluOp {
+	ALU_ADD = 0x01,
+	ALU_OR = 0x09,
+	ALU_AND = 0x21,
+	ALU_SUB = 0x29,
+	ALU_XOR = 0x31,
+	ALU_CMP = 0x39,
+	ALU_TEST = 0x85,
+	ALU_ADD_LOAD = 0x03,	//register-memory form
+	ALU_CMP_LOAD = 0x3b
+};
+
+//x86 alu opcode extensions, register-immidiate form
+enum AluDigit {
+	DIGIT_ADD = 0,
+	DIGIT_OR = 1,
+	DIGIT_AND = 4,
+	DIGIT_SUB = 5,
+	DIGIT_XOR = 6,
+	DIGIT_CMP = 7
+};
+
+enum ShiftDigit {
+	SHIFT_SHL = 4,
+	SHIFT_SHR = 5,
+	SHIFT_SAR = 7
+};
+
+//x86 condition codes used to read EFLAGS
+enum HostCondition {
+	CC_O = 0x0,	//overflow
+	CC_C = 0x2,	//carry
+	CC_NC = 0x3,	//no carry (arm carry after a subtraction), unsigned above or equal
+	CC_Z = 0x4,	//zero
+	CC_S = 0x8	//sign
+};
+
+//flag sources for storeFlags
+const int FLAG_KEEP = -1;	//flag not changed by the instruction
+const int FLAG_SHIFTER = -2;	//carry from the cpu shifter carry out
+
+const int FLAG_V_BIT = 28;
+const int FLAG_C_BIT = 29;
+const int FLAG_Z_BIT = 30;
+const int FLAG_N_BIT = 31;
+
+//host registers that can hold guest registers across the block
+const int allocatableRegs[] = { HOST_R12, HOST_R13, HOST_R14, HOST_R15 };
+
+Jit::Jit() {
+	_code = nullptr;
+	_codeUsed = 0;
+	_full = false;
+	_compiledBlocks = 0;
+	_endingTicks = 0;
+	_fetchTicks = 0;
+	_stopTicks = 0;
+	_generation = 0;
+	_thumb = false;
+	_gamePak = false;
+	_out = nullptr;
+	_cpsrOffset = 0;
+	_shifterCarryOffset = 0;
+	for (int i = 0; i < 16; i++) {
+		_hostReg[i] = -1;
+		_uses[i] = 0;
+	}
+
+#ifdef GBA_JIT
+	//never writable and executable at the same time, compile() switches the pages of the block it emits
+	void* mem = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem != MAP_FAILED)
+		_code = (uint8_t*)mem;
+#endif
+}
+
+Jit::~Jit() {
+#ifdef GBA_JIT
+	if (_code != nullptr)
+		munmap(_code, CODE_SIZE);
+#endif
+}
+
+bool Jit::isSupported() {
+#ifdef GBA_JIT
+	return true;
+#else
+	return false;
+#endif
+}
+
+//true when the code buffer has no room for another block. clear() must be called along with a block cache flush
+bool Jit::isFull() {
+	return _full;
+}
+
+void Jit::clear() {
+	_codeUsed = 0;
+	_full = false;
+}
+
+uint64_t Jit::getCompiledBlocks() {
+	return _compiledBlocks;
+}
+
+//execute a compiled block. the first instruction fetch is charged here, the others by next()
+void Jit::run(Cpu& cpu, JitCode code, unsigned long long endingTicks) {
+	_endingTicks = endingTicks;
+	_generation = cpu._blockCache.getGeneration();
+	_thumb = cpu.reg.CPSR_f->T;
+	_gamePak = MemoryMapper::isGamePakRom(cpu.reg.R15);
+	cpu.syncFlags();	//the compiled code reads and writes the flags in the cpsr
+
+	_fetchTicks = GBA::memory.fetchTicks(cpu.reg.R15, _thumb);
+	GBA::clock.addTicks(_fetchTicks);
+	_stopTicks = std::min(_endingTicks, GBA::clock.getNextEvent());
+	code(&cpu, &cpu.reg);
+}
+
+//called between two instructions: same checks as Cpu::next_block, then fetch the next one.
+//after a native instruction only the clock can have changed, see emitFetch()
+bool Jit::next(Cpu* cpu, uint32_t pc) {
+	Jit& jit = cpu->_jit;
+
+	if (cpu->_blockCache.getGeneration() != jit._generation)	//block invalidated
+		return false;
+
+	if (cpu->_halted)	//HALTCNT written
+		return false;
+
+	if (cpu->reg.R15 != pc || cpu->reg.CPSR_f->T != jit._thumb)	//branch taken
+		return false;
+
+	if (GBA::clock.getTicks() >= jit._endingTicks)
+		return false;
+
+	if (!cpu->reg.CPSR_f->I && GBA::irq.pending())
+		return false;
+
+	GBA::clock.addTicks(jit._gamePak ? GBA::memory.fetchTicks(pc, jit._thumb) : jit._fetchTicks);
+	jit._stopTicks = std::min(jit._endingTicks, GBA::clock.getNextEvent());	//the instruction may have scheduled an event
+	return true;
+}
+
+//change the protection of the pages a block can be emitted to
+bool Jit::protect(uint8_t* start, int prot) {
+#ifdef GBA_JIT
+	uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+	uintptr_t first = (uintptr_t)start & ~(pageSize - 1);
+	uintptr_t last = std::min((uintptr_t)(start + MAX_BLOCK_CODE), (uintptr_t)(_code + CODE_SIZE));
+	return mprotect((void*)first, last - first, prot) == 0;
+#else
+	return false;
+#endif
+}
+
+void Jit::interpretThumb(Cpu* cpu, const DecodedInstruction* instr) {
+	(cpu->*instr->thumb)(instr->opcode);
+	cpu->syncFlags();
+}
+
+void Jit::interpretArm(Cpu* cpu, const DecodedInstruction* instr) {
+	if (cpu->arm_checkInstructionCondition(instr->opcode)) {
+		(cpu->*instr->arm)(instr->opcode);
+	}
+	else {	//doesn't meet the condition
+		cpu->reg.R15 += 4;
+	}
+	cpu->syncFlags();
+}
+
+//translate a block. returns nullptr if there is no executable memory left
+JitCode Jit::compile(Cpu& cpu, const DecodedBlock& block) {
+	if (_code == nullptr || _full)
+		return nullptr;
+
+	if (CODE_SIZE - _codeUsed < MAX_BLOCK_CODE) {
+		_full = true;
+		return nullptr;
+	}
+
+	_cpsrOffset = offsetof(Registers, CPSR);
+	_shifterCarryOffset = (int32_t)((uint8_t*)&cpu.shifter_carry_out - (uint8_t*)&cpu);
+
+	//first pass counts the guest register accesses, second pass emits the real code
+	uint8_t* start = _code + _codeUsed;
+	if (!protect(start, PROT_READ | PROT_WRITE))
+		return nullptr;
+	for (int i = 0; i < 16; i++) {
+		_hostReg[i] = -1;
+		_uses[i] = 0;
+	}
+	emitBlock(block, start);
+	allocateRegisters();
+	emitBlock(block, start);
+	if (!protect(start, PROT_READ | PROT_EXEC))
+		return nullptr;
+
+	_codeUsed += (uint32_t)(_out - start);
+	_codeUsed = (_codeUsed + 15) & ~15;	//align next block
+	_compiledBlocks++;
+
+	return (JitCode)start;
+}
+
+void Jit::emitBlock(const DecodedBlock& block, uint8_t* start) {
+	_out = start;
+	_exitJumps.clear();
+
+	//prologue: void code(Cpu* cpu, Registers* reg)
+	push(HOST_EBX);
+	push(HOST_EBP);
+	push(HOST_R12);
+	push(HOST_R13);
+	push(HOST_R14);
+	push(HOST_R15);
+	aluRegImm(DIGIT_SUB, HOST_ESP, 8, true);	//keep the stack 16 byte aligned for calls
+	movReg64Reg(HOST_EBP, HOST_EDI);	//rbp = cpu
+	movReg64Reg(HOST_EBX, HOST_ESI);	//rbx = registers
+	reload();
+
+	uint32_t pc = block.address;
+	uint32_t step = block.thumb ? 2 : 4;
+	bool gamePak = MemoryMapper::isGamePakRom(block.address);
+	bool native = false;	//native instructions don't write R15, it's stored only before it gets read
+
+	for (size_t i = 0; i < block.instructions.size(); i++) {
+		const DecodedInstruction& instr = block.instructions[i];
+
+		if (i > 0 && native && !gamePak) {	//only the clock moved since the last check
+			emitFetch(pc);
+		}
+		else if (i > 0) {
+			if (native)
+				movMemImm(HOST_EBX, offsetof(Registers, R15), pc);
+			callHelper((void*)&Jit::next, pc);
+			exitIfFalse();
+		}
+
+		bool wasNative = native;
+		native = block.thumb ? compileThumb((uint16_t)instr.opcode) : compileArm(instr.opcode);
+		if (!native) {	//fall back to the interpreter
+			if (wasNative)
+				movMemImm(HOST_EBX, offsetof(Registers, R15), pc);
+			writeBack();
+			callHelper(block.thumb ? (void*)&Jit::interpretThumb : (void*)&Jit::interpretArm, (uint64_t)&instr);
+			reload();
+		}
+
+		pc += step;
+	}
+	if (native)
+		movMemImm(HOST_EBX, offsetof(Registers, R15), pc);
+
+	//epilogue, also the target of all exits. R15 is always up to date here
+	for (uint8_t* jump : _exitJumps) {
+		*(int32_t*)(jump - 4) = (int32_t)(_out - jump);
+	}
+	writeBack();
+	aluRegImm(DIGIT_ADD, HOST_ESP, 8, true);
+	pop(HOST_R15);
+	pop(HOST_R14);
+	pop(HOST_R13);
+	pop(HOST_R12);
+	pop(HOST_EBP);
+	pop(HOST_EBX);
+	emit8(0xc3);	//ret
+}
+
+//keep the most used guest registers in host registers
+void Jit::allocateRegisters() {
+	for (int host : allocatableRegs) {
+		int best = -1;
+		for (int guest = 0; guest < 15; guest++) {
+			if (_hostReg[guest] < 0 && _uses[guest] >= 2 && (best < 0 || _uses[guest] > _uses[best]))
+				best = guest;
+		}
+		if (best < 0)
+			return;
+		_hostReg[best] = host;
+	}
+}
+
+//translate a thumb instruction. returns false, without emitting anything, if it must be interpreted
+bool Jit::compileThumb(uint16_t opcode) {
+	uint8_t rd = opcode & 0b111;
+	uint8_t rs = (opcode >> 3) & 0b111;
+	uint8_t rn = (opcode >> 6) & 0b111;	//register or 3 bit immidiate
+	uint8_t offset = (opcode >> 6) & 0b11111;
+	uint8_t rd8 = (opcode >> 8) & 0b111;
+	uint32_t nn = opcode & 0xff;
+	uint8_t rdHi = rd | ((opcode & 0b10000000) >> 4);
+	uint8_t rsHi = rs | ((opcode & 0b1000000) >> 3);
+
+	THUMB_opcode instr = ThumbDecoder::decode(opcode);
+
+	switch (instr) {
+	case THUMB_OP_LSL_IMM:
+		loadGuest(HOST_EAX, rs);
+		if (offset == 0) {	//plain move, flags unchanged
+			storeGuest(rd, HOST_EAX);
+			return true;
+		}
+		shiftRegImm(SHIFT_SHL, HOST_EAX, offset);
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, CC_C, FLAG_KEEP);
+		return true;
+
+	case THUMB_OP_LSR_IMM:
+	case THUMB_OP_ASR_IMM:
+		if (offset == 0)	//shift by 32
+			return false;
+		loadGuest(HOST_EAX, rs);
+		shiftRegImm(instr == THUMB_OP_ASR_IMM ? SHIFT_SAR : SHIFT_SHR, HOST_EAX, offset);
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, CC_C, FLAG_KEEP);
+		return true;
+
+	case THUMB_OP_ADD_RR:
+		loadGuest(HOST_EAX, rs);
+		loadGuest(HOST_ECX, rn);
+		aluRegReg(ALU_ADD, HOST_EAX, HOST_ECX);
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, CC_C, CC_O);
+		return true;
+
+	case THUMB_OP_SUB_RR:
+		loadGuest(HOST_EAX, rs);
+		loadGuest(HOST_ECX, rn);
+		aluRegReg(ALU_SUB, HOST_EAX, HOST_ECX);
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, CC_NC, CC_O);
+		return true;
+
+	case THUMB_OP_ADD_RI:
+		loadGuest(HOST_EAX, rs);
+		aluRegImm(DIGIT_ADD, HOST_EAX, rn);
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, CC_C, CC_O);
+		return true;
+
+	case THUMB_OP_SUB_RI:
+		loadGuest(HOST_EAX, rs);
+		aluRegImm(DIGIT_SUB, HOST_EAX, rn);
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, CC_NC, CC_O);
+		return true;
+
+	case THUMB_OP_MOV_I:
+		movRegImm(HOST_EAX, nn);
+		storeGuest(rd8, HOST_EAX);
+		storeConstFlags((1u << FLAG_N_BIT) | (1u << FLAG_Z_BIT), nn == 0 ? (1u << FLAG_Z_BIT) : 0);
+		return true;
+
+	case THUMB_OP_ADD_I:
+	case THUMB_OP_SUB_I:
+		loadGuest(HOST_EAX, rd8);
+		aluRegImm(instr == THUMB_OP_ADD_I ? DIGIT_ADD : DIGIT_SUB, HOST_EAX, nn);
+		storeGuest(rd8, HOST_EAX);
+		storeFlags(CC_S, CC_Z, instr == THUMB_OP_ADD_I ? CC_C : CC_NC, CC_O);
+		return true;
+
+	case THUMB_OP_CMP_I:
+		loadGuest(HOST_EAX, rd8);
+		aluRegImm(DIGIT_CMP, HOST_EAX, nn);
+		storeFlags(CC_S, CC_Z, CC_NC, CC_O);
+		return true;
+
+	case THUMB_OP_AND:
+	case THUMB_OP_EOR:
+	case THUMB_OP_ORR:
+		loadGuest(HOST_EAX, rd);
+		loadGuest(HOST_ECX, rs);
+		aluRegReg(instr == THUMB_OP_AND ? ALU_AND : instr == THUMB_OP_EOR ? ALU_XOR : ALU_OR, HOST_EAX, HOST_ECX);
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, FLAG_KEEP, FLAG_KEEP);
+		return true;
+
+	case THUMB_OP_BIC:
+		loadGuest(HOST_EAX, rd);
+		loadGuest(HOST_ECX, rs);
+		notReg(HOST_ECX);
+		aluRegReg(ALU_AND, HOST_EAX, HOST_ECX);
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, FLAG_KEEP, FLAG_KEEP);
+		return true;
+
+	case THUMB_OP_MVN:
+		loadGuest(HOST_EAX, rs);
+		notReg(HOST_EAX);
+		aluRegReg(ALU_TEST, HOST_EAX, HOST_EAX);	//not doesn't set the flags
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, FLAG_KEEP, FLAG_KEEP);
+		return true;
+
+	case THUMB_OP_TST:
+		loadGuest(HOST_EAX, rd);
+		loadGuest(HOST_ECX, rs);
+		aluRegReg(ALU_TEST, HOST_EAX, HOST_ECX);
+		storeFlags(CC_S, CC_Z, FLAG_KEEP, FLAG_KEEP);
+		return true;
+
+	case THUMB_OP_CMP:
+		loadGuest(HOST_EAX, rd);
+		loadGuest(HOST_ECX, rs);
+		aluRegReg(ALU_CMP, HOST_EAX, HOST_ECX);
+		storeFlags(CC_S, CC_Z, CC_NC, CC_O);
+		return true;
+
+	case THUMB_OP_CMN:
+		loadGuest(HOST_EAX, rd);
+		loadGuest(HOST_ECX, rs);
+		aluRegReg(ALU_ADD, HOST_EAX, HOST_ECX);
+		storeFlags(CC_S, CC_Z, CC_C, CC_O);
+		return true;
+
+	case THUMB_OP_NEG:	//0 - Rs
+		movRegImm(HOST_EAX, 0);
+		loadGuest(HOST_ECX, rs);
+		aluRegReg(ALU_SUB, HOST_EAX, HOST_ECX);
+		storeGuest(rd, HOST_EAX);
+		storeFlags(CC_S, CC_Z, CC_NC, CC_O);
+		return true;
+
+	case THUMB_OP_ADD_SP:
+	case THUMB_OP_SUB_SP:
+		loadGuest(HOST_EAX, 13);
+		aluRegImm((opcode & 0x80) ? DIGIT_SUB : DIGIT_ADD, HOST_EAX, (opcode & 0x7f) * 4);
+		storeGuest(13, HOST_EAX);
+		return true;
+
+	case THUMB_OP_ADD_R_SP:
+		loadGuest(HOST_EAX, 13);
+		aluRegImm(DIGIT_ADD, HOST_EAX, nn * 4);
+		storeGuest(rd8, HOST_EAX);
+		return true;
+
+	case THUMB_OP_MOV_HRR:
+	case THUMB_OP_NOP:
+		if (rdHi == 15 || rsHi == 15)
+			return false;
+		loadGuest(HOST_EAX, rsHi);
+		storeGuest(rdHi, HOST_EAX);
+		return true;
+
+	case THUMB_OP_ADD_HRR:
+		if (rdHi == 15 || rsHi == 15)
+			return false;
+		loadGuest(HOST_EAX, rdHi);
+		loadGuest(HOST_ECX, rsHi);
+		aluRegReg(ALU_ADD, HOST_EAX, HOST_ECX);	//no condition flag are set
+		storeGuest(rdHi, HOST_EAX);
+		return true;
+
+	case THUMB_OP_CMP_HRR:
+		if (rdHi == 15 || rsHi == 15)
+			return false;
+		loadGuest(HOST_EAX, rdHi);
+		loadGuest(HOST_ECX, rsHi);
+		aluRegReg(ALU_CMP, HOST_EAX, HOST_ECX);
+		storeFlags(CC_S, CC_Z, CC_NC, CC_O);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+//translate an arm data processing instruction with an unshifted 2nd operand.
+//returns false, without emitting anything, if it must be interpreted
+bool Jit::compileArm(uint32_t opcode) {
+	if ((opcode >> 28) != 0xe)	//conditional instructions are interpreted
+		return false;
+
+	ARM_opcode instr = ArmDecoder::lookup(opcode);
+	uint8_t s = (opcode >> 20) & 1;
+	uint8_t rd = (opcode >> 12) & 0x0f;
+	uint8_t rn = (opcode >> 16) & 0x0f;
+
+	switch (instr) {
+	case ARM_OP_AND: case ARM_OP_EOR: case ARM_OP_SUB: case ARM_OP_ADD:
+	case ARM_OP_TST: case ARM_OP_TEQ: case ARM_OP_ORR: case ARM_OP_BIC:
+	case ARM_OP_RSB: case ARM_OP_CMP:
+		if (rn == 15)
+			return false;
+		break;
+	case ARM_OP_MOV:
+		break;
+	default:
+		return false;
+	}
+	if (rd == 15)	//writes to pc and spsr restore
+		return false;
+
+	//2nd operand: rotated immidiate or register with LSL #0
+	bool immidiate = (opcode >> 25) & 1;
+	uint32_t imm = 0;
+	int shifterCarry = -1;	//-1: carry flag, 0/1: constant
+	uint8_t rm = opcode & 0x0f;
+	if (immidiate) {
+		uint8_t rotate = ((opcode >> 8) & 0x0f) * 2;
+		uint32_t nn = opcode & 0xff;
+		imm = nn;
+		if (rotate != 0) {
+			imm = (nn >> rotate) | (nn << (32 - rotate));
+			shifterCarry = (nn >> (rotate - 1)) & 1;
+		}
+	}
+	else if ((opcode & 0xff0) != 0 || rm == 15) {	//shifted register
+		return false;
+	}
+
+	//shifter carry out, as set by the interpreter
+	if (shifterCarry < 0) {
+		movRegMem(HOST_EAX, HOST_EBX, _cpsrOffset);
+		shiftRegImm(SHIFT_SHR, HOST_EAX, FLAG_C_BIT);
+		aluRegImm(DIGIT_AND, HOST_EAX, 1);
+		movMemReg8(HOST_EBP, _shifterCarryOffset, HOST_EAX);
+	}
+	else {
+		movMemImm8(HOST_EBP, _shifterCarryOffset, shifterCarry);
+	}
+
+	if (immidiate)
+		movRegImm(HOST_ECX, imm);
+	else
+		loadGuest(HOST_ECX, rm);
+	if (instr != ARM_OP_MOV)
+		loadGuest(HOST_EAX, rn);
+
+	switch (instr) {
+	case ARM_OP_AND:
+	case ARM_OP_EOR:
+	case ARM_OP_ORR:
+	case ARM_OP_BIC:
+		if (instr == ARM_OP_BIC)
+			notReg(HOST_ECX);
+		aluRegReg(instr == ARM_OP_EOR ? ALU_XOR : instr == ARM_OP_ORR ? ALU_OR : ALU_AND, HOST_EAX, HOST_ECX);
+		storeGuest(rd, HOST_EAX);
+		if (s) storeFlags(CC_S, CC_Z, FLAG_SHIFTER, FLAG_KEEP);
+		return true;
+
+	case ARM_OP_MOV:
+		movRegReg(HOST_EAX, HOST_ECX);
+		storeGuest(rd, HOST_EAX);
+		if (s) {
+			aluRegReg(ALU_TEST, HOST_EAX, HOST_EAX);
+			storeFlags(CC_S, CC_Z, FLAG_SHIFTER, FLAG_KEEP);
+		}
+		return true;
+
+	case ARM_OP_TST:
+	case ARM_OP_TEQ:
+		aluRegReg(instr == ARM_OP_TST ? ALU_TEST : ALU_XOR, HOST_EAX, HOST_ECX);
+		if (s) storeFlags(CC_S, CC_Z, FLAG_SHIFTER, FLAG_KEEP);
+		return true;
+
+	case ARM_OP_ADD:
+		aluRegReg(ALU_ADD, HOST_EAX, HOST_ECX);
+		storeGuest(rd, HOST_EAX);
+		if (s) storeFlags(CC_S, CC_Z, CC_C, CC_O);
+		return true;
+
+	case ARM_OP_SUB:
+		aluRegReg(ALU_SUB, HOST_EAX, HOST_ECX);
+		storeGuest(rd, HOST_EAX);
+		if (s) storeFlags(CC_S, CC_Z, CC_NC, CC_O);
+		return true;
+
+	case ARM_OP_RSB:
+		aluRegReg(ALU_SUB, HOST_ECX, HOST_EAX);
+		storeGuest(rd, HOST_ECX);
+		if (s) storeFlags(CC_S, CC_Z, CC_NC, CC_O);
+		return true;
+
+	case ARM_OP_CMP:
+		aluRegReg(ALU_CMP, HOST_EAX, HOST_ECX);
+		storeFlags(CC_S, CC_Z, CC_NC, CC_O);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+//call a helper(Cpu* cpu, arg)
+void Jit::callHelper(void* helper, uint64_t arg) {
+	movReg64Reg(HOST_EDI, HOST_EBP);
+	movReg64Imm(HOST_ESI, arg);
+	movReg64Imm(HOST_EAX, (uint64_t)helper);
+	emit8(0xff);	//call rax
+	emit8(0xd0);
+}
+
+//inline version of next() after a native instruction: charge the fetch, which doesn't touch the
+//prefetch buffer outside of the game pak, and only call next() when the clock reaches _stopTicks
+void Jit::emitFetch(uint32_t pc) {
+	movReg64Imm(HOST_ECX, (uint64_t)&GBA::clock._ticks);
+	movReg64Imm(HOST_EDX, (uint64_t)&_fetchTicks);
+	movReg64Imm(HOST_ESI, (uint64_t)&_stopTicks);
+	movReg64Mem(HOST_EAX, HOST_ECX, 0);
+	aluReg64Mem(ALU_ADD_LOAD, HOST_EAX, HOST_EDX, 0);
+	aluReg64Mem(ALU_CMP_LOAD, HOST_EAX, HOST_ESI, 0);
+	uint8_t* due = jumpIf(CC_NC);
+	movMem64Reg(HOST_ECX, 0, HOST_EAX);
+	uint8_t* done = jump();
+
+	patchJump(due);
+	movMemImm(HOST_EBX, offsetof(Registers, R15), pc);
+	callHelper((void*)&Jit::next, pc);
+	exitIfFalse();
+	patchJump(done);
+}
+
+//leave the block if the last helper returned false
+void Jit::exitIfFalse() {
+	emit8(0x84);	//test al, al
+	emit8(0xc0);
+	emit8(0x0f);	//jz rel32, patched with the epilogue address
+	emit8(0x84);
+	emit32(0);
+	_exitJumps.push_back(_out);
+}
+
+//copy the guest registers held in host registers back to the register file
+void Jit::writeBack() {
+	for (int guest = 0; guest < 16; guest++) {
+		if (_hostReg[guest] >= 0)
+			movMemReg(HOST_EBX, guest * 4, _hostReg[guest]);
+	}
+}
+
+void Jit::reload() {
+	for (int guest = 0; guest < 16; guest++) {
+		if (_hostReg[guest] >= 0)
+			movRegMem(_hostReg[guest], HOST_EBX, guest * 4);
+	}
+}
+
+void Jit::loadGuest(int host, int guest) {
+	_uses[guest]++;
+	if (_hostReg[guest] >= 0)
+		movRegReg(host, _hostReg[guest]);
+	else
+		movRegMem(host, HOST_EBX, guest * 4);
+}
+
+void Jit::storeGuest(int guest, int host) {
+	_uses[guest]++;
+	if (_hostReg[guest] >= 0)
+		movRegReg(_hostReg[guest], host);
+	else
+		movMemReg(HOST_EBX, guest * 4, host);
+}
+
+//copy the host flags into CPSR. each flag is a host condition code or FLAG_KEEP
+void Jit::storeFlags(int n, int z, int c, int v) {
+	const int flags[] = { n, z, c, v };
+	const int bits[] = { FLAG_N_BIT, FLAG_Z_BIT, FLAG_C_BIT, FLAG_V_BIT };
+	const int temps[] = { HOST_R8, HOST_R9, HOST_R10, HOST_R11 };
+
+	uint32_t mask = 0;
+	for (int i = 0; i < 4; i++) {
+		if (flags[i] >= 0)
+			setcc(flags[i], temps[i]);
+		if (flags[i] == FLAG_SHIFTER)
+			movzxRegMem8(temps[i], HOST_EBP, _shifterCarryOffset);
+		if (flags[i] != FLAG_KEEP)
+			mask |= 1u << bits[i];
+	}
+
+	movRegMem(HOST_EDX, HOST_EBX, _cpsrOffset);
+	aluRegImm(DIGIT_AND, HOST_EDX, ~mask);
+	for (int i = 0; i < 4; i++) {
+		if (flags[i] == FLAG_KEEP)
+			continue;
+		movzxRegReg8(HOST_EAX, temps[i]);
+		shiftRegImm(SHIFT_SHL, HOST_EAX, bits[i]);
+		aluRegReg(ALU_OR, HOST_EDX, HOST_EAX);
+	}
+	movMemReg(HOST_EBX, _cpsrOffset, HOST_EDX);
+}
+
+void Jit::storeConstFlags(uint32_t mask, uint32_t value) {
+	movRegMem(HOST_EDX, HOST_EBX, _cpsrOffset);
+	aluRegImm(DIGIT_AND, HOST_EDX, ~mask);
+	if (value)
+		aluRegImm(DIGIT_OR, HOST_EDX, value);
+	movMemReg(HOST_EBX, _cpsrOffset, HOST_EDX);
+}
+
+void Jit::emit8(uint8_t b) {
+	*_out++ = b;
+}
+
+void Jit::emit32(uint32_t d) {
+	for (int i = 0; i < 4; i++) {
+		emit8((d >> (i * 8)) & 0xff);
+	}
+}
+
+void Jit::emit64(uint64_t q) {
+	emit32((uint32_t)q);
+	emit32((uint32_t)(q >> 32));
+}
+
+//rex prefix, only emitted when needed
+void Jit::rex(bool w, int reg, int rm) {
+	uint8_t prefix = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+	if (prefix != 0x40)
+		emit8(prefix);
+}
+
+void Jit::modrmReg(int reg, int rm) {
+	emit8(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+//[base + disp32]. base can't be rsp or r12, that need a sib byte
+void Jit::modrmMem(int reg, int base, int32_t disp) {
+	emit8(0x80 | ((reg & 7) << 3) | (base & 7));
+	emit32(disp);
+}
+
+void Jit::movRegReg(int dst, int src) {
+	rex(false, src, dst);
+	emit8(0x89);
+	modrmReg(src, dst);
+}
+
+void Jit::movRegMem(int dst, int base, int32_t disp) {
+	rex(false, dst, base);
+	emit8(0x8b);
+	modrmMem(dst, base, disp);
+}
+
+void Jit::movMemReg(int base, int32_t disp, int src) {
+	rex(false, src, base);
+	emit8(0x89);
+	modrmMem(src, base, disp);
+}
+
+//byte store of the low 8 bits of eax, ecx or edx
+void Jit::movMemReg8(int base, int32_t disp, int src) {
+	rex(false, src, base);
+	emit8(0x88);
+	modrmMem(src, base, disp);
+}
+
+void Jit::movRegImm(int dst, uint32_t imm) {
+	rex(false, 0, dst);
+	emit8(0xb8 + (dst & 7));
+	emit32(imm);
+}
+
+void Jit::movMemImm(int base, int32_t disp, uint32_t imm) {
+	rex(false, 0, base);
+	emit8(0xc7);
+	modrmMem(0, base, disp);
+	emit32(imm);
+}
+
+void Jit::movMemImm8(int base, int32_t disp, uint8_t imm) {
+	rex(false, 0, base);
+	emit8(0xc6);
+	modrmMem(0, base, disp);
+	emit8(imm);
+}
+
+void Jit::movzxRegMem8(int dst, int base, int32_t disp) {
+	rex(false, dst, base);
+	emit8(0x0f);
+	emit8(0xb6);
+	modrmMem(dst, base, disp);
+}
+
+//src is eax, ecx, edx or r8-r15
+void Jit::movzxRegReg8(int dst, int src) {
+	rex(false, dst, src);
+	emit8(0x0f);
+	emit8(0xb6);
+	modrmReg(dst, src);
+}
+
+void Jit::aluRegReg(uint8_t op, int dst, int src) {
+	rex(false, src, dst);
+	emit8(op);
+	modrmReg(src, dst);
+}
+
+void Jit::aluRegImm(uint8_t digit, int dst, uint32_t imm, bool wide) {
+	rex(wide, 0, dst);
+	emit8(0x81);
+	modrmReg(digit, dst);
+	emit32(imm);
+}
+
+void Jit::notReg(int reg) {
+	rex(false, 0, reg);
+	emit8(0xf7);
+	modrmReg(2, reg);
+}
+
+void Jit::shiftRegImm(uint8_t digit, int reg, uint8_t amount) {
+	rex(false, 0, reg);
+	emit8(0xc1);
+	modrmReg(digit, reg);
+	emit8(amount);
+}
+
+//reg is eax, ecx, edx or r8-r15
+void Jit::setcc(uint8_t cc, int reg) {
+	rex(false, 0, reg);
+	emit8(0x0f);
+	emit8(0x90 + cc);
+	modrmReg(0, reg);
+}
+
+void Jit::movReg64Imm(int dst, uint64_t imm) {
+	rex(true, 0, dst);
+	emit8(0xb8 + (dst & 7));
+	emit64(imm);
+}
+
+void Jit::movReg64Reg(int dst, int src) {
+	rex(true, src, dst);
+	emit8(0x89);
+	modrmReg(src, dst);
+}
+
+void Jit::movReg64Mem(int dst, int base, int32_t disp) {
+	rex(true, dst, base);
+	emit8(0x8b);
+	modrmMem(dst, base, disp);
+}
+
+void Jit::movMem64Reg(int base, int32_t disp, int src) {
+	rex(true, src, base);
+	emit8(0x89);
+	modrmMem(src, base, disp);
+}
+
+//op is the register-memory form of the alu opcode
+void Jit::aluReg64Mem(uint8_t op, int dst, int base, int32_t disp) {
+	rex(true, dst, base);
+	emit8(op);
+	modrmMem(dst, base, disp);
+}
+
+//short forward jumps, patchJump() sets the target to the current position
+uint8_t* Jit::jumpIf(uint8_t cc) {
+	emit8(0x70 + cc);
+	emit8(0);
+	return _out;
+}
+
+uint8_t* Jit::jump() {
+	emit8(0xeb);
+	emit8(0);
+	return _out;
+}
+
+void Jit::patchJump(uint8_t* jump) {
+	*(int8_t*)(jump - 1) = (int8_t)(_out - jump);
+}
+
+void Jit::push(int reg) {
+	rex(false, 0, reg);
+	emit8(0x50 + (reg & 7));
+}
+
+void Jit::pop(int reg) {
+	rex(false, 0, reg);
+	emit8(0x58 + (reg & 7));
+}
@@ -0,0 +1,110 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "block_cache.h"
+
+#include <cstdint>
+#include <vector>
+
+//the recompiler emits x86-64 code and needs executable memory from mmap
+#if defined(__linux__) && defined(__x86_64__)
+#define GBA_JIT
+#endif
+
+struct Registers;
+
+//x86-64 recompiler for hot blocks.
+//guest registers used by the block live in r12d-r15d, flags are taken from the host EFLAGS.
+//instructions it can't translate call the interpreter handler
+class Jit {
+public:
+	static const uint32_t HOT_THRESHOLD = 16;	//block executions before it gets compiled
+
+	Jit();
+	~Jit();
+	static bool isSupported();
+	JitCode compile(Cpu& cpu, const DecodedBlock& block);
+	void run(Cpu& cpu, JitCode code, unsigned long long endingTicks);
+	bool isFull();
+	void clear();
+	uint64_t getCompiledBlocks();
+private:
+	static const uint32_t CODE_SIZE = 0x800000;
+	static const uint32_t MAX_BLOCK_CODE = 0x8000;	//enough for MAX_BLOCK_LENGTH instructions
+
+	uint8_t* _code;
+	uint32_t _codeUsed;
+	bool _full;
+	uint64_t _compiledBlocks;
+
+	//state of the running block, read by the helpers
+	unsigned long long _endingTicks;
+	unsigned long long _fetchTicks;	//constant outside of the game pak rom
+	unsigned long long _stopTicks;	//end of the run or next event, the compiled code checks the clock against it
+	uint32_t _generation;
+	bool _thumb;
+	bool _gamePak;	//fetches go through the prefetch buffer
+
+	//block being compiled
+	uint8_t* _out;
+	int8_t _hostReg[16];	//host register holding a guest register, -1 if in memory
+	uint32_t _uses[16];	//guest register accesses, counted by the first pass
+	int32_t _cpsrOffset;
+	int32_t _shifterCarryOffset;
+	std::vector<uint8_t*> _exitJumps;
+
+	bool protect(uint8_t* start, int prot);
+	static bool next(Cpu* cpu, uint32_t pc);
+	static void interpretThumb(Cpu* cpu, const DecodedInstruction* instr);
+	static void interpretArm(Cpu* cpu, const DecodedInstruction* instr);
+
+	void emitBlock(const DecodedBlock& block, uint8_t* start);
+	void allocateRegisters();
+	bool compileThumb(uint16_t opcode);
+	bool compileArm(uint32_t opcode);
+	void callHelper(void* helper, uint64_t arg);
+	void emitFetch(uint32_t pc);
+	void writeBack();
+	void reload();
+
+	//guest register access
+	void loadGuest(int host, int guest);
+	void storeGuest(int guest, int host);
+	void storeFlags(int n, int z, int c, int v);
+	void storeConstFlags(uint32_t mask, uint32_t value);
+
+	//x86-64 encoding
+	void emit8(uint8_t b);
+	void emit32(uint32_t d);
+	void emit64(uint64_t q);
+	void rex(bool w, int reg, int rm);
+	void modrmReg(int reg, int rm);
+	void modrmMem(int reg, int base, int32_t disp);
+	void movRegReg(int dst, int src);
+	void movRegMem(int dst, int base, int32_t disp);
+	void movMemReg(int base, int32_t disp, int src);
+	void movRegImm(int dst, uint32_t imm);
+	void movMemImm(int base, int32_t disp, uint32_t imm);
+	void movMemReg8(int base, int32_t disp, int src);
+	void movMemImm8(int base, int32_t disp, uint8_t imm);
+	void movzxRegMem8(int dst, int base, int32_t disp);
+	void movzxRegReg8(int dst, int src);
+	void aluRegReg(uint8_t op, int dst, int src);
+	void aluRegImm(uint8_t digit, int dst, uint32_t imm, bool wide = false);
+	void notReg(int reg);
+	void shiftRegImm(uint8_t digit, int reg, uint8_t amount);
+	void setcc(uint8_t cc, int reg);
+	void movReg64Imm(int dst, uint64_t imm);
+	void movReg64Reg(int dst, int src);
+	void movReg64Mem(int dst, int base, int32_t disp);
+	void movMem64Reg(int base, int32_t disp, int src);
+	void aluReg64Mem(uint8_t op, int dst, int base, int32_t disp);
+	uint8_t* jumpIf(uint8_t cc);
+	uint8_t* jump();
+	void patchJump(uint8_t* jump);
+	void push(int reg);
+	void pop(int reg);
+	void exitIfFalse();
+};
+
+#endif
@@ -9,9 +9,6 @@
 #include <cstdint>
 
 LcdController::LcdController() {
-	h_cnt = 0;
-	video_cnt = 0;
-
 	DISPCNT = (dispCnt_struct *)GBA::memory.get_io_reg(0);
 	DISPSTAT = (dispStat_struct*)GBA::memory.get_io_reg(4);
 	VCOUNT = GBA::memory.get_io_reg(6);
@@ -713,9 +710,29 @@ void LcdController::transformPixelCoords(V2Int src_coords, V2Int& dst_coords, Tr
 
 }
 
-void LcdController::update_V_count(uint32_t cycles) {
-	video_cnt += cycles;
-	h_cnt = video_cnt / 4;
+//end of h-draw. scheduled by the clock every LINE_TICKS
+void LcdController::hblank() {
+	DISPSTAT->hblank_flag = 1;
+
+	if (*VCOUNT >= 160)	//nothing was drawn
+		return;
+
+	GBA::memory.trigger_dma(Dma_Trigger::HBLANK);
+	if(DISPSTAT->hblank_irq_enable)
+		GBA::irq.setHBlankFlag();	//h-blank irq
+}
+
+//end of h-blank: next scanline starts in h-draw
+void LcdController::endLine() {
+	DISPSTAT->hblank_flag = 0;
+	*VCOUNT += 1;
+
+	if (*VCOUNT >= 228) {//end of v-blank
+		*VCOUNT = 0;
+		DISPSTAT->vblank_flag = 0;	//v-draw
+		activeFrameBuffer = 1 - activeFrameBuffer;	//change frame buffer
+		memset(frameBuffers[activeFrameBuffer], 0, 240 * 160 * 4);	//clean the buffer
+	}
 
 	//v-counter irq
 	if (DISPSTAT->vcounter_irq_enable && DISPSTAT->LYC == *VCOUNT) {
@@ -730,72 +747,36 @@ void LcdController::update_V_count(uint32_t cycles) {
 				GBA::irq.setVBlankFlag();
 			GBA::memory.trigger_dma(Dma_Trigger::VBLANK);
 		}
-		if (video_cnt <= 960) {//h-draw in v-blank
-			DISPSTAT->hblank_flag = 0;
-		}
-		else {//h-blank in v-blank
-			DISPSTAT->hblank_flag = 1;
-			if (video_cnt > 1232) {	//end of h-blank
-				video_cnt %= 1232;
-				*VCOUNT += 1;
-			}
-		}
-		if (*VCOUNT >= 228) {//end of v-blank
-			*VCOUNT %= 228;
-			DISPSTAT->vblank_flag = 0;	//v-draw
-			activeFrameBuffer = 1 - activeFrameBuffer;	//change frame buffer
-			memset(frameBuffers[activeFrameBuffer], 0, 240 * 160 * 4);	//clean the buffer
-		}
 		return;
 	}
 
-	//h-draw
-	if (video_cnt <= 960) {
-		//first time in h-draw
-		if (DISPSTAT->hblank_flag) {
-			DISPSTAT->hblank_flag = 0;
-
-			//draw the current scanline
-			drawer->Wait();	//wait for the helper to finish the previous job
-
-			//sets some registers
-			drawerParams.DISPCNT = *DISPCNT;
-			drawerParams.DISPSTAT = *DISPSTAT;
-
-			drawerParams.WIN0H = *WIN0H;
-			drawerParams.WIN1H = *WIN1H;
-			drawerParams.WIN0V = *WIN0V;
-			drawerParams.WIN1V = *WIN1V;
-			drawerParams.WININ = *WININ;
-			drawerParams.WINOUT = *WINOUT;
-
-			drawerParams.vCount = *VCOUNT;
-			drawerParams.BLDALPHA = *BLDALPHA;
-			drawerParams.BLDCNT = *BLDCNT;
-			drawerParams.BLDY = *BLDY;
-			for (int i = 0; i < 4; i++) drawerParams.BGCNT[i] = BG0CNT[i];
-			for (int i = 0; i < 4; i++) drawerParams.BG_OFFSETS[i] = BG_OFFSETS[i];
-			drawerParams.GB2_REF_POINT = *GB2_REF_POINT;
-			drawerParams.GB3_REF_POINT = *GB3_REF_POINT;
-			drawerParams.BG2_TRANSF_MATRIX = *BG2_TRANSF_MATRIX;
-			drawerParams.BG3_TRANSF_MATRIX = *BG3_TRANSF_MATRIX;
-
-			drawerParams.screenBuffer = frameBuffers[activeFrameBuffer];
-			drawer->startWork(1, helperRoutine, &drawerParams);	//start the new job
-		}
-	}else {	//h-blank
-		if (!DISPSTAT->hblank_flag) {	//first time in h-blank
-			DISPSTAT->hblank_flag = 1;
-			GBA::memory.trigger_dma(Dma_Trigger::HBLANK);
-			if(DISPSTAT->hblank_irq_enable)
-				GBA::irq.setHBlankFlag();	//h-blank irq
-		}
-
-		if (video_cnt > 1232) {	//end of h-blank
-			video_cnt %= 1232;
-			*VCOUNT += 1;
-		}
-	}
+	//draw the current scanline
+	drawer->Wait();	//wait for the helper to finish the previous job
+
+	//sets some registers
+	drawerParams.DISPCNT = *DISPCNT;
+	drawerParams.DISPSTAT = *DISPSTAT;
+
+	drawerParams.WIN0H = *WIN0H;
+	drawerParams.WIN1H = *WIN1H;
+	drawerParams.WIN0V = *WIN0V;
+	drawerParams.WIN1V = *WIN1V;
+	drawerParams.WININ = *WININ;
+	drawerParams.WINOUT = *WINOUT;
+
+	drawerParams.vCount = *VCOUNT;
+	drawerParams.BLDALPHA = *BLDALPHA;
+	drawerParams.BLDCNT = *BLDCNT;
+	drawerParams.BLDY = *BLDY;
+	for (int i = 0; i < 4; i++) drawerParams.BGCNT[i] = BG0CNT[i];
+	for (int i = 0; i < 4; i++) drawerParams.BG_OFFSETS[i] = BG_OFFSETS[i];
+	drawerParams.GB2_REF_POINT = *GB2_REF_POINT;
+	drawerParams.GB3_REF_POINT = *GB3_REF_POINT;
+	drawerParams.BG2_TRANSF_MATRIX = *BG2_TRANSF_MATRIX;
+	drawerParams.BG3_TRANSF_MATRIX = *BG3_TRANSF_MATRIX;
+
+	drawerParams.screenBuffer = frameBuffers[activeFrameBuffer];
+	drawer->startWork(1, helperRoutine, &drawerParams);	//start the new job
 }
 
 
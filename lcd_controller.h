@@ -256,9 +256,13 @@ struct helperParams {
 
 class LcdController {
 public:
+	static const unsigned long long HDRAW_TICKS = 960;	//visible part of a scanline
+	static const unsigned long long LINE_TICKS = 1232;	//h-draw + h-blank
+
 	LcdController();
 	~LcdController();
-	void update_V_count(uint32_t cycles);
+	void hblank();
+	void endLine();
 	void update();
 	const uint32_t const* getBufferToRender();
 	static bool activeBg(helperParams& params, int bg_nr);
@@ -281,8 +285,6 @@ public:
 	inline static uint8_t get_bg_window_mask(helperParams& params, LayerType type, uint8_t objWindowMask, uint16_t x_coord, uint16_t y_coord);
 
 private:
-	uint32_t video_cnt;
-	uint32_t h_cnt;
 	dispCnt_struct* DISPCNT;
 	dispStat_struct* DISPSTAT;
 	uint16_t* VCOUNT;
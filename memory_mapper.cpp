@@ -9,33 +9,46 @@
 #include <stdexcept>
 
 
+//regions in _memory
+const uint32_t BIOS_OFFSET = 0;
+const uint32_t EWRAM_OFFSET = 0x4000;
+const uint32_t IWRAM_OFFSET = 0x44000;
+const uint32_t VRAM_OFFSET = 0x4c000;
+const uint32_t PALETTE_OFFSET = 0x64000;
+const uint32_t OAM_OFFSET = 0x64400;
+const uint32_t MEMORY_SIZE = 0x64800;
+
 MemoryMapper::MemoryMapper() :
-	_bios_mem(new uint8_t[0x4000]),
-	_e_wram(new uint8_t[0x40000]),
-	_i_wram(new uint8_t[0x8000]),
-	_palette_ram(new uint8_t[0x400]),
-	_vram(new uint8_t[0x18000]),
-	_oam(new uint8_t[0x400])
+	_memory(new uint8_t[MEMORY_SIZE])
 {
 	//init mem
-	memset(_bios_mem.get(), 0, 0x4000);
-	memset(_e_wram.get(), 0, 0x40000);
-	memset(_i_wram.get(), 0, 0x8000);
-	memset(_palette_ram.get(), 0, 0x400);
-	memset(_vram.get(), 0, 0x18000);
-	memset(_oam.get(), 0, 0x400);
+	memset(_memory.get(), 0, MEMORY_SIZE);
+	_palette_ram = &_memory[PALETTE_OFFSET];
+	_oam = &_memory[OAM_OFFSET];
+	useMemory(&_memory[BIOS_OFFSET], &_memory[EWRAM_OFFSET], &_memory[IWRAM_OFFSET], &_memory[VRAM_OFFSET]);
 
 	WAITCNT = (WaitCnt*)&_ioReg.WAITCNT;
+	buildIoTable();
+	_prefetch = { 0, 0, 0 };
+	_nextFetch = 0;
+	_pageGeneration = 0;
+	_logWrites = false;
+	_unloggedWrite = false;
 
 	//create DMAs objects
 	for (int i = 0; i < 4; i++) {
 		_dma[i].reset(new Dma(i));
 	}
+	_dmaRequests = 0;
+	updateDmaTriggers();
+	_fifosPlayed = 0;
 
-	fifoIndex[0] = fifoIndex[1] = 0;
-	memset(fifo, 0, sizeof(fifo));
+	_volatileAccesses = 0;
 
-	loadBios();
+	_hasBios = loadBios();
+	if (!_hasBios)
+		loadBiosStub();
+	buildPageTable();
 }
 
 MemoryMapper::~MemoryMapper() {
@@ -44,6 +57,172 @@ MemoryMapper::~MemoryMapper() {
 
 void MemoryMapper::loadRom(std::string rom_filename) {
 	_cartridge.open(rom_filename);
+	if (_fastmem.isActive() && !_fastmem.mapRom(_cartridge.getRom(), _cartridge.getRomSize())) {
+		printError(WARNING, "unable to map the rom in the fastmem arena");
+		setFastmem(false);
+	}
+	mapGamePak();
+}
+
+//move bios, wram and vram in the fastmem arena (linux only) or back to normal memory.
+//returns true if fastmem is in use
+bool MemoryMapper::setFastmem(bool enable) {
+	if (enable == _fastmem.isActive())
+		return enable;
+
+	if (enable) {
+		if (!_fastmem.create())
+			return false;
+		uint8_t* base = _fastmem.getBase();
+		if (_cartridge.getRom() != nullptr && !_fastmem.mapRom(_cartridge.getRom(), _cartridge.getRomSize())) {
+			_fastmem.destroy();
+			return false;
+		}
+		memcpy(base + 0x00000000, _bios_mem, 0x4000);
+		memcpy(base + 0x02000000, _e_wram, 0x40000);
+		memcpy(base + 0x03000000, _i_wram, 0x8000);
+		memcpy(base + 0x06000000, _vram, 0x18000);
+		useMemory(base + 0x00000000, base + 0x02000000, base + 0x03000000, base + 0x06000000);
+	}
+	else {
+		memcpy(&_memory[BIOS_OFFSET], _bios_mem, 0x4000);
+		memcpy(&_memory[EWRAM_OFFSET], _e_wram, 0x40000);
+		memcpy(&_memory[IWRAM_OFFSET], _i_wram, 0x8000);
+		memcpy(&_memory[VRAM_OFFSET], _vram, 0x18000);
+		useMemory(&_memory[BIOS_OFFSET], &_memory[EWRAM_OFFSET], &_memory[IWRAM_OFFSET], &_memory[VRAM_OFFSET]);
+		_fastmem.destroy();
+	}
+
+	buildPageTable();
+	return _fastmem.isActive();
+}
+
+bool MemoryMapper::isFastmem() {
+	return _fastmem.isActive();
+}
+
+void MemoryMapper::useMemory(uint8_t* bios, uint8_t* ewram, uint8_t* iwram, uint8_t* vram) {
+	_bios_mem = bios;
+	_e_wram = ewram;
+	_i_wram = iwram;
+	_vram = vram;
+}
+
+//map plain memory to host pointers. io, sram and unused memory are left to the slow path
+void MemoryMapper::buildPageTable() {
+	_pageGeneration++;
+	for (MemoryPage& page : _pages) {
+		page = { nullptr, 0, {0, 0, 0}, false };
+	}
+	_arena = nullptr;
+	for (const int*& timings : _arenaTimings) {
+		timings = nullptr;
+	}
+
+	mapPages(0x05000000, 0x06000000, _palette_ram, 0x400, accessTimings[5], true);
+	mapPages(0x07000000, 0x08000000, _oam, 0x400, accessTimings[3], true);
+
+	if (_fastmem.isActive()) {	//the mirrors are already mapped by the host
+		mapArena(0x00000000, 0x00004000, accessTimings[0]);
+		mapArena(0x02000000, 0x03000000, accessTimings[4]);
+		mapArena(0x03000000, 0x04000000, accessTimings[1]);
+		mapArena(0x06000000, 0x07000000, accessTimings[6]);
+		mapGamePak();
+
+		//wram and vram fill their whole 16MB region: reads and writes skip the page table
+		_arena = _fastmem.getBase();
+		_arenaTimings[0x2] = accessTimings[4];
+		_arenaTimings[0x3] = accessTimings[1];
+		_arenaTimings[0x6] = accessTimings[6];
+		return;
+	}
+
+	mapPages(0x00000000, 0x00004000, _bios_mem, 0x4000, accessTimings[0], true);
+	mapPages(0x02000000, 0x03000000, _e_wram, 0x40000, accessTimings[4], true);
+	mapPages(0x03000000, 0x04000000, _i_wram, 0x8000, accessTimings[1], true);
+
+	//vram mirrors every 128k, the last 32k mirror the previous 32k
+	for (uint32_t address = 0x06000000; address < 0x07000000; address += 0x20000) {
+		mapPages(address, address + 0x18000, _vram, 0x18000, accessTimings[6], true);
+		mapPages(address + 0x18000, address + 0x20000, _vram + 0x10000, 0x8000, accessTimings[6], true);
+	}
+
+	mapGamePak();
+}
+
+//precompute the game pak access ticks from WAITCNT
+void MemoryMapper::buildGamePakTimings() {
+	const int firstAccess[3] = { WAITCNT->WS0_fa, WAITCNT->WS1_fa, WAITCNT->WS2_fa };
+	const int secondAccess[3] = { WAITCNT->WS0_sa, WAITCNT->WS1_sa, WAITCNT->WS2_sa };
+
+	for (int waitState = 0; waitState < 3; waitState++) {
+		int n = 1 + waitcntAccessTimings[waitState * 2][firstAccess[waitState]];
+		int s = 1 + waitcntAccessTimings[waitState * 2 + 1][secondAccess[waitState]];
+		//game pak bus is only 16 bit wide: a 32 bit access is followed by a sequential one
+		_gamePakTimings[waitState] = { { (uint8_t)n, (uint8_t)n, (uint8_t)(n + s) }, { (uint8_t)s, (uint8_t)s, (uint8_t)(s * 2) } };
+	}
+
+	int sram = waitcntAccessTimings[6][WAITCNT->sram];	//no sequential accesses on the sram bus
+	uint8_t sramTimings[3] = { (uint8_t)(1 + sram), (uint8_t)(1 + sram), (uint8_t)(1 + sram * 2) };
+	_gamePakTimings[3] = { { sramTimings[0], sramTimings[1], sramTimings[2] }, { sramTimings[0], sramTimings[1], sramTimings[2] } };
+}
+
+//map the rom pages of the three wait states. called when the rom or WAITCNT change
+void MemoryMapper::mapGamePak() {
+	uint8_t* rom = _cartridge.getRom();
+	uint32_t romSize = rom != nullptr ? _cartridge.getRomSize() : 0;
+
+	buildGamePakTimings();
+	_pageGeneration++;
+
+	for (int waitState = 0; waitState < 3; waitState++) {
+		const uint8_t* timings = _gamePakTimings[waitState].nonSequential;
+
+		uint32_t start = 0x08000000 + waitState * 0x02000000;
+		for (uint32_t offset = 0; offset < 0x02000000; offset += PAGE_SIZE) {
+			MemoryPage& page = _pages[(start + offset) >> PAGE_BITS];
+			if (offset + PAGE_SIZE > romSize) {	//open bus
+				page = { nullptr, 0, {0, 0, 0}, false };
+				continue;
+			}
+			if (_fastmem.isActive())
+				page = { _fastmem.getBase(), 0xffffffff, { timings[0], timings[1], timings[2] }, false };
+			else
+				page = { rom + offset, PAGE_SIZE - 1, { timings[0], timings[1], timings[2] }, false };
+		}
+	}
+}
+
+//pages in the fastmem arena are indexed by the full address
+void MemoryMapper::mapArena(uint32_t start, uint32_t end, const int* timings) {
+	for (uint32_t address = start; address < end; address += PAGE_SIZE) {
+		MemoryPage& page = _pages[address >> PAGE_BITS];
+		page.memory = _fastmem.getBase();
+		page.mask = 0xffffffff;
+		page.writable = true;
+		for (int i = 0; i < 3; i++) {
+			page.accessTimings[i] = timings[i];
+		}
+	}
+}
+
+//map [start, end) to a memory of the given size, mirrored to fill the range
+void MemoryMapper::mapPages(uint32_t start, uint32_t end, uint8_t* memory, uint32_t size, const int* timings, bool writable) {
+	for (uint32_t address = start; address < end; address += PAGE_SIZE) {
+		MemoryPage& page = _pages[address >> PAGE_BITS];
+		page.writable = writable;
+		for (int i = 0; i < 3; i++) {
+			page.accessTimings[i] = timings[i];
+		}
+		if (size < PAGE_SIZE) {	//the whole page is a mirror of the memory
+			page.memory = memory;
+			page.mask = size - 1;
+		}
+		else {
+			page.memory = memory + (address - start) % size;
+			page.mask = PAGE_SIZE - 1;
+		}
+	}
 }
 
 bool MemoryMapper::saveState() {
@@ -52,35 +231,71 @@ bool MemoryMapper::saveState() {
 	return ret;
 }
 
-void MemoryMapper::loadBios() {
+bool MemoryMapper::loadBios() {
 	std::ifstream biosFile;
 
 	biosFile.open("gba_bios.bin", std::ios::binary);
 
 	if (!biosFile.is_open()) {
-		std::cout << " Error: unable to open gba_bios.bin file." << std::endl;
-		exit(0);
+		printError(WARNING, "unable to open gba_bios.bin file, using the hle bios");
+		return false;
 	}
 
 	biosFile.seekg(0, biosFile.end);
 	uint32_t size = biosFile.tellg();
 
 	if (size != 0x4000) {
-		std::cout << " Error: gba_bios.bin has an invalid size." << std::endl;
-		exit(0);
+		printError(WARNING, "gba_bios.bin has an invalid size, using the hle bios");
+		return false;
 	}
 
 	biosFile.seekg(0, biosFile.beg);
 
-	biosFile.read((char *)_bios_mem.get(), 0x4000);
+	biosFile.read((char *)_bios_mem, 0x4000);
 	biosFile.close();
+	return true;
+}
+
+//without a bios image: the irq vector calls the game handler at 0x03fffffc. there is no
+//swi vector, the cpu stops on the calls that the hle bios doesn't implement
+void MemoryMapper::loadBiosStub() {
+	const uint32_t irqVector[] = {
+		0xe92d500f,	//stmfd sp!, {r0-r3, r12, lr}
+		0xe3a00301,	//mov r0, #0x04000000
+		0xe28fe000,	//add lr, pc, #0
+		0xe510f004,	//ldr pc, [r0, #-4]
+		0xe8bd500f,	//ldmfd sp!, {r0-r3, r12, lr}
+		0xe25ef004	//subs pc, lr, #4
+	};
+
+	memset(_bios_mem, 0, 0x4000);
+	memcpy(&_bios_mem[0x18], irqVector, sizeof(irqVector));
+}
+
+//false if the bios is the hle stub
+bool MemoryMapper::hasBios() {
+	return _hasBios;
 }
 
 uint8_t MemoryMapper::read_8(uint32_t address) {
+	const int* timings = findArena(address);
+
+	if (timings != nullptr) {	//fastmem
+		GBA::clock.addTicks(timings[0]);
+		return _arena[address];
+	}
+
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr) {	//plain memory
+		GBA::clock.addTicks(page->accessTimings[0]);
+		return page->memory[address & page->mask];
+	}
+
 	gamePakAddr s;
 
 	if ((s = inCartridge(address)).inGamePak) {
-		GBA::clock.addTicks(1 + s.accessTiming);
+		GBA::clock.addTicks(s.accessTimings[0]);
 		return _cartridge.read_8(address);
 	}
 	realAddress addr = find_memory_addr(address);
@@ -90,14 +305,31 @@ uint8_t MemoryMapper::read_8(uint32_t address) {
 
 	GBA::clock.addTicks(addr.accessTimings[0]);
 
+	if (addr.memory == (uint8_t*)&_ioReg)
+		syncIo(addr.addr);
+
 	return addr.memory[addr.addr];
 }
 
 uint16_t MemoryMapper::read_16(uint32_t address) {
+	const int* timings = findArena(address);
+
+	if (timings != nullptr) {	//fastmem
+		GBA::clock.addTicks(timings[1]);
+		return *(uint16_t*)&_arena[address];
+	}
+
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr) {	//plain memory
+		GBA::clock.addTicks(page->accessTimings[1]);
+		return *(uint16_t*)&page->memory[address & page->mask];
+	}
+
 	gamePakAddr s;
 
 	if ((s = inCartridge(address)).inGamePak) {
-		GBA::clock.addTicks(1 + s.accessTiming);
+		GBA::clock.addTicks(s.accessTimings[1]);
 		return _cartridge.read_16(address);
 	}
 	realAddress addr = find_memory_addr(address);
@@ -107,14 +339,31 @@ uint16_t MemoryMapper::read_16(uint32_t address) {
 
 	GBA::clock.addTicks(addr.accessTimings[1]);
 
+	if (addr.memory == (uint8_t*)&_ioReg)
+		syncIo(addr.addr);
+
 	return *(uint16_t*)&addr.memory[addr.addr];
 }
 
 uint32_t MemoryMapper::read_32(uint32_t address) {
+	const int* timings = findArena(address);
+
+	if (timings != nullptr) {	//fastmem
+		GBA::clock.addTicks(timings[2]);
+		return *(uint32_t*)&_arena[address];
+	}
+
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr) {	//plain memory
+		GBA::clock.addTicks(page->accessTimings[2]);
+		return *(uint32_t*)&page->memory[address & page->mask];
+	}
+
 	gamePakAddr s;
 
 	if ((s = inCartridge(address)).inGamePak) {
-		GBA::clock.addTicks(1 + s.accessTiming * 2);	//game pak bus is only 16 bit wide
+		GBA::clock.addTicks(s.accessTimings[2]);
 		return _cartridge.read_32(address);
 	}
 	realAddress addr = find_memory_addr(address);
@@ -124,14 +373,258 @@ uint32_t MemoryMapper::read_32(uint32_t address) {
 
 	GBA::clock.addTicks(addr.accessTimings[2]);
 
+	if (addr.memory == (uint8_t*)&_ioReg)
+		syncIo(addr.addr);
+
+	return *(uint32_t*)&addr.memory[addr.addr];
+}
+
+//read without advancing the clock. used to decode instructions ahead of execution
+uint8_t MemoryMapper::peek_8(uint32_t address) {
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr)
+		return page->memory[address & page->mask];
+
+	if (inCartridge(address).inGamePak)
+		return _cartridge.read_8(address);
+
+	realAddress addr = find_memory_addr(address);
+
+	if (addr.memory == nullptr)
+		return 0;
+
+	return addr.memory[addr.addr];
+}
+
+uint16_t MemoryMapper::peek_16(uint32_t address) {
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr)
+		return *(uint16_t*)&page->memory[address & page->mask];
+
+	if (inCartridge(address).inGamePak)
+		return _cartridge.read_16(address);
+
+	realAddress addr = find_memory_addr(address);
+
+	if (addr.memory == nullptr)
+		return 0;
+
+	return *(uint16_t*)&addr.memory[addr.addr];
+}
+
+uint32_t MemoryMapper::peek_32(uint32_t address) {
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr)
+		return *(uint32_t*)&page->memory[address & page->mask];
+
+	if (inCartridge(address).inGamePak)
+		return _cartridge.read_32(address);
+
+	realAddress addr = find_memory_addr(address);
+
+	if (addr.memory == nullptr)
+		return 0;
+
 	return *(uint32_t*)&addr.memory[addr.addr];
 }
 
+//host memory of a load/store multiple: words ascending from address. nullptr if they are not
+//all in one plain ram page, the transfer goes through read_32/write_32 then.
+//the ticks of the whole transfer are added here
+uint32_t* MemoryMapper::transferBlock(uint32_t address, uint32_t words, bool write) {
+	MemoryPage* page = findPage(address);
+	uint32_t last = address + words * 4 - 1;
+
+	if (page == nullptr || !page->writable || words == 0 || (address & 3)
+		|| (address >> PAGE_BITS) != (last >> PAGE_BITS) || (address & page->mask) > (last & page->mask))	//page end or mirror wrap
+		return nullptr;
+
+	GBA::clock.addTicks(page->accessTimings[2] * words);
+
+	if (write && _logWrites)
+		logWrite(page, address, words * 4);
+
+	if (write) {	//self modifying code, the block spans at most two code pages
+		GBA::cpu.invalidateCode(address);
+		GBA::cpu.invalidateCode(last);
+	}
+	return (uint32_t*)&page->memory[address & page->mask];
+}
+
+//host memory behind [address, address + size) when it's plain memory, contiguous in the host too.
+//nullptr for io, sram, open bus, mirror wraps or pages that are not next to each other
+uint8_t* MemoryMapper::hostRange(uint32_t address, uint32_t size, bool write) {
+	MemoryPage* page = findPage(address);
+	uint32_t last = address + size - 1;
+
+	if (page == nullptr || size == 0 || last < address)
+		return nullptr;
+
+	uint8_t* host = &page->memory[address & page->mask];
+	for (uint32_t start = address; ; start = (start | (PAGE_SIZE - 1)) + 1) {
+		uint32_t end = (start | (PAGE_SIZE - 1)) < last ? start | (PAGE_SIZE - 1) : last;
+		page = findPage(start);
+		if (page == nullptr || (write && !page->writable) || &page->memory[start & page->mask] != host + (start - address)
+			|| (end & page->mask) - (start & page->mask) != end - start)
+			return nullptr;
+		if (end == last)
+			return host;
+	}
+}
+
+//host memory from hostRange is about to be written: log it and mark the code decoded from it stale
+void MemoryMapper::prepareHostWrite(uint32_t address, uint8_t* host, uint32_t size) {
+	if (_logWrites) {
+		for (uint32_t i = 0; i < size; i++) {
+			_writeLog.push_back({ address + i, host[i] });
+		}
+	}
+
+	uint32_t last = address + size - 1;
+	for (uint32_t page = address & ~(BlockCache::PAGE_SIZE - 1); page <= last && page >= (address & ~(BlockCache::PAGE_SIZE - 1)); page += BlockCache::PAGE_SIZE) {
+		GBA::cpu.invalidateCode(page);
+	}
+}
+
+//ticks of consecutive 16 or 32 bit accesses from address up: the game pak only pays the first access once
+int MemoryMapper::burstTicks(uint32_t address, uint32_t units, uint32_t unitSize) {
+	int width = unitSize == 2 ? 1 : 2;
+	int ticks = 0;
+
+	for (uint32_t start = address; units > 0; ) {
+		uint32_t inPage = (PAGE_SIZE - (start & (PAGE_SIZE - 1))) / unitSize;
+		if (inPage > units)
+			inPage = units;
+
+		if (isGamePakRom(start)) {
+			const GamePakTimings& timings = _gamePakTimings[(start >> 25) - 4];
+			ticks += inPage * timings.sequential[width];
+			if (start == address)
+				ticks += timings.nonSequential[width] - timings.sequential[width];
+		}
+		else {
+			MemoryPage* page = findPage(start);
+			if (page != nullptr)
+				ticks += inPage * page->accessTimings[width];
+		}
+		start += inPage * unitSize;
+		units -= inPage;
+	}
+	return ticks;
+}
+
+//contiguous host memory around address: the page, or the mirror inside it for small memories
+FetchWindow MemoryMapper::getFetchWindow(uint32_t address) {
+	MemoryPage* page = findPage(address);
+
+	if (page == nullptr)
+		return { nullptr, address, 0, {0, 0, 0}, _pageGeneration };
+
+	uint32_t size = page->mask < PAGE_SIZE - 1 ? page->mask + 1 : PAGE_SIZE;
+	uint32_t start = address & ~(size - 1);
+	return { &page->memory[start & page->mask], start, size,
+		{ page->accessTimings[0], page->accessTimings[1], page->accessTimings[2] }, _pageGeneration };
+}
+
+//ticks to fetch an instruction. in the game pak rom a fetch right after the previous one is
+//sequential, and it updates the prefetch buffer: the ticks must be added to the clock
+int MemoryMapper::fetchTicks(uint32_t address, bool thumb) {
+	if (isGamePakRom(address)) {
+		const GamePakTimings& timings = _gamePakTimings[(address >> 25) - 4];
+		bool sequential = address == _nextFetch && (address & 0x1ffff) != 0;	//the game pak restarts on 128k boundaries
+		_nextFetch = address + (thumb ? 2 : 4);
+		if (WAITCNT->GB_prefetch)
+			return prefetchTicks(address, thumb ? 1 : 2, sequential, timings);
+		return sequential ? timings.sequential[thumb ? 1 : 2] : timings.nonSequential[thumb ? 1 : 2];
+	}
+
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr)
+		return page->accessTimings[thumb ? 1 : 2];
+
+	gamePakAddr s;
+
+	if ((s = inCartridge(address)).inGamePak)
+		return s.accessTimings[thumb ? 1 : 2];
+
+	realAddress addr = find_memory_addr(address);
+
+	if (addr.memory == nullptr)
+		return 0;
+
+	return addr.accessTimings[thumb ? 1 : 2];
+}
+
+//fetch through the prefetch buffer: it loads a halfword every sequential access time
+//since the last fetch, a hit costs a single tick. a branch restarts it at the new address
+int MemoryMapper::prefetchTicks(uint32_t address, int halfwords, bool sequential, const GamePakTimings& timings) {
+	unsigned long long now = GBA::clock.getTicks();
+	int halfwordTicks = timings.sequential[1];
+
+	if (now < _prefetch.ticks)	//clock reset
+		_prefetch.ticks = now;
+
+	unsigned long long loaded = (now - _prefetch.ticks) / halfwordTicks;
+	if (_prefetch.count + loaded >= PREFETCH_SIZE) {	//full, it stops until the cpu reads it
+		_prefetch.count = PREFETCH_SIZE;
+		_prefetch.ticks = now;
+	}
+	else {
+		_prefetch.count += (uint32_t)loaded;
+		_prefetch.ticks += loaded * halfwordTicks;
+	}
+
+	if (!sequential || address != _prefetch.address) {	//miss
+		int ticks = timings.nonSequential[halfwords];
+		_prefetch = { address + halfwords * 2, 0, now + ticks };
+		return ticks;
+	}
+
+	_prefetch.address += halfwords * 2;
+	if (_prefetch.count >= (uint32_t)halfwords) {	//hit
+		_prefetch.count -= halfwords;
+		return 1;
+	}
+
+	//wait for the halfwords still loading
+	int ticks = (int)((halfwords - _prefetch.count) * halfwordTicks - (now - _prefetch.ticks));
+	_prefetch.count = 0;
+	_prefetch.ticks = now + ticks;
+	return ticks;
+}
+
 void MemoryMapper::write_8(uint32_t address, uint8_t data) {
+	const int* timings = findArena(address);
+
+	if (timings != nullptr && !_logWrites) {	//fastmem
+		GBA::clock.addTicks(timings[0]);
+		GBA::cpu.invalidateCode(address);	//self modifying code
+		_arena[address] = data;
+		return;
+	}
+
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr && page->writable) {	//plain memory
+		GBA::clock.addTicks(page->accessTimings[0]);
+		if (_logWrites)
+			logWrite(page, address, 1);
+		GBA::cpu.invalidateCode(address);	//self modifying code
+		page->memory[address & page->mask] = data;
+		return;
+	}
+
+	if (_logWrites)	//io, sram and rom writes can't be undone
+		_unloggedWrite = true;
+
 	gamePakAddr s;
 
 	if ((s = inCartridge(address)).inGamePak) {
-		GBA::clock.addTicks(1 + s.accessTiming);
+		GBA::clock.addTicks(s.accessTimings[0]);
 		_cartridge.write_8(address, data);
 		return;
 	}
@@ -143,18 +636,43 @@ void MemoryMapper::write_8(uint32_t address, uint8_t data) {
 	GBA::clock.addTicks(addr.accessTimings[0]);
 
 	if (addr.memory == (uint8_t*)&_ioReg) {	//register
-		write_register(addr.addr, addr.memory[addr.addr], data);
+		syncIo(addr.addr);
+		writeIo(addr.addr, data, 1);
 		return;
 	}
 
+	GBA::cpu.invalidateCode(address);	//self modifying code
 	addr.memory[addr.addr] = data;
 }
 
 void MemoryMapper::write_16(uint32_t address, uint16_t data) {
+	const int* timings = findArena(address);
+
+	if (timings != nullptr && !_logWrites) {	//fastmem
+		GBA::clock.addTicks(timings[1]);
+		GBA::cpu.invalidateCode(address);	//self modifying code
+		*(uint16_t*)&_arena[address] = data;
+		return;
+	}
+
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr && page->writable) {	//plain memory
+		GBA::clock.addTicks(page->accessTimings[1]);
+		if (_logWrites)
+			logWrite(page, address, 2);
+		GBA::cpu.invalidateCode(address);	//self modifying code
+		*(uint16_t*)&page->memory[address & page->mask] = data;
+		return;
+	}
+
+	if (_logWrites)	//io, sram and rom writes can't be undone
+		_unloggedWrite = true;
+
 	gamePakAddr s;
 
 	if ((s = inCartridge(address)).inGamePak) {
-		GBA::clock.addTicks(1 + s.accessTiming);
+		GBA::clock.addTicks(s.accessTimings[1]);
 		_cartridge.write_16(address, data);
 		return;
 	}
@@ -166,18 +684,43 @@ void MemoryMapper::write_16(uint32_t address, uint16_t data) {
 	GBA::clock.addTicks(addr.accessTimings[1]);
 
 	if (addr.memory == (uint8_t*)&_ioReg) {	//register
-		write_register(addr.addr, *(uint16_t*)(&addr.memory[addr.addr]), data);
+		syncIo(addr.addr);
+		writeIo(addr.addr, data, 2);
 		return;
 	}
 
+	GBA::cpu.invalidateCode(address);	//self modifying code
 	*(uint16_t*)&addr.memory[addr.addr] = data;
 }
 
 void MemoryMapper::write_32(uint32_t address, uint32_t data) {
+	const int* timings = findArena(address);
+
+	if (timings != nullptr && !_logWrites) {	//fastmem
+		GBA::clock.addTicks(timings[2]);
+		GBA::cpu.invalidateCode(address);	//self modifying code
+		*(uint32_t*)&_arena[address] = data;
+		return;
+	}
+
+	MemoryPage* page = findPage(address);
+
+	if (page != nullptr && page->writable) {	//plain memory
+		GBA::clock.addTicks(page->accessTimings[2]);
+		if (_logWrites)
+			logWrite(page, address, 4);
+		GBA::cpu.invalidateCode(address);	//self modifying code
+		*(uint32_t*)&page->memory[address & page->mask] = data;
+		return;
+	}
+
+	if (_logWrites)	//io, sram and rom writes can't be undone
+		_unloggedWrite = true;
+
 	gamePakAddr s;
 
 	if ((s = inCartridge(address)).inGamePak) {
-		GBA::clock.addTicks(1 + s.accessTiming * 2);	//game pak bus is only 16 bit wide
+		GBA::clock.addTicks(s.accessTimings[2]);
 		_cartridge.write_32(address, data);
 		return;
 	}
@@ -189,10 +732,12 @@ void MemoryMapper::write_32(uint32_t address, uint32_t data) {
 	GBA::clock.addTicks(addr.accessTimings[2]);
 
 	if (addr.memory == (uint8_t*)&_ioReg) {	//register
-		write_register(addr.addr, *(uint32_t*)(&addr.memory[addr.addr]), data);
+		syncIo(addr.addr);
+		writeIo(addr.addr, data, 4);
 		return;
 	}
 
+	GBA::cpu.invalidateCode(address);	//self modifying code
 	*(uint32_t*)&addr.memory[addr.addr] = data;
 }
 
@@ -214,65 +759,69 @@ void MemoryMapper::setKeyInput(keyinput_struct input) {
 	_ioReg.KEYINPUT.l = 1 - input.l;
 }
 
+//next 4 samples of a fifo, the first one in the low byte
 uint32_t MemoryMapper::getFifo(uint8_t ch) {
-
-	uint8_t dma = 0;
-	if (_ioReg.DMA1DAD == (0x40000A0 + ch * 4)) {
-		dma = 1;
-	}
-	else {
-		dma = 2;
+	uint32_t word = 0;
+	_fifosPlayed |= 1 << (ch & 1);
+	for (int i = 0; i < 4; i++) {
+		word |= (uint32_t)(uint8_t)_soundFifos[ch & 1].pop() << (i * 8);
 	}
+	return word;
+}
 
-	if (fifoIndex[ch & 1] <= 4) {
-		_dma[dma]->trigger(FIFO);
-	}
+int8_t MemoryMapper::getFifoSample(uint8_t ch) {
+	_fifosPlayed |= 1 << (ch & 1);
+	return _soundFifos[ch & 1].pop();
+}
 
-	if(fifoIndex[ch & 1] == 0)
-		return 0;
+void MemoryMapper::writeFifo(uint32_t val, uint8_t ch) {
+	_soundFifos[ch & 1].push(val);
+}
 
-	uint32_t firstOut = fifo[ch & 1][0];
-	
-	for (int i = 1; i < fifoIndex[ch & 1]; i++) {
-		fifo[ch & 1][i - 1] = fifo[ch & 1][i];
-	}
+//called with the sound event, once the fifo timers are up to date: the fifos played since the last
+//one that are half empty ask their dma for 4 words, instead of checking on every sample
+void MemoryMapper::refillFifos() {
+	uint8_t played = _fifosPlayed;
+	_fifosPlayed = 0;
 
-	fifoIndex[ch & 1]--;
+	for (uint8_t ch = 0; ch < 2; ch++) {
+		if (!(played & (1 << ch)) || _soundFifos[ch].size() > SoundFifo::REFILL_LEVEL)
+			continue;
 
-	return firstOut;
+		uint8_t dma = _ioReg.DMA1DAD == (0x40000A0 + ch * 4u) ? 1 : 2;
+		if (_dmaTriggers[FIFO] & (1 << dma))
+			requestDma(dma);
+	}
 }
 
-void MemoryMapper::writeFifo(uint32_t val, uint8_t ch) {
-	if (fifoIndex[ch & 1] == 8)
-		return;
-
-	fifo[ch][fifoIndex[ch & 1]] = val;
-	fifoIndex[ch & 1]++;
+//occupancy and underruns of fifo a (0) or b (1)
+const SoundFifo& MemoryMapper::getSoundFifo(uint8_t ch) {
+	return _soundFifos[ch & 1];
 }
 
 uint8_t* MemoryMapper::getMemoryAddr(int chunk) {
 
 	switch (chunk) {
 	case 0:
-		return _bios_mem.get();
+		return _bios_mem;
 		break;
 	case 2:
-		return _e_wram.get();
+		return _e_wram;
 		break; 
 	case 3:
-		return _i_wram.get();
+		return _i_wram;
 		break;
 	case 4:
 		return (uint8_t *)&_ioReg;
 		break;
 	case 5:
-		return _palette_ram.get();
+		return _palette_ram;
 		break;
 	case 6:
-		return _vram.get();
+		return _vram;
 		break;
 	case 7:
-		return _oam.get();
+		return _oam;
 		break;
 	default:
 		return nullptr;
@@ -293,7 +842,7 @@ realAddress MemoryMapper::find_memory_addr(uint32_t gba_address) {
 		if (localAddr > 0x3fff)
 			return { nullptr, 0, nullptr };	//avoid out of bound memory access
 
-		return { _bios_mem.get(), localAddr, accessTimings[0] };
+		return { _bios_mem, localAddr, accessTimings[0] };
 		break;
 	}
 	case 1:	//invalid memory
@@ -306,12 +855,12 @@ realAddress MemoryMapper::find_memory_addr(uint32_t gba_address) {
 		if (localAddr > 0x3ffff)
 			printError(CRITICAL_ERROR, "trying to access out of bound memory");
 #endif
-		return { _e_wram.get(), localAddr & 0x3ffff, accessTimings[4] };
+		return { _e_wram, localAddr & 0x3ffff, accessTimings[4] };
 		break;
 	}		
 	case 3:		//internal wram
 	{
-		return { _i_wram.get(), localAddr & 0x7fff, accessTimings[1] };
+		return { _i_wram, localAddr & 0x7fff, accessTimings[1] };
 		break;
 	}
 	case 4:	//io registers
@@ -336,7 +885,7 @@ realAddress MemoryMapper::find_memory_addr(uint32_t gba_address) {
 		if (localAddr > 0x3ff)
 			printError(CRITICAL_ERROR, "trying to access out of bound memory");
 #endif
-		return { _palette_ram.get(), localAddr & 0x3ff, accessTimings[5] };
+		return { _palette_ram, localAddr & 0x3ff, accessTimings[5] };
 		break;
 	}
 	case 6:	//vram
@@ -345,7 +894,7 @@ realAddress MemoryMapper::find_memory_addr(uint32_t gba_address) {
 		if (localAddr > 0x17fff) {	//last 32k mirrors the previous 32k
 			localAddr = 0x10000 /* 64k */ + (localAddr & 0x7fff)/* mirror of used 32k */;
 		}
-		return { _vram.get(), localAddr, accessTimings[6] };
+		return { _vram, localAddr, accessTimings[6] };
 		break;
 	}
 	case 7:	//oam
@@ -354,7 +903,7 @@ realAddress MemoryMapper::find_memory_addr(uint32_t gba_address) {
 		if (localAddr > 0x3ff)
 			printError(CRITICAL_ERROR, "trying to access out of bound memory");
 #endif
-		return { _oam.get(), localAddr & 0x3ff, accessTimings[3] };
+		return { _oam, localAddr & 0x3ff, accessTimings[3] };
 		break;
 	}
 	default:	//invalid memory
@@ -376,11 +925,11 @@ gamePakAddr MemoryMapper::inCartridge(uint32_t gba_address) {
 	case 0xd:
 	{
 		int waitSate = (mem_chunk - 8) / 2;
-		return { true, waitcntAccessTimings[waitSate * 2][WAITCNT->WS0_fa] };
+		return { true, _gamePakTimings[waitSate].nonSequential };
 		break;
 	}
 	case 0xe:	//game pak sram
-		return { true,  waitcntAccessTimings[6][WAITCNT->sram] };
+		return { true, _gamePakTimings[3].nonSequential };
 		break;
 
 	default:	//invalid memory
@@ -391,120 +940,216 @@ gamePakAddr MemoryMapper::inCartridge(uint32_t gba_address) {
 	return { false, 0 };
 }
 
-//send a trigger to all DMAs
+//read handler of the register, before the game reads or writes it
+void MemoryMapper::syncIo(uint32_t offset) {
+	if (offset >= 0x400)
+		return;
+
+	IoReadHandler read = _ioRegisters[offset / 2].read;
+	if (read != nullptr)
+		(this->*read)(offset);
+}
+
+//changes every time the game touches a sound or timer register
+uint32_t MemoryMapper::getVolatileAccesses() {
+	return _volatileAccesses;
+}
+
+//record the plain memory writes from now on, to undo them with rollbackWrites
+void MemoryMapper::beginWriteLog() {
+	_writeLog.clear();
+	_logWrites = true;
+	_unloggedWrite = false;
+	_loggedPrefetch = _prefetch;
+	_loggedNextFetch = _nextFetch;
+}
+
+//false if something was written that the log can't undo
+bool MemoryMapper::endWriteLog() {
+	_logWrites = false;
+	return !_unloggedWrite;
+}
+
+const std::vector<LoggedWrite>& MemoryMapper::getWriteLog() {
+	return _writeLog;
+}
+
+//restore the logged bytes and the fetch state as they were when the log started
+void MemoryMapper::rollbackWrites() {
+	for (auto it = _writeLog.rbegin(); it != _writeLog.rend(); ++it) {
+		MemoryPage* page = findPage(it->address);
+		GBA::cpu.invalidateCode(it->address);
+		page->memory[it->address & page->mask] = it->old;
+	}
+	_writeLog.clear();
+	_prefetch = _loggedPrefetch;
+	_nextFetch = _loggedNextFetch;
+}
+
+void MemoryMapper::logWrite(MemoryPage* page, uint32_t address, uint32_t size) {
+	for (uint32_t i = 0; i < size; i++) {
+		_writeLog.push_back({ address + i, page->memory[(address + i) & page->mask] });
+	}
+}
+
+//send a trigger to the DMAs waiting for it
 void MemoryMapper::trigger_dma(Dma_Trigger type) {
 	for (int i = 0; i < 4; i++) {
-		_dma[i]->trigger(type);
+		if (_dmaTriggers[type] & (1 << i))
+			requestDma(i);
 	}
 }
 
-void MemoryMapper::write_register(uint32_t gba_addr,
-	uint8_t& real_mem, uint8_t data) {
-	if (gba_addr > 0x3fe)
+//a triggered channel starts after the dma latency. a channel already requested ignores the trigger
+void MemoryMapper::requestDma(int channel) {
+	if (_dmaRequests & (1 << channel))
 		return;
 
-	switch (gba_addr) {
-	case 0x202:	//clear interrupt flag
-	case 0x203:
-		real_mem &= ~data;
-		break;
-	default:
-		real_mem = data;
-		break;
+	_dma[channel]->load_on_repeat();
+	_dmaRequests |= 1 << channel;
+	if (!GBA::clock.isScheduled(EVENT_DMA))
+		GBA::clock.schedule(EVENT_DMA, GBA::clock.getTicks() + Dma::START_TICKS);
+}
+
+//dma event: the cpu is stalled while the requested channels run, highest priority first. a transfer
+//stops when an event that can trigger a dma is due, a channel it triggers then preempts the one that was running
+void MemoryMapper::runDma() {
+	while (_dmaRequests != 0) {
+		int channel = 0;
+		while (!(_dmaRequests & (1 << channel)))
+			channel++;
+
+		bool fifoPreempts = (_dmaTriggers[FIFO] & ((1 << channel) - 1)) != 0;
+		if (!_dma[channel]->run(GBA::clock.getDmaDeadline(fifoPreempts))) {
+			GBA::clock.schedule(EVENT_DMA, GBA::clock.getTicks());
+			return;
+		}
+		_dmaRequests &= ~(1 << channel);
+		updateDmaTriggers();	//the channel may be disabled now
 	}
 }
 
-void MemoryMapper::write_register(uint32_t gba_addr, 
-	uint16_t &real_mem, uint16_t data) {
-	if (gba_addr > 0x3fe)
+void MemoryMapper::updateDmaTriggers() {
+	memset(_dmaTriggers, 0, sizeof(_dmaTriggers));
+	for (int i = 0; i < 4; i++) {
+		_dmaTriggers[_dma[i]->getTrigger()] |= 1 << i;
+	}
+	_dmaTriggers[EMPTY_TRIGGER] = 0;
+}
+
+//registers with side effects, the others are a masked store
+void MemoryMapper::buildIoTable() {
+	for (IoRegister& reg : _ioRegisters) {
+		reg = { nullptr, nullptr, 0xffff, nullptr };
+	}
+
+	_ioRegisters[0x004 / 2].writeMask = 0xff38;	//dispstat: the status bits are read only
+	_ioRegisters[0x006 / 2].writeMask = 0;	//vcount
+	_ioRegisters[0x130 / 2].writeMask = 0;	//keyinput
+
+	//the fifo timers only see the elapsed ticks every few cycles:
+	//catch them up before the game touches a sound or timer register
+	for (uint32_t offset = 0x60; offset < 0xb0; offset += 2) {
+		_ioRegisters[offset / 2].read = &MemoryMapper::syncVolatile;
+	}
+	for (uint32_t offset = 0x100; offset < 0x110; offset += 2) {
+		_ioRegisters[offset / 2].read = &MemoryMapper::syncVolatile;
+	}
+
+	_ioRegisters[0x084 / 2].sideEffect = &MemoryMapper::writeSoundMaster;
+	_ioRegisters[0x0a2 / 2].sideEffect = &MemoryMapper::writeFifoHigh;	//fifo a
+	_ioRegisters[0x0a6 / 2].sideEffect = &MemoryMapper::writeFifoHigh;	//fifo b
+	for (uint32_t offset = 0xba; offset <= 0xde; offset += 12) {	//dma 0-3 control
+		_ioRegisters[offset / 2].sideEffect = &MemoryMapper::writeDmaControl;
+	}
+	_ioRegisters[0x202 / 2].write = &MemoryMapper::writeIF;
+	_ioRegisters[0x204 / 2].sideEffect = &MemoryMapper::writeWaitcnt;
+	_ioRegisters[0x300 / 2].sideEffect = &MemoryMapper::writeHaltcnt;
+}
+
+//io write of 1, 2 or 4 bytes, split in the halfword registers it covers
+void MemoryMapper::writeIo(uint32_t offset, uint32_t data, int size) {
+	if (offset > 0x3ff)
 		return;
 
-	switch (gba_addr) {
-	case 0x84:
-		real_mem = data;
-		GBA::sound.enableMaster(real_mem >> 7);
-	case 0xba:	//DMA0 control
-		real_mem = data;
-		if (data & 0x8000) {	//DMA enable
-			_dma[0]->enable_dma();
-			_dma[0]->trigger(Dma_Trigger::EMPTY_TRIGGER);
-		}
-		break;
-	case 0xc6:	//DMA1 control
-		real_mem = data;
-		if (data & 0x8000) {	//DMA enable
-			_dma[1]->enable_dma();
-			_dma[1]->trigger(Dma_Trigger::EMPTY_TRIGGER);
-		}
-		break;
-	case 0xd2:	//DMA2 control
-		real_mem = data;
-		if (data & 0x8000) {	//DMA enable
-			_dma[2]->enable_dma();
-			_dma[2]->trigger(Dma_Trigger::EMPTY_TRIGGER);
-		}
-		break;
-	case 0xd6:	//DMA3 control
-		real_mem = data;
-		if (data & 0x8000) {	//DMA enable
-			_dma[3]->enable_dma();
-			_dma[3]->trigger(Dma_Trigger::EMPTY_TRIGGER);
-		}
+	switch (size) {
+	case 1:
+	{
+		int shift = (offset & 1) * 8;
+		writeIoRegister(offset & ~1, data << shift, 0xff << shift);
 		break;
-	case 0x202:	//clearing interrupt flag
-		_ioReg.IF &= ~data;
+	}
+	case 2:
+		writeIoRegister(offset & ~1, data, 0xffff);
 		break;
 	default:
-		real_mem = data;
+		writeIoRegister(offset & ~3, data, 0xffff);
+		writeIoRegister((offset & ~3) + 2, data >> 16, 0xffff);
 		break;
 	}
 }
 
-void MemoryMapper::write_register(uint32_t gba_addr, 
-	uint32_t& real_mem, uint32_t data) {
-	if (gba_addr > 0x3fe)
-		return;
+void MemoryMapper::writeIoRegister(uint32_t offset, uint16_t data, uint16_t mask) {
+	const IoRegister& reg = _ioRegisters[offset / 2];
 
-	switch (gba_addr) {
-	case 0xa0:
-		writeFifo(data, 0);
-		break;
-	case 0xa4:
-		writeFifo(data, 1);
-		break;
-	case 0xb8:	//DMA0 control
-		real_mem = data;
-		if (data & 0x80000000) {	//DMA enable
-			_dma[0]->enable_dma();
-			_dma[0]->trigger(Dma_Trigger::EMPTY_TRIGGER);
-		}
-		break;
-	case 0xc4:	//DMA1 control
-		real_mem = data;
-		if (data & 0x80000000) {	//DMA enable
-			_dma[1]->enable_dma();
-			_dma[1]->trigger(Dma_Trigger::EMPTY_TRIGGER);
-		}
-		break;
-	case 0xd0:	//DMA2 control
-		real_mem = data;
-		if (data & 0x80000000) {	//DMA enable
-			_dma[2]->enable_dma();
-			_dma[2]->trigger(Dma_Trigger::EMPTY_TRIGGER);
+	if (reg.write != nullptr) {
+		(this->*reg.write)(offset, data, mask);
+	}
+	else {
+		uint16_t* value = get_io_reg(offset);
+		uint16_t bits = mask & reg.writeMask;
+		*value = (*value & ~bits) | (data & bits);
+	}
+
+	if (reg.sideEffect != nullptr)
+		(this->*reg.sideEffect)(offset, data, mask);
+}
+
+void MemoryMapper::syncVolatile(uint32_t /*offset*/) {
+	GBA::clock.syncSound();
+	_volatileAccesses++;
+}
+
+//interrupts are acknowledged by writing 1 to their flag
+void MemoryMapper::writeIF(uint32_t /*offset*/, uint16_t data, uint16_t mask) {
+	_ioReg.IF &= ~(data & mask);
+}
+
+void MemoryMapper::writeSoundMaster(uint32_t offset, uint16_t /*data*/, uint16_t /*mask*/) {
+	GBA::sound.enableMaster(*get_io_reg(offset) >> 7);
+}
+
+//the fifo takes the word once its high halfword is written
+void MemoryMapper::writeFifoHigh(uint32_t offset, uint16_t /*data*/, uint16_t mask) {
+	if (mask & 0xff00)
+		writeFifo(*(uint32_t*)get_io_reg(offset - 2), offset == 0xa2 ? 0 : 1);
+}
+
+//the enable bit going from 0 to 1 latches the channel, which either starts or waits for its trigger
+void MemoryMapper::writeDmaControl(uint32_t offset, uint16_t data, uint16_t mask) {
+	int channel = (offset - 0xba) / 12;
+	Dma* dma = _dma[channel].get();
+
+	if (mask & 0x8000) {
+		if (!(data & 0x8000)) {	//DMA disable
+			dma->disable();
+			_dmaRequests &= ~(1 << channel);
 		}
-		break;
-	case 0xd4:	//DMA3 control
-		real_mem = data;
-		if (data & 0x80000000) {	//DMA enable
-			_dma[3]->enable_dma();
-			_dma[3]->trigger(Dma_Trigger::EMPTY_TRIGGER);
+		else if (!dma->isEnabled()) {	//DMA enable
+			dma->enable_dma();
+			if (dma->getTrigger() == Dma_Trigger::EMPTY_TRIGGER)
+				requestDma(channel);
 		}
-		break;
-	case 0x84:
-		real_mem = data;
-		GBA::sound.enableMaster(real_mem >> 7);
-	default:
-		real_mem = data;
-		break;
 	}
-}
\ No newline at end of file
+	updateDmaTriggers();	//the timing may have changed
+}
+
+void MemoryMapper::writeWaitcnt(uint32_t /*offset*/, uint16_t /*data*/, uint16_t /*mask*/) {
+	mapGamePak();	//update the rom access timings
+}
+
+//postflg in the low byte, haltcnt in the high one
+void MemoryMapper::writeHaltcnt(uint32_t /*offset*/, uint16_t data, uint16_t mask) {
+	if (mask & 0xff00)
+		GBA::cpu.halt(data & 0x8000);
+}
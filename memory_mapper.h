@@ -3,12 +3,13 @@
 
 #include "cartridge.h"
 #include "io_registers.h"
-class Dma;
-enum Dma_Trigger;
+#include "fastmem.h"
+#include "dma.h"
 
 #include <string>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 struct WaitCnt {
 	uint16_t sram : 2,	//game pak ram wait control
@@ -31,9 +32,63 @@ struct realAddress {
 	const int* accessTimings;
 };
 
+//host memory behind a page of the gba address space
+struct MemoryPage {
+	uint8_t* memory;	//nullptr: io, sram and unused memory go through the slow path
+	uint32_t mask;	//address bits that index memory
+	uint8_t accessTimings[3];	//8, 16 and 32 bit access
+	bool writable;
+};
+
+//host memory that instructions are fetched from, valid until the page table changes
+struct FetchWindow {
+	const uint8_t* memory;	//nullptr: fetches go through read_16/read_32
+	uint32_t start;	//gba address of memory[0]
+	uint32_t size;
+	uint8_t accessTimings[3];
+	uint32_t generation;	//page table it was taken from
+};
+
+//byte overwritten while the write log is on
+struct LoggedWrite {
+	uint32_t address;
+	uint8_t old;
+};
+
 struct gamePakAddr {
 	bool inGamePak;
-	int accessTiming;
+	const uint8_t* accessTimings;	//8, 16 and 32 bit non sequential access
+};
+
+//game pak access ticks for the current WAITCNT, rebuilt when it's written
+struct GamePakTimings {
+	uint8_t nonSequential[3];	//8, 16 and 32 bit access
+	uint8_t sequential[3];
+};
+
+//the game pak prefetch buffer keeps reading the next halfwords while the cpu doesn't use the bus
+struct PrefetchBuffer {
+	uint32_t address;	//address of the first buffered halfword
+	uint32_t count;	//buffered halfwords
+	unsigned long long ticks;	//timestamp where the next halfword started loading
+};
+
+//direct sound fifo: 32 signed 8 bit samples, words are pushed 4 samples at a time
+class SoundFifo {
+public:
+	static const uint32_t CAPACITY = 32;
+	static const uint32_t REFILL_LEVEL = 16;	//dma asks for 4 more words from here
+
+	SoundFifo();
+	void push(uint32_t word);
+	int8_t pop();
+	uint32_t size() const;
+	uint32_t getUnderruns() const;
+	void clear();
+private:
+	int8_t _samples[CAPACITY];
+	uint32_t _read, _write;	//free running, wrapped on access
+	uint32_t _underruns;	//samples played while empty
 };
 
 const int accessTimings[][3] = {
@@ -59,8 +114,24 @@ const int waitcntAccessTimings[][4] = {
 	{4, 3, 2, 8},		//sram
 };
 
+class MemoryMapper;
+typedef void (MemoryMapper::*IoReadHandler)(uint32_t offset);
+typedef void (MemoryMapper::*IoWriteHandler)(uint32_t offset, uint16_t data, uint16_t mask);
+
+//halfword io register. handlers get the register offset, mask has the bits being written
+struct IoRegister {
+	IoReadHandler read;	//called before a read, nullptr if the value is always up to date
+	IoWriteHandler write;	//replaces the masked store, nullptr for plain registers
+	uint16_t writeMask;	//bits the game can write
+	IoWriteHandler sideEffect;	//called after the store, nullptr if the write does nothing else
+};
+
 class MemoryMapper {
 public:
+	static const uint32_t PAGE_BITS = 14;
+	static const uint32_t PAGE_SIZE = 1 << PAGE_BITS;
+	static const uint32_t PREFETCH_SIZE = 8;	//halfwords
+
 	MemoryMapper();
 	~MemoryMapper();
 	void loadRom(std::string rom_filename);
@@ -68,37 +139,161 @@ public:
 	uint8_t read_8(uint32_t address);
 	uint16_t read_16(uint32_t address);
 	uint32_t read_32(uint32_t address);
+	uint8_t peek_8(uint32_t address);
+	uint16_t peek_16(uint32_t address);
+	uint32_t peek_32(uint32_t address);
+	uint32_t* transferBlock(uint32_t address, uint32_t words, bool write);
+	uint8_t* hostRange(uint32_t address, uint32_t size, bool write);
+	void prepareHostWrite(uint32_t address, uint8_t* host, uint32_t size);
+	int burstTicks(uint32_t address, uint32_t units, uint32_t unitSize);
+	FetchWindow getFetchWindow(uint32_t address);
+	uint32_t getPageGeneration();
+	int fetchTicks(uint32_t address, bool thumb);
+	static bool isGamePakRom(uint32_t address);
 	void write_8(uint32_t address, uint8_t data);
 	void write_16(uint32_t address, uint16_t data);
 	void write_32(uint32_t address, uint32_t data);
 	uint16_t* get_io_reg(uint32_t offset);
 	void setKeyInput(keyinput_struct input);
 	uint32_t getFifo(uint8_t index);
+	int8_t getFifoSample(uint8_t index);
 	void writeFifo(uint32_t val, uint8_t fifo);
+	void refillFifos();
+	const SoundFifo& getSoundFifo(uint8_t index);
 	uint8_t* getMemoryAddr(int chunk);
-	void write_register(uint32_t gba_addr, uint8_t& real_addr, uint8_t data);
-	void write_register(uint32_t gba_addr, uint16_t& real_addr, uint16_t data);
-	void write_register(uint32_t gba_addr, uint32_t& real_addr, uint32_t data);
 	void trigger_dma(Dma_Trigger type);
+	void runDma();
+	bool setFastmem(bool enable);
+	bool isFastmem();
+	bool hasBios();
+	uint32_t getVolatileAccesses();
+	void beginWriteLog();
+	bool endWriteLog();
+	const std::vector<LoggedWrite>& getWriteLog();
+	void rollbackWrites();
 private:
 	//memory
-	std::unique_ptr <uint8_t[]> _bios_mem;
-	std::unique_ptr <uint8_t[]> _e_wram;
-	std::unique_ptr <uint8_t[]> _i_wram;
-	std::unique_ptr <uint8_t[]> _palette_ram;
-	std::unique_ptr <uint8_t[]> _vram;
-	std::unique_ptr <uint8_t[]> _oam;
+	std::unique_ptr <uint8_t[]> _memory;	//all the regions, when they are not in the fastmem arena
+	uint8_t* _bios_mem;
+	uint8_t* _e_wram;
+	uint8_t* _i_wram;
+	uint8_t* _palette_ram;
+	uint8_t* _vram;
+	uint8_t* _oam;
+	Fastmem _fastmem;
 	Cartridge _cartridge;
 	Io_registers _ioReg;
 	uint8_t wave_ram_banks[2][0x10];
 	WaitCnt *WAITCNT;
+	IoRegister _ioRegisters[0x400 / 2];	//0x000-0x3ff, by halfword
+	GamePakTimings _gamePakTimings[4];	//wait states 0-2 and sram
+	PrefetchBuffer _prefetch;
+	uint32_t _nextFetch;	//address after the last game pak instruction fetch
 	std::unique_ptr<Dma> _dma[4];
-	uint32_t fifo[2][8];
-	uint8_t fifoIndex[2];
+	uint8_t _dmaTriggers[VIDEO_CAPTURE + 1];	//channels waiting for each trigger, one bit per channel
+	uint8_t _dmaRequests;	//channels triggered and not done yet. the lowest has the priority
+	SoundFifo _soundFifos[2];	//fifo a and b
+	uint8_t _fifosPlayed;	//fifos their timer took samples from since the last refill, one bit each
+	uint32_t _volatileAccesses;	//accesses to registers that change on their own (sound, timers)
+	bool _hasBios;	//gba_bios.bin loaded, a stub is in its place otherwise
+	MemoryPage _pages[0x10000000 >> PAGE_BITS];	//pages of 0x00000000-0x0fffffff, higher addresses are unused
+	uint8_t* _arena;	//fastmem base, nullptr when fastmem is off
+	const int* _arenaTimings[0x10];	//access ticks of the 16MB regions accessed straight in the arena, nullptr for the others
+	uint32_t _pageGeneration;	//incremented every time pages are remapped
+	bool _logWrites;	//record the plain memory writes to undo them
+	bool _unloggedWrite;	//io, sram or rom written while logging: can't be undone
+	std::vector<LoggedWrite> _writeLog;
+	PrefetchBuffer _loggedPrefetch;	//fetch state when the log started
+	uint32_t _loggedNextFetch;
 
-	void loadBios();
+	bool loadBios();
+	void loadBiosStub();
 	realAddress find_memory_addr(uint32_t gba_address);
 	gamePakAddr inCartridge(uint32_t addr);
+	void syncIo(uint32_t offset);
+	void buildIoTable();
+	void writeIo(uint32_t offset, uint32_t data, int size);
+	void writeIoRegister(uint32_t offset, uint16_t data, uint16_t mask);
+	void syncVolatile(uint32_t offset);
+	void writeIF(uint32_t offset, uint16_t data, uint16_t mask);
+	void writeSoundMaster(uint32_t offset, uint16_t data, uint16_t mask);
+	void writeFifoHigh(uint32_t offset, uint16_t data, uint16_t mask);
+	void writeDmaControl(uint32_t offset, uint16_t data, uint16_t mask);
+	void requestDma(int channel);
+	void updateDmaTriggers();
+	void writeWaitcnt(uint32_t offset, uint16_t data, uint16_t mask);
+	void writeHaltcnt(uint32_t offset, uint16_t data, uint16_t mask);
+	void buildPageTable();
+	void mapGamePak();
+	void buildGamePakTimings();
+	int prefetchTicks(uint32_t address, int halfwords, bool sequential, const GamePakTimings& timings);
+	void mapPages(uint32_t start, uint32_t end, uint8_t* memory, uint32_t size, const int* timings, bool writable);
+	void mapArena(uint32_t start, uint32_t end, const int* timings);
+	void useMemory(uint8_t* bios, uint8_t* ewram, uint8_t* iwram, uint8_t* vram);
+	MemoryPage* findPage(uint32_t address);
+	const int* findArena(uint32_t address);
+	void logWrite(MemoryPage* page, uint32_t address, uint32_t size);
 };
 
+//page mapped to host memory, nullptr if the access needs the slow path
+inline MemoryPage* MemoryMapper::findPage(uint32_t address) {
+	if (address >= 0x10000000)
+		return nullptr;
+
+	MemoryPage* page = &_pages[address >> PAGE_BITS];
+	return page->memory != nullptr ? page : nullptr;
+}
+
+//fastmem: access ticks if _arena[address] is the memory at address, nullptr otherwise.
+//the page after each region is mapped too, an unaligned access at the end can't fault
+inline const int* MemoryMapper::findArena(uint32_t address) {
+	if (_arena == nullptr || address >= 0x10000000)
+		return nullptr;
+	return _arenaTimings[address >> 24];
+}
+
+inline uint32_t MemoryMapper::getPageGeneration() {
+	return _pageGeneration;
+}
+
+//wait states 0-2, where the prefetch buffer and the sequential timings apply
+inline bool MemoryMapper::isGamePakRom(uint32_t address) {
+	return address - 0x08000000 < 0x06000000;
+}
+
+inline SoundFifo::SoundFifo() {
+	clear();
+}
+
+//a full fifo drops the word
+inline void SoundFifo::push(uint32_t word) {
+	if (size() > CAPACITY - 4)
+		return;
+
+	for (int i = 0; i < 4; i++) {
+		_samples[_write++ % CAPACITY] = (int8_t)(word >> (i * 8));
+	}
+}
+
+inline int8_t SoundFifo::pop() {
+	if (_read == _write) {
+		_underruns++;
+		return 0;
+	}
+	return _samples[_read++ % CAPACITY];
+}
+
+inline uint32_t SoundFifo::size() const {
+	return _write - _read;
+}
+
+inline uint32_t SoundFifo::getUnderruns() const {
+	return _underruns;
+}
+
+inline void SoundFifo::clear() {
+	_read = _write = 0;
+	_underruns = 0;
+}
+
 #endif
@@ -0,0 +1,131 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+//the decoded instructions, apart from cpu.h so the decoders build without the rest of the emulator
+
+enum ARM_opcode {
+	ARM_OP_INVALID,
+	ARM_OP_B,	//branches
+	ARM_OP_BL,
+	ARM_OP_BX,
+	ARM_OP_AND,	//alu operations
+	ARM_OP_EOR,
+	ARM_OP_SUB,
+	ARM_OP_RSB,
+	ARM_OP_ADD,
+	ARM_OP_ADC,
+	ARM_OP_SBC,
+	ARM_OP_RSC,
+	ARM_OP_TST,
+	ARM_OP_TEQ,
+	ARM_OP_CMP,
+	ARM_OP_CMN,
+	ARM_OP_ORR,
+	ARM_OP_MOV,
+	ARM_OP_BIC,
+	ARM_OP_MVN,
+	ARM_OP_LDRH,	//load/store halfword
+	ARM_OP_LDRSB,
+	ARM_OP_LDRSH,
+	ARM_OP_STRH,
+	ARM_OP_STM,		//load/store multiple
+	ARM_OP_LDM,
+	ARM_OP_LDR,		//load/store
+	ARM_OP_STR,
+	ARM_OP_MSR,
+	ARM_OP_MRS,
+	ARM_OP_MUL,
+	ARM_OP_MLA,
+	ARM_OP_MULL,	//multiply long
+	ARM_OP_MLAL,		//multiply-accumulate long
+	ARM_OP_UMULL,	//unsigned multiply long
+	ARM_OP_UMLAL,		//unsigned multiply-accumulate long
+	ARM_OP_SWI,		//software interrupt
+	ARM_OP_UNRESOLVED	//lookup table only: depends on bits outside the table index
+};
+
+enum THUMB_opcode {
+	THUMB_OP_INVALID,
+	THUMB_OP_UNDEFINED,
+	THUMB_OP_LSL_IMM,	//logical/arithm shift left
+	THUMB_OP_LSR_IMM,	//logical right shift
+	THUMB_OP_ASR_IMM,	//arithmetic shift right
+	THUMB_OP_MOV_I,	//mov/cmp/add/sub immidiate
+	THUMB_OP_CMP_I,
+	THUMB_OP_ADD_I,
+	THUMB_OP_SUB_I,	
+	THUMB_OP_LDR_PC,	//load pc-relative
+	THUMB_OP_STR_O,	//store register offset
+	THUMB_OP_STRB_O,
+	THUMB_OP_LDR_O,	//load register offset
+	THUMB_OP_LDRB_O,
+	//Alu operations
+	THUMB_OP_AND,
+	THUMB_OP_EOR,
+	THUMB_OP_LSL,
+	THUMB_OP_LSR,
+	THUMB_OP_ASR,
+	THUMB_OP_ADC,
+	THUMB_OP_SBC,
+	THUMB_OP_ROR,
+	THUMB_OP_TST,	//TST
+	THUMB_OP_NEG,
+	THUMB_OP_CMP,
+	THUMB_OP_CMN,
+	THUMB_OP_ORR,
+	THUMB_OP_MUL,
+	THUMB_OP_BIC,
+	THUMB_OP_MVN,	//MVN
+
+	THUMB_OP_ADD_RR,	//add register-register
+	THUMB_OP_SUB_RR,	//sub register-register
+	THUMB_OP_ADD_RI,	//add register-immidiate
+	THUMB_OP_SUB_RI,	//sub register-immidiate
+	THUMB_OP_BEQ,	//conditional branches
+	THUMB_OP_BNE,
+	THUMB_OP_BCS,	
+	THUMB_OP_BCC,
+	THUMB_OP_BMI,
+	THUMB_OP_BPL,
+	THUMB_OP_BVS,
+	THUMB_OP_BVC,
+	THUMB_OP_BHI,
+	THUMB_OP_BLS,
+	THUMB_OP_BGE,
+	THUMB_OP_BLT,
+	THUMB_OP_BGT,
+	THUMB_OP_BLE,
+	THUMB_OP_SWI,	//software interrupt
+	THUMB_OP_ADD_HRR,	//high register add
+	THUMB_OP_CMP_HRR,	//high register compare
+	THUMB_OP_MOV_HRR,	//high register move
+	THUMB_OP_NOP,	//nop (MOV r8, r8)
+	THUMB_OP_BX,	//branch exchange
+	THUMB_OP_PUSH,	//push
+	THUMB_OP_POP,	//pop
+	THUMB_OP_LDMIA,	//load multiple 
+	THUMB_OP_STMIA,	//store multiple
+	THUMB_OP_ADD_SP,	//add offset to sp
+	THUMB_OP_SUB_SP,		//sub offset to sp
+	THUMB_OP_ADD_R_SP,	//get relative address from sp
+	THUMB_OP_ADD_R_PC,	//get relative address from pc
+	THUMB_OP_STR_SP,	//store sp-relative
+	THUMB_OP_LDR_SP,	//load sp-relative
+	THUMB_OP_LDRH,	//load halfword
+	THUMB_OP_STRH,	//store halfword
+	THUMB_OP_B,	//unconditional branch
+	THUMB_OP_BL_F,	//long branch with link
+	THUMB_OP_BL_LR_IMM,
+	THUMB_OP_STR_I,	//load/store immidiate offset
+	THUMB_OP_LDR_I,
+	THUMB_OP_STRB_I,
+	THUMB_OP_LDRB_I,
+
+	//THUMB.8: load store sign-extended byte halfword
+	THUMB_OP_STRH_R,	
+	THUMB_OP_LDSB_R,
+	THUMB_OP_LDRH_R,
+	THUMB_OP_LDSH_R
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "scheduler.h"
+
+#include <cstdint>
+#include <algorithm>
+
+Scheduler::Scheduler() {
+	clear();
+}
+
+//heap order: the earliest event on top
+bool Scheduler::later(const Event& a, const Event& b) {
+	return a.timestamp > b.timestamp;
+}
+
+//schedule an event at an absolute tick. replaces the pending event of the same type
+void Scheduler::schedule(Event_Type type, unsigned long long timestamp) {
+	if (_scheduled[type])
+		cancel(type);
+
+	_events.push_back({ timestamp, type });
+	std::push_heap(_events.begin(), _events.end(), later);
+	_scheduled[type] = true;
+}
+
+void Scheduler::cancel(Event_Type type) {
+	if (!_scheduled[type])
+		return;
+
+	for (size_t i = 0; i < _events.size(); i++) {
+		if (_events[i].type == type) {
+			_events.erase(_events.begin() + i);
+			break;
+		}
+	}
+	std::make_heap(_events.begin(), _events.end(), later);	//only a handful of events
+	_scheduled[type] = false;
+}
+
+bool Scheduler::isScheduled(Event_Type type) {
+	return _scheduled[type];
+}
+
+//timestamp of the pending event of a type, NO_EVENT if it isn't scheduled
+unsigned long long Scheduler::getTimestamp(Event_Type type) {
+	for (const Event& event : _events) {
+		if (event.type == type)
+			return event.timestamp;
+	}
+	return NO_EVENT;
+}
+
+//remove the earliest event and return its type
+Event_Type Scheduler::pop() {
+	std::pop_heap(_events.begin(), _events.end(), later);
+	Event_Type type = _events.back().type;
+	_events.pop_back();
+	_scheduled[type] = false;
+	return type;
+}
+
+void Scheduler::clear() {
+	_events.clear();
+	for (int i = 0; i < EVENT_COUNT; i++) {
+		_scheduled[i] = false;
+	}
+}
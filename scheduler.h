@@ -0,0 +1,54 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <vector>
+
+enum Event_Type {
+	EVENT_HBLANK = 0,		//end of h-draw
+	EVENT_LINE_END = 1,		//end of h-blank, next scanline
+	EVENT_SOUND = 2,		//pass the elapsed ticks to the fifo timers
+	EVENT_DMA = 3,			//run the requested dma channels
+	EVENT_COUNT
+};
+
+//min-heap of timestamped events. every type has at most one pending event
+class Scheduler {
+public:
+	static const unsigned long long NO_EVENT = ~0ull;
+
+	Scheduler();
+	void schedule(Event_Type type, unsigned long long timestamp);
+	void cancel(Event_Type type);
+	bool isScheduled(Event_Type type);
+	unsigned long long getTimestamp(Event_Type type);
+	unsigned long long getNextTimestamp();
+	Event_Type getNextType();
+	Event_Type pop();
+	void clear();
+private:
+	struct Event {
+		unsigned long long timestamp;
+		Event_Type type;
+	};
+
+	std::vector<Event> _events;
+	bool _scheduled[EVENT_COUNT];
+
+	static bool later(const Event& a, const Event& b);
+};
+
+//timestamp of the earliest event, NO_EVENT if nothing is scheduled
+inline unsigned long long Scheduler::getNextTimestamp() {
+	if (_events.empty())
+		return NO_EVENT;
+	return _events.front().timestamp;
+}
+
+inline Event_Type Scheduler::getNextType() {
+	if (_events.empty())
+		return EVENT_COUNT;
+	return _events.front().type;
+}
+
+#endif
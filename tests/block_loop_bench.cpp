@@ -0,0 +1,112 @@
+//times Cpu::runFor on a synthetic thumb loop, then on the first frames of the game
+//when "Kirby - Nightmare in Dreamland.gba" is in the working directory.
+//build it before and after a change to the block loop and compare.
+//the loop also runs from iwram, through the block cache, and from vram, which isn't cacheable and runs
+//one instruction at a time: both fetch in one tick, so the two run the same guest code in the same ticks
+
+#include "test_gba.h"
+
+#include <chrono>
+
+using namespace TestGba;
+
+const char* const GAME = "Kirby - Nightmare in Dreamland.gba";
+const uint32_t FRAME_TICKS = 280896;
+const uint32_t DATA = 0x03000000;	//written by the loop
+const uint32_t IWRAM_CODE = 0x03001000;
+const uint32_t VRAM_CODE = 0x06000000;
+
+//a 14 instruction thumb block that loops forever: alu ops, iwram loads and stores and a conditional branch.
+//it writes memory, so it isn't skipped as an idle loop. position independent
+static std::vector<uint8_t> thumbLoop() {
+	std::vector<uint8_t> code;
+	put16(code, 0x2203);	//movs r2, #3
+	put16(code, 0x0612);	//lsls r2, r2, #24
+	put16(code, 0x2000);	//movs r0, #0
+	put16(code, 0x3001);	//loop: adds r0, #1
+	put16(code, 0x0081);	//lsls r1, r0, #2
+	put16(code, 0x4041);	//eors r1, r0
+	put16(code, 0x6011);	//str r1, [r2]
+	put16(code, 0x6854);	//ldr r4, [r2, #4]
+	put16(code, 0x1864);	//adds r4, r4, r1
+	put16(code, 0x6054);	//str r4, [r2, #4]
+	put16(code, 0x1a25);	//subs r5, r4, r0
+	put16(code, 0x430d);	//orrs r5, r1
+	put16(code, 0x08ee);	//lsrs r6, r5, #3
+	put16(code, 0x4286);	//cmp r6, r0
+	put16(code, 0xd800);	//bhi skip
+	put16(code, 0x1837);	//adds r7, r6, r0
+	put16(code, 0xe7f1);	//skip: b loop
+	return code;
+}
+
+//vram ignores 8 bit writes
+static void writeBytes16(uint32_t address, const std::vector<uint8_t>& data) {
+	for (size_t i = 0; i < data.size(); i += 2) {
+		GBA::memory.write_16(address + i, data[i] | (data[i + 1] << 8));
+	}
+}
+
+//run the loop from the rom, or copy it to address and jump there
+static void loadLoop(uint32_t address) {
+	std::vector<uint8_t> code;
+	std::vector<uint8_t> loop = thumbLoop();
+	if (address == CODE_START) {
+		putThumbEntry(code);
+		code.insert(code.end(), loop.begin(), loop.end());
+	}
+	else {
+		put32(code, 0xe59fc000);	//ldr r12, [pc]
+		put32(code, 0xe12fff1c);	//bx r12
+		put32(code, address | 1);
+	}
+	loadRom(code);
+	GBA::memory.write_32(DATA + 4, 0);	//the loop adds to it
+
+	if (address != CODE_START)
+		writeBytes16(address, loop);
+}
+
+//wall time of runFor over the given emulated ticks, in milliseconds
+static double timeRun(uint64_t ticks) {
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t done = 0; done < ticks; done += FRAME_TICKS) {
+		GBA::cpu.runFor(FRAME_TICKS);
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main() {
+	const int frames = 600;	//10 emulated seconds
+	loadLoop(CODE_START);
+	timeRun(60 * FRAME_TICKS);	//warm up
+	printf("thumb loop: %.1f ms for %d frames\n", timeRun(frames * FRAME_TICKS), frames);
+
+	loadLoop(IWRAM_CODE);
+	double cached = timeRun(frames * FRAME_TICKS);
+	uint32_t cachedSum = GBA::memory.read_32(DATA + 4);
+	loadLoop(VRAM_CODE);
+	double uncached = timeRun(frames * FRAME_TICKS);
+	if (GBA::memory.read_32(DATA + 4) != cachedSum) {
+		printf("the iwram and vram loops didn't run the same instructions\n");
+		return 1;
+	}
+	printf("block cache (iwram):       %.1f ms for %d frames\n", cached, frames);
+	printf("one instruction at a time (vram): %.1f ms for %d frames\n", uncached, frames);
+	printf("speedup: %.2fx\n", uncached / cached);
+
+	FILE* game = fopen(GAME, "rb");
+	if (game == nullptr) {
+		printf("%s not found, game boot skipped\n", GAME);
+		return 0;
+	}
+	fclose(game);
+	GBA::memory.loadRom(GAME);
+	GBA::cpu.Reset();
+	BlockCache& cache = GBA::cpu.getBlockCache();
+	uint64_t hits = cache.getHits(), lookups = cache.getLookups();
+	printf("game boot: %.1f ms for %d frames\n", timeRun(frames * FRAME_TICKS), frames);
+	printf("block cache hit rate: %.4f\n", (double)(cache.getHits() - hits) / (cache.getLookups() - lookups));
+	return 0;
+}
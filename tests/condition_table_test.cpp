@@ -0,0 +1,93 @@
+//checks the condition lookup table against the switch it replaced, for every condition and nzcv pair
+//build from the repo root: g++ -std=c++17 -I. tests/condition_table_test.cpp -o condition_table_test
+
+#include "condition_table.h"
+
+#include <cstdio>
+
+struct Flags {
+	bool N, Z, C, V;
+};
+
+//the switch of arm_checkInstructionCondition before the table
+static bool checkConditionSwitch(uint8_t condition, const Flags& f) {
+	bool condition_met = false;
+
+	switch (condition) {
+	case 0:	//EQ (z = 1)
+		condition_met = f.Z == 1;
+		break;
+	case 1:		//NE (z = 0)
+		condition_met = f.Z == 0;
+		break;
+	case 2:		//CS/HS (c = 1)
+		condition_met = f.C == 1;
+		break;
+	case 3:		//CC/LO	(c = 0)
+		condition_met = f.C == 0;
+		break;
+	case 4:		//MI (N = 1) negative
+		condition_met = f.N == 1;
+		break;
+	case 5:		//PL (N = 0) >= 0
+		condition_met = f.N == 0;
+		break;
+	case 6:		//VS (V = 1) overflow
+		condition_met = f.V == 1;
+		break;
+	case 7:		//VC (V = 0) no overflow
+		condition_met = f.V == 0;
+		break;
+	case 8:		//HI (C = 1 and Z = 0)	unsigned higher
+		condition_met = (f.C == 1) && (f.Z == 0);
+		break;
+	case 9:		//LS (C = 0 or Z=1)	unsigned lower or same
+		condition_met = (f.C == 0) || (f.Z == 1);
+		break;
+	case 0xa:	//GE (N = V) signed greater or equal
+		condition_met = f.N == f.V;
+		break;
+	case 0xb:	//LT (N!=V)	signed less than
+		condition_met = f.N != f.V;
+		break;
+	case 0xc:	//GT (Z=0 and N=V)	signed greater than
+		condition_met = (f.Z == 0) && (f.N == f.V);
+		break;
+	case 0xd:	//LE (Z=1 or N!=V)	signed less or equal
+		condition_met = (f.Z == 1) || (f.N != f.V);
+		break;
+	case 0xe:	//AL always
+		condition_met = true;
+		break;
+	case 0xf:	//NV never
+		condition_met = false;
+		break;
+	}
+
+	return condition_met;
+}
+
+int main() {
+	constexpr std::array<uint16_t, 16> table = buildConditionTable();
+	int failures = 0;
+
+	for (int cond = 0; cond < 16; cond++) {
+		for (int nzcv = 0; nzcv < 16; nzcv++) {
+			Flags f = { (nzcv & 8) != 0, (nzcv & 4) != 0, (nzcv & 2) != 0, (nzcv & 1) != 0 };
+			bool expected = checkConditionSwitch(cond, f);
+			bool got = (table[cond] >> nzcv) & 1;
+
+			if (got != expected) {
+				printf("condition 0x%x nzcv 0x%x: table %d, switch %d\n", cond, nzcv, got, expected);
+				failures++;
+			}
+		}
+	}
+
+	if (failures) {
+		printf("%d of 256 condition/flag pairs differ\n", failures);
+		return 1;
+	}
+	printf("all 256 condition/flag pairs match\n");
+	return 0;
+}
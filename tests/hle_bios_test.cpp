@@ -0,0 +1,295 @@
+//runs bios calls through gba_bios.bin and through the native versions (--hle-bios) from the same state,
+//and compares the memory they write and r0-r3 byte for byte. skipped without gba_bios.bin in the working directory
+
+#include "test_gba.h"
+
+#include <cstring>
+
+using namespace TestGba;
+
+const uint32_t INPUT = 0x02000000;
+const uint32_t OUTPUT = 0x02020000;
+const uint32_t VRAM = 0x06000000;
+const uint32_t REGISTERS = 0x03006000;	//r0-r3 before and after the call
+const uint32_t LOOP = CODE_START + 16;
+
+struct BiosCall {
+	std::string name;
+	uint8_t number;
+	uint32_t r[4];
+	std::vector<uint8_t> input;	//at INPUT
+	uint32_t output;	//compared area, filled with 0xcc before the call
+	uint32_t outputSize;
+};
+
+//ldmia the registers, swi, stmia them back and loop
+static std::vector<uint8_t> callProgram(uint8_t number) {
+	std::vector<uint8_t> code;
+	put32(code, 0xe59f400c);	//ldr r4, =REGISTERS
+	put32(code, 0xe894000f);	//ldmia r4, {r0-r3}
+	put32(code, 0xef000000 | (number << 16));	//swi number
+	put32(code, 0xe884000f);	//stmia r4, {r0-r3}
+	put32(code, ARM_B_SELF);	//LOOP
+	put32(code, REGISTERS);
+	return code;
+}
+
+//the compared area then r0-r3, empty if the call didn't return
+static std::vector<uint8_t> run(const BiosCall& call, bool hle) {
+	loadRom(callProgram(call.number));
+	GBA::cpu.setHleBios(hle);
+	fill16(call.output, call.outputSize, 0xcccc);
+	writeBytes(INPUT, call.input);
+	for (int i = 0; i < 4; i++) {
+		GBA::memory.write_32(REGISTERS + i * 4, call.r[i]);
+	}
+
+	if (!runUntil(LOOP, 50000000))
+		return {};
+	std::vector<uint8_t> result = readBytes(call.output, call.outputSize);
+	std::vector<uint8_t> registers = readBytes(REGISTERS, 16);
+	result.insert(result.end(), registers.begin(), registers.end());
+	return result;
+}
+
+//bytes with runs and repeated strings, so that every compressor has something to do
+static std::vector<uint8_t> sampleData(uint32_t size, uint32_t seed) {
+	std::vector<uint8_t> data;
+	while (data.size() < size) {
+		seed = seed * 1664525 + 1013904223;
+		uint32_t kind = seed >> 30;
+		uint32_t length = ((seed >> 20) & 0x1f) + 1;
+		for (uint32_t i = 0; i < length && data.size() < size; i++) {
+			if (kind == 0)	//run
+				data.push_back(seed >> 8);
+			else if (kind == 1 && data.size() > 64)	//repeat
+				data.push_back(data[data.size() - 1 - ((seed >> 12) & 0x3f)]);
+			else
+				data.push_back((seed >> 8) + i * 37);
+		}
+	}
+	return data;
+}
+
+static void putHeader(std::vector<uint8_t>& out, uint8_t type, uint32_t size) {
+	put32(out, type | (size << 8));
+}
+
+static void padWord(std::vector<uint8_t>& out) {
+	while (out.size() & 3) {
+		out.push_back(0);
+	}
+}
+
+//greedy lz77. vram: no copy from 1 byte back, the bios can't read it back from a halfword not written yet
+static std::vector<uint8_t> compressLz77(const std::vector<uint8_t>& data, bool vram) {
+	std::vector<uint8_t> out;
+	putHeader(out, 0x10, data.size());
+	size_t pos = 0;
+	while (pos < data.size()) {
+		size_t flags = out.size();
+		out.push_back(0);
+		for (int block = 0; block < 8 && pos < data.size(); block++) {
+			size_t bestLength = 0, bestDisp = 0;
+			for (size_t disp = vram ? 2 : 1; disp <= 0x1000 && disp <= pos; disp++) {
+				size_t length = 0;
+				while (length < 18 && pos + length < data.size() && data[pos + length] == data[pos + length - disp]) {
+					length++;
+				}
+				if (length > bestLength) {
+					bestLength = length;
+					bestDisp = disp;
+				}
+			}
+			if (bestLength >= 3) {
+				out[flags] |= 0x80 >> block;
+				out.push_back(((bestLength - 3) << 4) | ((bestDisp - 1) >> 8));
+				out.push_back((bestDisp - 1) & 0xff);
+				pos += bestLength;
+			}
+			else {
+				out.push_back(data[pos++]);
+			}
+		}
+	}
+	padWord(out);
+	return out;
+}
+
+static std::vector<uint8_t> compressRunLength(const std::vector<uint8_t>& data) {
+	std::vector<uint8_t> out;
+	putHeader(out, 0x30, data.size());
+	size_t pos = 0;
+	while (pos < data.size()) {
+		size_t run = 1;
+		while (run < 130 && pos + run < data.size() && data[pos + run] == data[pos]) {
+			run++;
+		}
+		if (run >= 3) {
+			out.push_back(0x80 | (run - 3));
+			out.push_back(data[pos]);
+			pos += run;
+			continue;
+		}
+
+		size_t start = pos;
+		while (pos < data.size() && pos - start < 128) {
+			if (pos + 2 < data.size() && data[pos] == data[pos + 1] && data[pos] == data[pos + 2])
+				break;
+			pos++;
+		}
+		out.push_back(pos - start - 1);
+		out.insert(out.end(), data.begin() + start, data.begin() + pos);
+	}
+	padWord(out);
+	return out;
+}
+
+//huffman with a balanced tree of 16 leaves: every unit is coded on 4 bits, its index in leaves.
+//bits: 4 or 8, the units are the nibbles (low first) or the bytes of data, and all must be in leaves
+static std::vector<uint8_t> compressHuffman(const std::vector<uint8_t>& data, int bits, const uint8_t* leaves) {
+	std::vector<uint8_t> out;
+	putHeader(out, 0x20 | bits, data.size());
+
+	//nodes stored like a heap: the children of node i are 2i and 2i + 1, the leaves 16-31
+	uint8_t tree[32];
+	tree[0] = sizeof(tree) / 2 - 1;
+	for (int i = 1; i < 16; i++) {
+		tree[i] = (2 * i - (i & ~1) - 2) / 2 | (i >= 8 ? 0xc0 : 0);
+	}
+	for (int i = 0; i < 16; i++) {
+		tree[16 + i] = leaves[i];
+	}
+	out.insert(out.end(), tree, tree + sizeof(tree));
+
+	uint32_t word = 0;
+	int used = 0;
+	for (size_t i = 0; i < data.size() * 8 / bits; i++) {
+		uint8_t unit = bits == 8 ? data[i] : (data[i / 2] >> ((i & 1) * 4)) & 0xf;
+		uint32_t code = std::find(leaves, leaves + 16, unit) - leaves;
+		word |= code << (28 - used);
+		used += 4;
+		if (used == 32) {
+			put32(out, word);
+			word = 0;
+			used = 0;
+		}
+	}
+	if (used != 0)
+		put32(out, word);
+	return out;
+}
+
+static std::vector<uint8_t> words(std::initializer_list<uint32_t> values) {
+	std::vector<uint8_t> out;
+	for (uint32_t value : values) {
+		put32(out, value);
+	}
+	return out;
+}
+
+static std::vector<BiosCall> calls() {
+	std::vector<BiosCall> list;
+	std::vector<uint8_t> data = sampleData(0x800, 1);
+	std::vector<uint8_t> words16 = sampleData(0x100, 2);
+
+	int32_t divs[][2] = { { 1000000, -37 }, { -7, 2 }, { 5, 7 }, { (int32_t)0x80000000, 3 }, { -1000, -1 } };
+	for (auto& d : divs) {
+		list.push_back({ "Div " + std::to_string(d[0]) + "/" + std::to_string(d[1]), 0x06, { (uint32_t)d[0], (uint32_t)d[1] }, {}, OUTPUT, 4 });
+		list.push_back({ "DivArm " + std::to_string(d[0]) + "/" + std::to_string(d[1]), 0x07, { (uint32_t)d[1], (uint32_t)d[0] }, {}, OUTPUT, 4 });
+	}
+	for (uint32_t n : { 0u, 1u, 2u, 15u, 16u, 123456789u, 0xffffffffu }) {
+		list.push_back({ "Sqrt " + std::to_string(n), 0x08, { n }, {}, OUTPUT, 4 });
+	}
+	for (int32_t tan : { 0, 0x1000, -0x1000, 0x3fff, -0x4000 }) {
+		list.push_back({ "ArcTan " + std::to_string(tan), 0x09, { (uint32_t)tan }, {}, OUTPUT, 4 });
+	}
+	int32_t points[][2] = { { 0x100, 0x100 }, { -0x4000, 0x10 }, { 0, -5 }, { 7, 0 }, { -3, -3 }, { 0x10, -0x3000 } };
+	for (auto& p : points) {
+		list.push_back({ "ArcTan2 " + std::to_string(p[0]) + "," + std::to_string(p[1]), 0x0a, { (uint32_t)p[0], (uint32_t)p[1] }, {}, OUTPUT, 4 });
+	}
+
+	list.push_back({ "CpuSet copy 16", 0x0b, { INPUT + 2, OUTPUT, 77 }, words16, OUTPUT, 0x100 });
+	list.push_back({ "CpuSet copy 32", 0x0b, { INPUT, OUTPUT, 0x04000000 | 50 }, words16, OUTPUT, 0x100 });
+	list.push_back({ "CpuSet fill 16", 0x0b, { INPUT + 6, OUTPUT + 2, 0x01000000 | 33 }, words16, OUTPUT, 0x100 });
+	list.push_back({ "CpuSet fill 32", 0x0b, { INPUT + 4, OUTPUT, 0x05000000 | 21 }, words16, OUTPUT, 0x100 });
+	list.push_back({ "CpuSet from the bios", 0x0b, { 0x100, OUTPUT, 16 }, words16, OUTPUT, 0x100 });
+	list.push_back({ "CpuFastSet copy", 0x0c, { INPUT, OUTPUT, 20 }, words16, OUTPUT, 0x100 });
+	list.push_back({ "CpuFastSet fill", 0x0c, { INPUT + 8, OUTPUT, 0x01000000 | 9 }, words16, OUTPUT, 0x100 });
+	list.push_back({ "CpuFastSet from the bios", 0x0c, { 0x100, OUTPUT, 16 }, words16, OUTPUT, 0x100 });
+
+	//center x, y (8.8), display x, y, scale x, y (8.8), angle
+	std::vector<uint8_t> bg = words({ 0x1000, 0x2000, (16 << 16) | 8, 0x100 | (0x200 << 16), 0x4000,
+		(uint32_t)-0x3400, 0x7100, (0xfff0 << 16) | 3, 0x80 | (0xff40 << 16), 0xc321 });
+	list.push_back({ "BgAffineSet", 0x0e, { INPUT, OUTPUT, 2 }, bg, OUTPUT, 0x20 });
+	//scale x, y (8.8), angle
+	std::vector<uint8_t> obj = words({ 0x100 | (0x200 << 16), 0x2000, (0xff80 << 16) | 0x40, 0x9abc });
+	list.push_back({ "ObjAffineSet packed", 0x0f, { INPUT, OUTPUT, 2, 2 }, obj, OUTPUT, 0x10 });
+	list.push_back({ "ObjAffineSet oam", 0x0f, { INPUT, OUTPUT + 6, 2, 8 }, obj, OUTPUT, 0x40 });
+
+	list.push_back({ "LZ77UnCompWram", 0x11, { INPUT, OUTPUT }, compressLz77(data, false), OUTPUT, 0x900 });
+	list.push_back({ "LZ77UnCompVram", 0x12, { INPUT, VRAM }, compressLz77(data, true), VRAM, 0x900 });
+	list.push_back({ "LZ77 from the bios", 0x11, { 0x100, OUTPUT }, {}, OUTPUT, 0x100 });
+	list.push_back({ "RLUnCompWram", 0x14, { INPUT, OUTPUT }, compressRunLength(data), OUTPUT, 0x900 });
+	list.push_back({ "RLUnCompVram", 0x15, { INPUT, VRAM }, compressRunLength(std::vector<uint8_t>(data.begin(), data.begin() + 0x3ff)), VRAM, 0x500 });
+
+	uint8_t nibbles[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+	list.push_back({ "HuffUnComp 4 bit", 0x13, { INPUT, OUTPUT }, compressHuffman(data, 4, nibbles), OUTPUT, 0x900 });
+	uint8_t bytes[16] = { 0x00, 0x11, 0x7f, 0x80, 0xff, 0x23, 0x42, 0x55, 0x5a, 0xa5, 0xc3, 0x3c, 0x01, 0xfe, 0x99, 0x66 };
+	std::vector<uint8_t> coded = data;
+	for (uint8_t& b : coded) {
+		b = bytes[b & 15];
+	}
+	list.push_back({ "HuffUnComp 8 bit", 0x13, { INPUT, OUTPUT }, compressHuffman(coded, 8, bytes), OUTPUT, 0x900 });
+
+	list.push_back({ "RegisterRamReset ewram", 0x01, { 0x01 }, {}, 0x02000000, 0x40000 });
+	list.push_back({ "RegisterRamReset iwram", 0x01, { 0x02 }, {}, 0x03000000, 0x6000 });
+	list.push_back({ "RegisterRamReset palette", 0x01, { 0x04 }, {}, 0x05000000, 0x400 });
+	list.push_back({ "RegisterRamReset vram", 0x01, { 0x08 }, {}, 0x06000000, 0x18000 });
+	list.push_back({ "RegisterRamReset oam", 0x01, { 0x10 }, {}, 0x07000000, 0x400 });
+	return list;
+}
+
+int main() {
+	if (!GBA::memory.hasBios()) {
+		printf("gba_bios.bin not found, skipped\n");
+		return 0;
+	}
+
+	int failures = 0;
+	std::vector<BiosCall> list = calls();
+	for (const BiosCall& call : list) {
+		std::vector<uint8_t> bios = run(call, false);
+		std::vector<uint8_t> hle = run(call, true);
+
+		if (bios.empty()) {
+			printf("%s: the bios didn't return\n", call.name.c_str());
+			failures++;
+			continue;
+		}
+		if (hle.empty()) {
+			printf("%s: the hle call didn't return\n", call.name.c_str());
+			failures++;
+			continue;
+		}
+
+		size_t diff = std::mismatch(bios.begin(), bios.end(), hle.begin()).first - bios.begin();
+		if (diff == bios.size()) {
+			printf("%s: ok\n", call.name.c_str());
+			continue;
+		}
+		if (diff >= call.outputSize)
+			printf("%s: r%d differs, bios %08x hle %08x\n", call.name.c_str(), (int)(diff - call.outputSize) / 4,
+				*(uint32_t*)&bios[call.outputSize + (diff - call.outputSize) / 4 * 4], *(uint32_t*)&hle[call.outputSize + (diff - call.outputSize) / 4 * 4]);
+		else
+			printf("%s: %08x differs, bios %02x hle %02x\n", call.name.c_str(), (uint32_t)(call.output + diff), bios[diff], hle[diff]);
+		failures++;
+	}
+
+	if (failures) {
+		printf("%d of %d calls differ\n", failures, (int)list.size());
+		return 1;
+	}
+	printf("all %d calls match\n", (int)list.size());
+	return 0;
+}
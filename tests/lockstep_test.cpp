@@ -0,0 +1,109 @@
+//runs a short thumb then arm block sequence with --lockstep, on the interpreter and on the recompiler when it is available.
+//every block is replayed by the reference interpreter: a difference stops the program with a critical error
+
+#include "test_gba.h"
+
+using namespace TestGba;
+
+const uint32_t RESULT = 0x03001000;	//r0-r12 at the end
+const uint32_t END = CODE_START + 0x74;
+
+//a thumb loop that calls a subroutine, then an arm loop over the words it stored
+static std::vector<uint8_t> program() {
+	std::vector<uint8_t> code;
+	putThumbEntry(code);
+	put16(code, 0x2000);	//movs r0, #0
+	put16(code, 0x2500);	//movs r5, #0
+	put16(code, 0x2164);	//movs r1, #100
+	put16(code, 0x2203);	//movs r2, #3
+	put16(code, 0x0612);	//lsls r2, r2, #24
+	put16(code, 0x1840);	//tloop: adds r0, r0, r1
+	put16(code, 0x0043);	//lsls r3, r0, #1
+	put16(code, 0x404b);	//eors r3, r1
+	put16(code, 0x6013);	//str r3, [r2]
+	put16(code, 0x6050);	//str r0, [r2, #4]
+	put16(code, 0x6814);	//ldr r4, [r2]
+	put16(code, 0x3208);	//adds r2, #8
+	put16(code, 0xf000);	//bl tsub
+	put16(code, 0xf804);
+	put16(code, 0x3901);	//subs r1, #1
+	put16(code, 0xd1f4);	//bne tloop
+	put16(code, 0xa303);	//adr r3, arm_code
+	put16(code, 0x4718);	//bx r3
+	put16(code, 0xb510);	//tsub: push {r4, lr}
+	put16(code, 0x1c04);	//adds r4, r0, #0
+	put16(code, 0x400c);	//ands r4, r1
+	put16(code, 0x4325);	//orrs r5, r4
+	put16(code, 0xbd10);	//pop {r4, pc}
+	put16(code, 0x0000);	//align
+	put32(code, 0xe3a06403);	//arm_code: mov r6, #0x03000000
+	put32(code, 0xe3a07032);	//mov r7, #50
+	put32(code, 0xe8b60300);	//aloop: ldmia r6!, {r8, r9}
+	put32(code, 0xe088a009);	//add r10, r8, r9
+	put32(code, 0xe00b079a);	//mul r11, r10, r7
+	put32(code, 0xe03bc1ea);	//eors r12, r11, r10, ror #3
+	put32(code, 0x4080000c);	//addmi r0, r0, r12
+	put32(code, 0x5045512c);	//subpl r5, r5, r12, lsr #2
+	put32(code, 0xe3570019);	//cmp r7, #25
+	put32(code, 0xc9060021);	//stmdbgt r6, {r0, r5}
+	put32(code, 0xe2577001);	//subs r7, r7, #1
+	put32(code, 0x1afffff5);	//bne aloop
+	put32(code, 0xe3a06403);	//mov r6, #0x03000000
+	put32(code, 0xe2866a01);	//add r6, r6, #0x1000
+	put32(code, 0xe8861fff);	//stmia r6, {r0-r12}
+	put32(code, ARM_B_SELF);	//END
+	return code;
+}
+
+//r0-r12 stored by the program, empty if it didn't reach the end
+static std::vector<uint8_t> run(CpuBackend backend, bool lockstep) {
+	loadRom(program());
+	GBA::cpu.setBackend(backend);
+	GBA::cpu.setLockstep(lockstep);
+	if (!runUntil(END, 10000000))
+		return {};
+	return readBytes(RESULT, 13 * 4);
+}
+
+static bool finished = false;
+
+int main() {
+	//a lockstep difference exits through printError, after the report
+	atexit([] {
+		if (!finished) {
+			printf("stopped by a lockstep difference\n");
+			_Exit(1);
+		}
+	});
+
+	std::vector<uint8_t> expected = run(CPU_INTERPRETER, false);
+	if (expected.empty()) {
+		printf("the program didn't reach its end\n");
+		finished = true;
+		return 1;
+	}
+
+	std::vector<CpuBackend> backends = { CPU_INTERPRETER };
+	if (Jit::isSupported())
+		backends.push_back(CPU_JIT);
+
+	int failures = 0;
+	for (CpuBackend backend : backends) {
+		const char* name = backend == CPU_JIT ? "recompiler" : "interpreter";
+		std::vector<uint8_t> result = run(backend, true);
+		if (result.empty()) {
+			printf("%s: the program didn't reach its end in lockstep\n", name);
+			failures++;
+		}
+		else if (result != expected) {
+			size_t diff = std::mismatch(expected.begin(), expected.end(), result.begin()).first - expected.begin();
+			printf("%s: r%d differs from the run without lockstep\n", name, (int)diff / 4);
+			failures++;
+		}
+		else
+			printf("%s: ok\n", name);
+	}
+
+	finished = true;
+	return failures ? 1 : 0;
+}
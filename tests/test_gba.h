@@ -0,0 +1,102 @@
+//the emulator core without the window and the input, for the programs in tests/ that run guest code.
+//link them with every .cpp of the repo root except gba.cpp, gba_emulator.cpp, graphics.cpp and input.cpp
+
+#ifndef TEST_GBA_H
+#define TEST_GBA_H
+
+#include "gba.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+//defined by gba.cpp in the emulator
+MemoryMapper GBA::memory;
+Cpu GBA::cpu;
+
+namespace TestGba {
+
+const uint32_t CODE_START = 0x080000c0;	//after the rom header
+const uint32_t ARM_B_SELF = 0xeafffffe;	//b .
+const uint16_t THUMB_B_SELF = 0xe7fe;
+
+inline void put16(std::vector<uint8_t>& code, uint16_t value) {
+	code.push_back(value & 0xff);
+	code.push_back(value >> 8);
+}
+
+inline void put32(std::vector<uint8_t>& code, uint32_t value) {
+	put16(code, value & 0xffff);
+	put16(code, value >> 16);
+}
+
+//arm code that switches to thumb for the code after it, at CODE_START + 8
+inline void putThumbEntry(std::vector<uint8_t>& code) {
+	put32(code, 0xe28fc001);	//add r12, pc, #1
+	put32(code, 0xe12fff1c);	//bx r12
+}
+
+//write a rom with code at CODE_START and a valid header, and load it.
+//the cpu restarts where the bios boot code leaves it, from where the header branch jumps to the code
+inline void loadRom(const std::vector<uint8_t>& code, const std::string& path = "test_rom.gba") {
+	std::vector<uint8_t> rom(0x8000 + code.size(), 0);
+	rom[0] = 0x2e;	//b 0x080000c0
+	rom[3] = 0xea;
+	rom[0xb2] = 0x96;	//fixed value
+	uint16_t checksum = 0;
+	for (int i = 0xa0; i < 0xbc; i++)
+		checksum -= rom[i];
+	rom[0xbd] = (checksum - 0x19) & 0xff;
+	std::copy(code.begin(), code.end(), rom.begin() + (CODE_START - 0x08000000));
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		printf("unable to write %s\n", path.c_str());
+		exit(1);
+	}
+	fwrite(rom.data(), 1, rom.size(), file);
+	fclose(file);
+
+	GBA::memory.loadRom(path);
+	GBA::cpu.Reset();
+	GBA::cpu.skipBios();
+}
+
+//run until the pc is at address, false if it isn't reached within maxTicks
+inline bool runUntil(uint32_t address, unsigned long long maxTicks) {
+	unsigned long long end = GBA::clock.getTicks() + maxTicks;
+	while (GBA::cpu.getPC() != address) {
+		if (GBA::clock.getTicks() >= end)
+			return false;
+		GBA::cpu.runFor(1000);
+	}
+	return true;
+}
+
+inline void writeBytes(uint32_t address, const std::vector<uint8_t>& data) {
+	for (size_t i = 0; i < data.size(); i++) {
+		GBA::memory.write_8(address + i, data[i]);
+	}
+}
+
+//16 bit writes: vram, palette and oam ignore or mirror 8 bit ones
+inline void fill16(uint32_t address, uint32_t size, uint16_t value) {
+	for (uint32_t i = 0; i < size; i += 2) {
+		GBA::memory.write_16(address + i, value);
+	}
+}
+
+inline std::vector<uint8_t> readBytes(uint32_t address, uint32_t size) {
+	std::vector<uint8_t> data(size);
+	for (uint32_t i = 0; i < size; i++) {
+		data[i] = GBA::memory.read_8(address + i);
+	}
+	return data;
+}
+
+}
+
+#endif
@@ -0,0 +1,136 @@
+//a synthetic model of the thumb dispatch: a table built like Cpu::_thumbHandlers against the decode + switch it replaced.
+//it doesn't run the cpu: the handlers are stand-ins of the same cost, so only the dispatch differs
+//and the numbers are an upper bound of what the table saves in the emulator
+//build from the repo root: g++ -std=c++17 -O2 -I. tests/thumb_dispatch_bench.cpp -o thumb_dispatch_bench
+
+#include "thumb_decoder.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+//keep the stand-in handlers out of line, like the real ones
+#if defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+#define THUMB_OPS(X) \
+	X(LSL_IMM) X(LSR_IMM) X(ASR_IMM) X(MOV_I) X(CMP_I) X(ADD_I) X(SUB_I) X(LDR_PC) \
+	X(STR_O) X(STRB_O) X(LDR_O) X(LDRB_O) X(AND) X(EOR) X(LSL) X(LSR) X(ASR) X(ADC) X(SBC) \
+	X(ROR) X(TST) X(NEG) X(CMP) X(CMN) X(ORR) X(MUL) X(BIC) X(MVN) X(ADD_RR) X(SUB_RR) \
+	X(ADD_RI) X(SUB_RI) X(BEQ) X(BNE) X(BCS) X(BCC) X(BMI) X(BPL) X(BVS) X(BVC) X(BHI) \
+	X(BLS) X(BGE) X(BLT) X(BGT) X(BLE) X(SWI) X(ADD_HRR) X(CMP_HRR) X(MOV_HRR) \
+	X(BX) X(PUSH) X(POP) X(LDMIA) X(STMIA) X(ADD_SP) X(SUB_SP) X(ADD_R_SP) X(ADD_R_PC) \
+	X(STR_SP) X(LDR_SP) X(LDRH) X(STRH) X(B) X(BL_F) X(BL_LR_IMM) X(STR_I) X(LDR_I) \
+	X(STRB_I) X(LDRB_I) X(STRH_R) X(LDSB_R) X(LDRH_R) X(LDSH_R)
+
+class Core;
+typedef void (Core::*Handler)(uint16_t opcode);
+
+class Core {
+public:
+	uint32_t r[16] = {};
+
+	//before: decode every instruction, then switch on the result
+	void runSwitch(uint16_t opcode) {
+		switch (ThumbDecoder::decode(opcode)) {
+#define SWITCH_CASE(op) case THUMB_OP_##op: handle<THUMB_OP_##op>(opcode); r[15] += 2; break;
+		THUMB_OPS(SWITCH_CASE)
+#undef SWITCH_CASE
+		case THUMB_OP_NOP: handle<THUMB_OP_MOV_HRR>(opcode); r[15] += 2; break;	//nop is MOV r8, r8
+		default: notImplemented(opcode); break;
+		}
+	}
+
+	//after: one load from the table built at compile time
+	void runTable(uint16_t opcode) {
+		(this->*_handlers[opcode >> 6])(opcode);
+	}
+
+private:
+	template <THUMB_opcode op>
+	BENCH_NOINLINE void handle(uint16_t opcode) {
+		r[op & 7] += opcode ^ op;
+	}
+
+	template <void (Core::*handler)(uint16_t)>
+	void sequential(uint16_t opcode) {
+		(this->*handler)(opcode);
+		r[15] += 2;
+	}
+
+	BENCH_NOINLINE void notImplemented(uint16_t opcode) {
+		r[8] ^= opcode;
+	}
+
+	static constexpr Handler handlerFor(THUMB_opcode instruction) {
+		switch (instruction) {
+#define TABLE_CASE(op) case THUMB_OP_##op: return &Core::sequential<&Core::handle<THUMB_OP_##op>>;
+		THUMB_OPS(TABLE_CASE)
+#undef TABLE_CASE
+		case THUMB_OP_NOP: return &Core::sequential<&Core::handle<THUMB_OP_MOV_HRR>>;	//nop is MOV r8, r8
+		default: return &Core::notImplemented;
+		}
+	}
+
+	static constexpr std::array<Handler, 1024> buildHandlers() {
+		std::array<Handler, 1024> table = {};
+		for (uint16_t i = 0; i < 1024; i++) {
+			table[i] = handlerFor(ThumbDecoder::decode(i << 6));
+		}
+		return table;
+	}
+
+	static const std::array<Handler, 1024> _handlers;
+};
+
+constexpr std::array<Handler, 1024> Core::_handlers = Core::buildHandlers();
+
+template <void (Core::*run)(uint16_t)>
+static double timeRun(Core& core, const std::vector<uint16_t>& program, int passes) {
+	auto start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < passes; pass++) {
+		for (uint16_t opcode : program) {
+			(core.*run)(opcode);
+		}
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (double(passes) * program.size());
+}
+
+int main() {
+	//a fixed pseudo random mix of the implemented encodings
+	std::vector<uint16_t> program;
+	uint32_t seed = 0x12345678;
+	while (program.size() < 4096) {
+		seed = seed * 1664525 + 1013904223;
+		uint16_t opcode = seed >> 16;
+		THUMB_opcode op = ThumbDecoder::decode(opcode);
+		if (op != THUMB_OP_INVALID && op != THUMB_OP_UNDEFINED)
+			program.push_back(opcode);
+	}
+
+	const int passes = 5000;
+	Core switchCore, tableCore;
+	timeRun<&Core::runSwitch>(switchCore, program, passes / 10);	//warm up
+	timeRun<&Core::runTable>(tableCore, program, passes / 10);
+
+	double switchNs = timeRun<&Core::runSwitch>(switchCore, program, passes);
+	double tableNs = timeRun<&Core::runTable>(tableCore, program, passes);
+
+	for (int i = 0; i < 16; i++) {
+		if (switchCore.r[i] != tableCore.r[i]) {
+			printf("r%d differs: switch 0x%08x, table 0x%08x\n", i, switchCore.r[i], tableCore.r[i]);
+			return 1;
+		}
+	}
+
+	printf("decode + switch: %.2f ns/instruction\n", switchNs);
+	printf("handler table:   %.2f ns/instruction\n", tableNs);
+	printf("speedup:         %.2fx\n", switchNs / tableNs);
+	return 0;
+}